@@ -0,0 +1,838 @@
+#include "bench.h"
+#include "scenes.h"
+#include "../bump/broadphase.h"
+#include "../bump/concurrent.h"
+#include "../bump/trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <random>
+#include <regex>
+#include <sstream>
+#include <thread>
+
+namespace Bench
+{
+    /// ------------------------------------------
+    /// -- Auxiliary functions
+    /// ------------------------------------------
+    namespace Aux
+    {
+        inline bool startsWith(const std::string &value, const std::string &prefix)
+        {
+            return value.compare(0, prefix.size(), prefix) == 0;
+        }
+
+        inline std::vector<std::string> split(const std::string &value, const char &separator)
+        {
+            std::vector<std::string> parts;
+            std::stringstream stream(value);
+            std::string part;
+            while (std::getline(stream, part, separator))
+            {
+                if (!part.empty())
+                {
+                    parts.push_back(part);
+                }
+            }
+            return parts;
+        }
+
+        inline double percentile(const std::vector<double> &sorted, const double &fraction)
+        {
+            if (sorted.empty())
+            {
+                return 0;
+            }
+            const std::size_t index = static_cast<std::size_t>(fraction * (sorted.size() - 1) + 0.5);
+            return sorted[std::min(index, sorted.size() - 1)];
+        }
+    }
+
+    /// ------------------------------------------
+    /// -- Classes
+    /// ------------------------------------------
+    State::State(const std::size_t &iterations)
+    {
+        samples.reserve(iterations);
+    }
+
+    void State::merge(const State &other)
+    {
+        samples.insert(samples.end(), other.samples.begin(), other.samples.end());
+    }
+
+    Result State::finish() const
+    {
+        std::vector<double> sorted = samples;
+        std::sort(sorted.begin(), sorted.end());
+
+        Result result;
+        result.iterations = sorted.size();
+        for (const double &sample : sorted)
+        {
+            result.totalNs += sample;
+        }
+        if (!sorted.empty())
+        {
+            result.meanNs = result.totalNs / sorted.size();
+            result.maxNs = sorted.back();
+        }
+        result.p50Ns = Aux::percentile(sorted, 0.50);
+        result.p90Ns = Aux::percentile(sorted, 0.90);
+        result.p99Ns = Aux::percentile(sorted, 0.99);
+        result.itemsPerSecond = result.totalNs > 0 ? result.iterations * 1e9 / result.totalNs : 0;
+        return result;
+    }
+
+    /// ------------------------------------------
+    /// -- Benchmarks
+    /// ------------------------------------------
+    namespace
+    {
+        struct Backend
+        {
+            std::string name;
+            std::function<Bump::World(const SceneData &scene)> create;
+        };
+
+        std::vector<Backend> backends()
+        {
+            return std::vector<Backend>
+            {
+                { "grid", [](const SceneData &scene) { return Bump::World(scene.cellSize); } },
+                { "grid4", [](const SceneData &scene) { return Bump::World(scene.cellSize, 4); } },
+                { "gridTiled", [](const SceneData &scene)
+                    {
+                        return Bump::World(std::unique_ptr<Bump::BroadPhase>(
+                            new Bump::GridBroadPhase(scene.cellSize, 1, Bump::GridBroadPhase::Layout::Tiled)), scene.cellSize);
+                    }
+                },
+                { "tree", [](const SceneData &scene)
+                    {
+                        return Bump::World(std::unique_ptr<Bump::BroadPhase>(new Bump::AabbTreeBroadPhase(4)), scene.cellSize);
+                    }
+                },
+                { "sap", [](const SceneData &scene)
+                    {
+                        return Bump::World(std::unique_ptr<Bump::BroadPhase>(new Bump::SweepAndPruneBroadPhase()), scene.cellSize);
+                    }
+                },
+            };
+        }
+
+        class Runner
+        {
+        public:
+            explicit Runner(const Options &options_) : options(options_), filter(options_.filter)
+            {
+            }
+
+            bool selected(const std::string &name) const
+            {
+                return options.filter.empty() || std::regex_search(name, filter);
+            }
+
+            void report(Result result)
+            {
+                if (options.list)
+                {
+                    std::printf("%s\n", result.name.c_str());
+                    return;
+                }
+
+                if (!options.json)
+                {
+                    std::printf(
+                        "%-40s %12.0f ns %10zu %10.0f %10.0f %10.0f %12.0f %10.3fM/s\n",
+                        result.name.c_str(), result.meanNs, result.iterations,
+                        result.p50Ns, result.p90Ns, result.p99Ns, result.maxNs,
+                        result.itemsPerSecond / 1e6
+                    );
+                    std::fflush(stdout);
+                }
+                results.push_back(std::move(result));
+            }
+
+            void run(const Scene &scene, const Backend &backend, const std::size_t &count)
+            {
+                const std::string suffix = "/" + scene.name + "/" + backend.name + "/" + std::to_string(count);
+                const char *operations[] = { "add", "addBulk", "queryRect", "querySegment", "serialize", "deserialize", "deserializeChecked", "update", "updateFrame", "updateDeferred", "move", "moveSubstepped" };
+
+                bool any = false;
+                for (const char *operation : operations)
+                {
+                    any = any || selected(operation + suffix);
+                }
+                if (!any)
+                {
+                    return;
+                }
+
+                if (options.list)
+                {
+                    for (const char *operation : operations)
+                    {
+                        if (selected(operation + suffix))
+                        {
+                            report(named(Result(), operation, scene, backend, count));
+                        }
+                    }
+                    return;
+                }
+
+                SceneData data = scene.generate(count);
+                Bump::World world = backend.create(data);
+
+                std::mt19937 random(static_cast<std::mt19937::result_type>(count));
+                std::uniform_real_distribution<Bump::Number> px(0, data.width);
+                std::uniform_real_distribution<Bump::Number> py(0, data.height);
+                std::uniform_real_distribution<Bump::Number> jitter(-data.jitter, data.jitter);
+                std::uniform_real_distribution<Bump::Number> angle(0, 6.283185307179586);
+                std::uniform_int_distribution<std::size_t> mover(0, data.movers.empty() ? 0 : data.movers.size() - 1);
+
+                {
+                    State state(data.rects.size());
+                    for (std::size_t i = 0; i < data.rects.size(); i++)
+                    {
+                        const Bump::Rectangle &rect = data.rects[i];
+                        const Bump::Item item = toItem(i);
+                        state.measure([&world, &item, &rect]() { world.add(item, rect.x, rect.y, rect.w, rect.h); });
+                    }
+                    finish("add", scene, backend, count, state, world);
+                }
+
+                if (selected("addBulk" + suffix))
+                {
+                    // A single sample: building the whole world is the operation
+                    std::vector<Bump::Item> items(data.rects.size());
+                    for (std::size_t i = 0; i < items.size(); i++)
+                    {
+                        items[i] = toItem(i);
+                    }
+
+                    Bump::World bulk = backend.create(data);
+                    const std::size_t threads = std::max(1u, std::thread::hardware_concurrency());
+                    State state(1);
+                    state.measure([&bulk, &items, &data, &threads]() { bulk.addBulk(items, data.rects, threads); });
+                    finish("addBulk", scene, backend, count, state, bulk);
+                }
+
+                if (selected("queryRect" + suffix))
+                {
+                    State state(options.operations);
+                    for (std::size_t i = 0; i < options.operations; i++)
+                    {
+                        const Bump::Number x = px(random);
+                        const Bump::Number y = py(random);
+                        const Bump::Number size = data.querySize;
+                        state.measure([&world, &x, &y, &size]() { world.queryRect(x, y, size, size); });
+                    }
+                    finish("queryRect", scene, backend, count, state, world);
+                }
+
+                if (selected("querySegment" + suffix))
+                {
+                    State state(options.operations);
+                    for (std::size_t i = 0; i < options.operations; i++)
+                    {
+                        const Bump::Number x1 = px(random);
+                        const Bump::Number y1 = py(random);
+                        const Bump::Number a = angle(random);
+                        const Bump::Number x2 = x1 + data.rayLength * std::cos(a);
+                        const Bump::Number y2 = y1 + data.rayLength * std::sin(a);
+                        state.measure([&world, &x1, &y1, &x2, &y2]() { world.querySegment(x1, y1, x2, y2); });
+                    }
+                    finish("querySegment", scene, backend, count, state, world);
+                }
+
+                if (selected("serialize" + suffix) || selected("deserialize" + suffix) || selected("deserializeChecked" + suffix))
+                {
+                    // Whole world snapshots are far more expensive than single operations
+                    const std::size_t snapshots = std::max<std::size_t>(1, options.operations / 100);
+                    std::vector<std::uint8_t> blob;
+
+                    State serialize(snapshots);
+                    for (std::size_t i = 0; i < snapshots; i++)
+                    {
+                        serialize.measure([&world, &blob]() { world.serialize(blob); });
+                    }
+                    finish("serialize", scene, backend, count, serialize, world);
+
+                    State deserialize(snapshots);
+                    for (std::size_t i = 0; i < snapshots; i++)
+                    {
+                        deserialize.measure([&world, &blob]() { world.deserialize(blob); });
+                    }
+                    finish("deserialize", scene, backend, count, deserialize, world);
+
+                    State checked(snapshots);
+                    for (std::size_t i = 0; i < snapshots; i++)
+                    {
+                        checked.measure([&world, &blob]() { world.deserialize(blob, Bump::Blob::Check::Full); });
+                    }
+                    finish("deserializeChecked", scene, backend, count, checked, world);
+                }
+
+                if (data.movers.empty())
+                {
+                    return;
+                }
+
+                if (selected("update" + suffix))
+                {
+                    State state(options.operations);
+                    for (std::size_t i = 0; i < options.operations; i++)
+                    {
+                        const Bump::Item item = toItem(data.movers[mover(random)]);
+                        Bump::Number x, y, w, h;
+                        std::tie(x, y, w, h) = world.getRect(item);
+                        x += jitter(random);
+                        y += jitter(random);
+                        state.measure([&world, &item, &x, &y]() { world.update(item, x, y); });
+                    }
+                    finish("update", scene, backend, count, state, world);
+                }
+
+                // A frame updating every mover three times, with the broad phase catching up
+                // after each update or once at the end
+                for (const std::string operation : { "updateFrame", "updateDeferred" })
+                {
+                    if (!selected(operation + suffix))
+                    {
+                        continue;
+                    }
+
+                    const std::size_t frames = std::max<std::size_t>(1, options.operations / 1000);
+                    const std::size_t threads = std::max(1u, std::thread::hardware_concurrency());
+                    world.setDeferredUpdates(operation == "updateDeferred", threads);
+
+                    std::vector<Bump::Point> offsets(data.movers.size() * 3);
+                    State state(frames);
+                    for (std::size_t frame = 0; frame < frames; frame++)
+                    {
+                        for (Bump::Point &offset : offsets)
+                        {
+                            offset = Bump::Point{ jitter(random), jitter(random) };
+                        }
+
+                        state.measure([&world, &data, &offsets]()
+                        {
+                            for (std::size_t pass = 0; pass < 3; pass++)
+                            {
+                                for (std::size_t i = 0; i < data.movers.size(); i++)
+                                {
+                                    const Bump::Item item = toItem(data.movers[i]);
+                                    const Bump::Point &offset = offsets[pass * data.movers.size() + i];
+                                    Bump::Number x, y, w, h;
+                                    std::tie(x, y, w, h) = world.getRect(item);
+                                    world.update(item, x + offset.x, y + offset.y);
+                                }
+                            }
+                            world.flush();
+                        });
+                    }
+                    world.setDeferredUpdates(false);
+                    finish(operation, scene, backend, count, state, world);
+                }
+
+                for (const std::string operation : { "move", "moveSubstepped" })
+                {
+                    if (!selected(operation + suffix))
+                    {
+                        continue;
+                    }
+
+                    const std::string response = data.response;
+                    const Bump::Filter filter = [&response](const Bump::Item &, const Bump::Item &)
+                    {
+                        return response;
+                    };
+
+                    State state(options.operations);
+                    for (std::size_t i = 0; i < options.operations; i++)
+                    {
+                        const std::size_t index = mover(random);
+                        const Bump::Item item = toItem(data.movers[index]);
+                        const Bump::Point velocity = data.velocities[index];
+
+                        Bump::Number x, y, w, h;
+                        std::tie(x, y, w, h) = world.getRect(item);
+
+                        // Wrap movers that left the world, outside of the timed section
+                        if (x < -data.width || x > 2 * data.width || y < -data.height || y > 2 * data.height)
+                        {
+                            std::tie(x, y) = std::make_tuple(px(random), py(random));
+                            world.update(item, x, y);
+                        }
+
+                        Bump::Number goalX = x + velocity.x;
+                        Bump::Number goalY = y + velocity.y;
+                        if (velocity.x == 0 && velocity.y == 0)
+                        {
+                            goalX += jitter(random);
+                            goalY += jitter(random);
+                        }
+
+                        if (operation == "move")
+                        {
+                            state.measure([&world, &item, &goalX, &goalY, &filter]() { world.move(item, goalX, goalY, filter); });
+                        }
+                        else
+                        {
+                            state.measure([&world, &item, &goalX, &goalY, &filter]() { world.moveSubstepped(item, goalX, goalY, filter); });
+                        }
+                    }
+                    finish(operation, scene, backend, count, state, world);
+                }
+            }
+
+            // 90% queries, split evenly over queryRect, querySegment and project, and 10%
+            // updates from 1 to 32 threads sharing one ConcurrentWorld. Throughput is the
+            // total over every thread per second of wall time.
+            void runConcurrent(const Scene &scene, const std::size_t &count)
+            {
+                std::vector<std::size_t> threadCounts;
+                for (const std::size_t &threads : options.threads)
+                {
+                    if (threads > 0 && selected(concurrent(Result(), scene, count, threads).name))
+                    {
+                        threadCounts.push_back(threads);
+                    }
+                }
+                if (threadCounts.empty())
+                {
+                    return;
+                }
+
+                if (options.list)
+                {
+                    for (const std::size_t &threads : threadCounts)
+                    {
+                        report(concurrent(Result(), scene, count, threads));
+                    }
+                    return;
+                }
+
+                SceneData data = scene.generate(count);
+                if (data.movers.empty())
+                {
+                    return;
+                }
+
+                Bump::ConcurrentWorld world(data.cellSize);
+                for (std::size_t i = 0; i < data.rects.size(); i++)
+                {
+                    const Bump::Rectangle &rect = data.rects[i];
+                    world.add(toItem(i), rect.x, rect.y, rect.w, rect.h);
+                }
+
+                for (const std::size_t &threads : threadCounts)
+                {
+                    std::vector<State> states(threads, State(options.operations));
+                    std::vector<std::thread> workers;
+
+                    const auto start = std::chrono::steady_clock::now();
+                    for (std::size_t t = 0; t < threads; t++)
+                    {
+                        workers.emplace_back([this, &world, &data, &states, t]()
+                        {
+                            std::mt19937 random(static_cast<std::mt19937::result_type>(t + 1));
+                            std::uniform_real_distribution<Bump::Number> px(0, data.width);
+                            std::uniform_real_distribution<Bump::Number> py(0, data.height);
+                            std::uniform_real_distribution<Bump::Number> jitter(-data.jitter, data.jitter);
+                            std::uniform_real_distribution<Bump::Number> angle(0, 6.283185307179586);
+                            std::uniform_int_distribution<std::size_t> mover(0, data.movers.size() - 1);
+                            std::uniform_int_distribution<int> percent(0, 99);
+
+                            const std::string response = data.response;
+                            const Bump::Filter filter = [&response](const Bump::Item &, const Bump::Item &)
+                            {
+                                return response;
+                            };
+
+                            State &state = states[t];
+                            for (std::size_t i = 0; i < options.operations; i++)
+                            {
+                                const int operation = percent(random);
+                                if (operation < 30)
+                                {
+                                    const Bump::Number x = px(random);
+                                    const Bump::Number y = py(random);
+                                    const Bump::Number size = data.querySize;
+                                    state.measure([&world, &x, &y, &size]() { world.queryRect(x, y, size, size); });
+                                }
+                                else if (operation < 60)
+                                {
+                                    const Bump::Number x1 = px(random);
+                                    const Bump::Number y1 = py(random);
+                                    const Bump::Number a = angle(random);
+                                    const Bump::Number x2 = x1 + data.rayLength * std::cos(a);
+                                    const Bump::Number y2 = y1 + data.rayLength * std::sin(a);
+                                    state.measure([&world, &x1, &y1, &x2, &y2]() { world.querySegment(x1, y1, x2, y2); });
+                                }
+                                else if (operation < 90)
+                                {
+                                    // Projects a mover by its velocity from where it is, as move would
+                                    const std::size_t index = mover(random);
+                                    const Bump::Item item = toItem(data.movers[index]);
+                                    const Bump::Point velocity = data.velocities[index];
+                                    const Bump::Number dx = velocity.x != 0 || velocity.y != 0 ? velocity.x : jitter(random);
+                                    const Bump::Number dy = velocity.x != 0 || velocity.y != 0 ? velocity.y : jitter(random);
+                                    state.measure([&world, &item, &dx, &dy, &filter]()
+                                    {
+                                        Bump::Number x, y, w, h;
+                                        std::tie(x, y, w, h) = world.getRect(item);
+                                        world.project(item, x, y, w, h, x + dx, y + dy, filter);
+                                    });
+                                }
+                                else
+                                {
+                                    const Bump::Item item = toItem(data.movers[mover(random)]);
+                                    const Bump::Number dx = jitter(random);
+                                    const Bump::Number dy = jitter(random);
+                                    state.measure([&world, &item, &dx, &dy]()
+                                    {
+                                        Bump::Number x, y, w, h;
+                                        std::tie(x, y, w, h) = world.getRect(item);
+                                        world.update(item, x + dx, y + dy, w, h);
+                                    });
+                                }
+                            }
+                        });
+                    }
+                    for (std::thread &worker : workers)
+                    {
+                        worker.join();
+                    }
+                    const auto end = std::chrono::steady_clock::now();
+
+                    for (std::size_t t = 1; t < threads; t++)
+                    {
+                        states[0].merge(states[t]);
+                    }
+
+                    Result result = concurrent(states[0].finish(), scene, count, threads);
+                    const double wallNs = std::chrono::duration<double, std::nano>(end - start).count();
+                    result.itemsPerSecond = wallNs > 0 ? result.iterations * 1e9 / wallNs : 0;
+                    report(std::move(result));
+                }
+            }
+
+            // Sums the time of every operation per scene and item count and names the fastest backend
+            void summarize() const
+            {
+                std::map<std::string, std::map<std::string, double>> totals;
+                for (const Result &result : results)
+                {
+                    // Concurrent runs are scaling curves, not a backend to pick
+                    if (result.backend == "concurrent")
+                    {
+                        continue;
+                    }
+                    const std::string key = result.scene + "/" + std::to_string(result.items);
+                    totals[key][result.backend] += result.totalNs;
+                }
+
+                for (const auto &scene : totals)
+                {
+                    if (scene.second.size() < 2)
+                    {
+                        continue;
+                    }
+
+                    const auto best = std::min_element(scene.second.begin(), scene.second.end(),
+                        [](const std::pair<const std::string, double> &a, const std::pair<const std::string, double> &b)
+                        {
+                            return a.second < b.second;
+                        });
+                    std::printf("best backend for %-24s %-8s (%.2f ms)\n", scene.first.c_str(), best->first.c_str(), best->second / 1e6);
+                }
+            }
+
+            void writeJson(std::ostream &stream, const std::string &executable) const
+            {
+                char date[64] = { 0 };
+                const std::time_t now = std::time(nullptr);
+                std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::localtime(&now));
+
+                stream << "{\n  \"context\": {\n";
+                stream << "    \"date\": \"" << date << "\",\n";
+                stream << "    \"executable\": \"" << escape(executable) << "\",\n";
+                stream << "    \"num_cpus\": " << std::thread::hardware_concurrency() << ",\n";
+#ifdef NDEBUG
+                stream << "    \"library_build_type\": \"release\"\n";
+#else
+                stream << "    \"library_build_type\": \"debug\"\n";
+#endif
+                stream << "  },\n  \"benchmarks\": [";
+
+                for (std::size_t i = 0; i < results.size(); i++)
+                {
+                    const Result &result = results[i];
+                    stream << (i == 0 ? "\n" : ",\n");
+                    stream << "    {\n";
+                    stream << "      \"name\": \"" << escape(result.name) << "\",\n";
+                    stream << "      \"run_name\": \"" << escape(result.name) << "\",\n";
+                    stream << "      \"run_type\": \"iteration\",\n";
+                    stream << "      \"scene\": \"" << escape(result.scene) << "\",\n";
+                    stream << "      \"backend\": \"" << escape(result.backend) << "\",\n";
+                    stream << "      \"operation\": \"" << escape(result.operation) << "\",\n";
+                    stream << "      \"items\": " << result.items << ",\n";
+                    stream << "      \"threads\": " << result.threads << ",\n";
+                    stream << "      \"iterations\": " << result.iterations << ",\n";
+                    stream << "      \"real_time\": " << result.meanNs << ",\n";
+                    stream << "      \"cpu_time\": " << result.meanNs << ",\n";
+                    stream << "      \"time_unit\": \"ns\",\n";
+                    stream << "      \"p50\": " << result.p50Ns << ",\n";
+                    stream << "      \"p90\": " << result.p90Ns << ",\n";
+                    stream << "      \"p99\": " << result.p99Ns << ",\n";
+                    stream << "      \"max\": " << result.maxNs << ",\n";
+                    stream << "      \"items_per_second\": " << result.itemsPerSecond;
+#ifdef BUMP_ENABLE_STATS
+                    const Bump::Stats &stats = result.stats;
+                    const double iterations = result.iterations > 0 ? static_cast<double>(result.iterations) : 1;
+                    stream << ",\n";
+                    stream << "      \"cells_visited\": " << stats.cellsVisited / iterations << ",\n";
+                    stream << "      \"candidates_tested\": " << stats.candidatesTested / iterations << ",\n";
+                    stream << "      \"narrow_phase_hits\": " << stats.narrowPhaseHits / iterations << ",\n";
+                    stream << "      \"dedupe_rejects\": " << stats.dedupeRejects / iterations << ",\n";
+                    stream << "      \"response_iterations\": " << stats.responseIterations / iterations << ",\n";
+                    stream << "      \"allocations\": " << stats.allocations / iterations;
+#endif
+                    stream << "\n";
+                    stream << "    }";
+                }
+
+                stream << "\n  ]\n}\n";
+            }
+
+        private:
+            static std::string escape(const std::string &value)
+            {
+                std::string escaped;
+                for (const char &c : value)
+                {
+                    if (c == '"' || c == '\\')
+                    {
+                        escaped += '\\';
+                    }
+                    escaped += c;
+                }
+                return escaped;
+            }
+
+            static Result named(
+                Result result, const std::string &operation,
+                const Scene &scene, const Backend &backend, const std::size_t &count
+            )
+            {
+                result.name = operation + "/" + scene.name + "/" + backend.name + "/" + std::to_string(count);
+                result.operation = operation;
+                result.scene = scene.name;
+                result.backend = backend.name;
+                result.items = count;
+                return result;
+            }
+
+            static Result concurrent(
+                Result result, const Scene &scene,
+                const std::size_t &count, const std::size_t &threads
+            )
+            {
+                result = named(result, "mixed", scene, Backend{ "concurrent", nullptr }, count);
+                result.name += "/threads:" + std::to_string(threads);
+                result.threads = threads;
+                return result;
+            }
+
+            void finish(
+                const std::string &operation,
+                const Scene &scene, const Backend &backend, const std::size_t &count,
+                const State &state, Bump::World &world
+            )
+            {
+                Result result = named(state.finish(), operation, scene, backend, count);
+                result.stats = world.getStats();
+                world.resetStats();
+                if (selected(result.name))
+                {
+                    report(std::move(result));
+                }
+            }
+
+        private:
+            const Options &options;
+            std::regex filter;
+            std::vector<Result> results;
+        };
+    }
+
+    /// ------------------------------------------
+    /// -- Functions
+    /// ------------------------------------------
+    Options parseOptions(int argc, char **argv)
+    {
+        Options options;
+        for (int i = 1; i < argc; i++)
+        {
+            const std::string argument = argv[i];
+            const std::string value = argument.substr(argument.find('=') + 1);
+
+            if (Aux::startsWith(argument, "--benchmark_filter="))
+            {
+                options.filter = value;
+            }
+            else if (Aux::startsWith(argument, "--benchmark_out="))
+            {
+                options.out = value;
+            }
+            else if (Aux::startsWith(argument, "--benchmark_format="))
+            {
+                options.json = value == "json";
+            }
+            else if (argument == "--benchmark_list_tests" || argument == "--benchmark_list_tests=true")
+            {
+                options.list = true;
+            }
+            else if (Aux::startsWith(argument, "--trace="))
+            {
+                options.trace = value;
+            }
+            else if (Aux::startsWith(argument, "--operations="))
+            {
+                options.operations = std::strtoull(value.c_str(), nullptr, 10);
+            }
+            else if (Aux::startsWith(argument, "--items="))
+            {
+                options.counts.clear();
+                for (const std::string &count : Aux::split(value, ','))
+                {
+                    options.counts.push_back(std::strtoull(count.c_str(), nullptr, 10));
+                }
+            }
+            else if (Aux::startsWith(argument, "--backends="))
+            {
+                options.backends = Aux::split(value, ',');
+            }
+            else if (Aux::startsWith(argument, "--threads="))
+            {
+                options.threads.clear();
+                for (const std::string &threads : Aux::split(value, ','))
+                {
+                    options.threads.push_back(std::strtoull(threads.c_str(), nullptr, 10));
+                }
+            }
+            else
+            {
+                std::fprintf(stderr,
+                    "usage: %s [--benchmark_filter=<regex>] [--benchmark_out=<file>]\n"
+                    "          [--benchmark_format=console|json] [--benchmark_list_tests]\n"
+                    "          [--items=<n,...>] [--backends=grid,grid4,gridTiled,tree,sap,concurrent] [--operations=<n>]\n"
+                    "          [--threads=<n,...>] [--trace=<file>]\n",
+                    argv[0]);
+                std::exit(argument == "--help" ? 0 : 1);
+            }
+        }
+        return options;
+    }
+
+    int run(int argc, char **argv)
+    {
+        const Options options = parseOptions(argc, argv);
+        Runner runner(options);
+
+        if (!options.json && !options.list)
+        {
+            std::printf(
+                "%-40s %15s %10s %10s %10s %10s %12s %12s\n",
+                "Benchmark", "Time", "Iterations", "p50", "p90", "p99", "max", "Throughput"
+            );
+        }
+
+        if (!options.trace.empty())
+        {
+            Bump::Trace::start();
+        }
+
+        for (const Scene &scene : scenes())
+        {
+            for (const std::string &name : options.backends)
+            {
+                if (name == "concurrent")
+                {
+                    for (const std::size_t &count : options.counts)
+                    {
+                        if (count <= scene.maxItems)
+                        {
+                            runner.runConcurrent(scene, count);
+                        }
+                    }
+                    continue;
+                }
+
+                const std::vector<Backend> available = backends();
+                const auto backend = std::find_if(available.begin(), available.end(),
+                    [&name](const Backend &candidate) { return candidate.name == name; });
+                if (backend == available.end())
+                {
+                    std::fprintf(stderr, "unknown backend %s\n", name.c_str());
+                    return 1;
+                }
+
+                for (const std::size_t &count : options.counts)
+                {
+                    if (count <= scene.maxItems)
+                    {
+                        runner.run(scene, *backend, count);
+                    }
+                }
+            }
+        }
+
+        if (options.list)
+        {
+            return 0;
+        }
+
+        if (!options.trace.empty())
+        {
+            Bump::Trace::stop();
+            if (!Bump::Trace::write(options.trace))
+            {
+                std::fprintf(stderr, "cannot write %s\n", options.trace.c_str());
+                return 1;
+            }
+        }
+
+        if (options.json)
+        {
+            std::ostringstream stream;
+            runner.writeJson(stream, argv[0]);
+            std::fputs(stream.str().c_str(), stdout);
+        }
+        else
+        {
+            runner.summarize();
+        }
+
+        if (!options.out.empty())
+        {
+            std::ofstream file(options.out);
+            if (!file)
+            {
+                std::fprintf(stderr, "cannot write %s\n", options.out.c_str());
+                return 1;
+            }
+            runner.writeJson(file, argv[0]);
+        }
+
+        return 0;
+    }
+}
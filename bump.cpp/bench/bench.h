@@ -0,0 +1,91 @@
+#ifndef BENCH_H_INCLUDED_7C1D2A4E_3B9F_4E51_9A0D_61F2C8B4E5A7
+#define BENCH_H_INCLUDED_7C1D2A4E_3B9F_4E51_9A0D_61F2C8B4E5A7
+#include "../bump/bump.h"
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace Bench
+{
+    /// ------------------------------------------
+    /// -- Structures
+    /// ------------------------------------------
+    struct Options
+    {
+        std::string filter;                 // --benchmark_filter=<regex>
+        std::string out;                    // --benchmark_out=<file>, always JSON
+        bool json = false;                  // --benchmark_format=json
+        bool list = false;                  // --benchmark_list_tests
+        std::size_t operations = 10000;     // --operations=<n>, timed operations per benchmark
+        std::string trace;                  // --trace=<file>, Chrome trace of the last events, needs BUMP_TRACE=ON
+        std::vector<std::size_t> counts{ 1000, 10000, 100000, 1000000 }; // --items=<n,n,...>
+        std::vector<std::string> backends{ "grid", "grid4", "tree", "sap" }; // --backends=<name,...>, "concurrent" runs the mixed workload
+        std::vector<std::size_t> threads{ 1, 2, 4, 8, 16, 32 }; // --threads=<n,n,...>, for the concurrent backend
+    };
+
+    struct Result
+    {
+        std::string name;
+        std::string scene;
+        std::string backend;
+        std::string operation;
+        std::size_t items = 0;
+        std::size_t threads = 1;
+
+        std::size_t iterations = 0;
+        double totalNs = 0;
+        double meanNs = 0;
+        double p50Ns = 0;
+        double p90Ns = 0;
+        double p99Ns = 0;
+        double maxNs = 0;
+        double itemsPerSecond = 0;
+
+        // Counters summed over every iteration, only filled in with BUMP_STATS=ON
+        Bump::Stats stats;
+    };
+
+    /// ------------------------------------------
+    /// -- Classes
+    /// ------------------------------------------
+
+    // Times every operation on its own so that latency percentiles
+    // can be reported next to throughput.
+    class State
+    {
+    public:
+        explicit State(const std::size_t &iterations);
+
+        template<typename Operation>
+        void measure(const Operation &operation)
+        {
+            const auto start = Clock::now();
+            operation();
+            const auto end = Clock::now();
+            samples.push_back(std::chrono::duration<double, std::nano>(end - start).count());
+        }
+
+        // Adds the samples another state measured, one state per thread
+        void merge(const State &other);
+
+        Result finish() const;
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        std::vector<double> samples;
+    };
+
+    /// ------------------------------------------
+    /// -- Functions
+    /// ------------------------------------------
+    Options parseOptions(int argc, char **argv);
+
+    // Runs every scene x backend x item count x operation matching the options.
+    // Returns the process exit code.
+    int run(int argc, char **argv);
+}
+
+#endif
@@ -0,0 +1,245 @@
+#include "scenes.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+
+namespace Bench
+{
+    /// ------------------------------------------
+    /// -- Scenes
+    /// ------------------------------------------
+    namespace
+    {
+        // Item positions are drawn so that density stays the same at every item count
+        Bump::Number sideFor(const std::size_t &count, const Bump::Number &areaPerItem)
+        {
+            return std::sqrt(static_cast<Bump::Number>(count) * areaPerItem);
+        }
+
+        SceneData uniform(const std::size_t &count)
+        {
+            std::mt19937 random(1);
+            SceneData scene;
+            scene.width = scene.height = sideFor(count, 48 * 48);
+
+            std::uniform_real_distribution<Bump::Number> position(0, scene.width);
+            std::uniform_real_distribution<Bump::Number> size(4, 32);
+
+            scene.rects.resize(count);
+            for (std::size_t i = 0; i < count; i++)
+            {
+                scene.rects[i] = { position(random), position(random), size(random), size(random) };
+                scene.movers.push_back(i);
+                scene.velocities.push_back({ 0, 0 });
+            }
+            return scene;
+        }
+
+        // Ground and floating platforms made of 16x16 tiles, with 5% of the
+        // items being 12x24 players falling and running over them
+        SceneData tilemap(const std::size_t &count)
+        {
+            const Bump::Number tile = 16;
+            const std::size_t players = std::max<std::size_t>(1, count / 20);
+            const std::size_t tiles = count - players;
+            const std::size_t columns = std::max<std::size_t>(64, tiles / 8);
+            const std::size_t levelRows = 64;
+
+            std::mt19937 random(2);
+            SceneData scene;
+            scene.width = columns * tile;
+            scene.height = (levelRows + 4) * tile;
+            scene.cellSize = 32;
+            scene.querySize = 320;
+
+            std::uniform_int_distribution<std::size_t> column(0, columns - 8);
+            std::uniform_int_distribution<std::size_t> row(0, levelRows - 1);
+
+            scene.rects.reserve(count);
+            std::size_t groundTiles = std::min(tiles, columns * 4);
+            for (std::size_t i = 0; i < groundTiles; i++)
+            {
+                scene.rects.push_back({
+                    (i % columns) * tile, (levelRows + i / columns) * tile, tile, tile
+                });
+            }
+            while (scene.rects.size() < tiles)
+            {
+                const std::size_t x = column(random);
+                const std::size_t y = row(random);
+                for (std::size_t i = 0; i < 8 && scene.rects.size() < tiles; i++)
+                {
+                    scene.rects.push_back({ (x + i) * tile, y * tile, tile, tile });
+                }
+            }
+
+            std::uniform_real_distribution<Bump::Number> px(0, scene.width);
+            std::uniform_real_distribution<Bump::Number> py(0, levelRows * tile);
+            std::uniform_real_distribution<Bump::Number> run(-4, 4);
+            for (std::size_t i = 0; i < players; i++)
+            {
+                scene.movers.push_back(scene.rects.size());
+                scene.velocities.push_back({ run(random), 6 });
+                scene.rects.push_back({ px(random), py(random), 12, 24 });
+            }
+            return scene;
+        }
+
+        // Small agents packed so tightly that most of them overlap a neighbour
+        SceneData crowd(const std::size_t &count)
+        {
+            std::mt19937 random(3);
+            SceneData scene;
+            scene.width = scene.height = sideFor(count, 12 * 12);
+            scene.cellSize = 32;
+            scene.jitter = 3;
+
+            std::uniform_real_distribution<Bump::Number> position(0, scene.width);
+
+            scene.rects.resize(count);
+            for (std::size_t i = 0; i < count; i++)
+            {
+                scene.rects[i] = { position(random), position(random), 8, 8 };
+                scene.movers.push_back(i);
+                scene.velocities.push_back({ 0, 0 });
+            }
+            return scene;
+        }
+
+        // Fast 4x4 bullets crossing a field of 32x32 ships
+        SceneData bulletHell(const std::size_t &count)
+        {
+            const Bump::Number pi = 3.14159265358979323846;
+            const std::size_t ships = std::max<std::size_t>(1, count / 50);
+
+            std::mt19937 random(4);
+            SceneData scene;
+            scene.width = scene.height = sideFor(count, 64 * 64);
+            scene.response = "cross";
+
+            std::uniform_real_distribution<Bump::Number> position(0, scene.width);
+            std::uniform_real_distribution<Bump::Number> angle(0, 2 * pi);
+
+            scene.rects.resize(count);
+            for (std::size_t i = 0; i < count; i++)
+            {
+                if (i < ships)
+                {
+                    scene.rects[i] = { position(random), position(random), 32, 32 };
+                    continue;
+                }
+
+                const Bump::Number a = angle(random);
+                scene.rects[i] = { position(random), position(random), 4, 4 };
+                scene.movers.push_back(i);
+                scene.velocities.push_back({ 24 * std::cos(a), 24 * std::sin(a) });
+            }
+            return scene;
+        }
+
+        // Static boxes probed by rays spanning half of the world
+        SceneData longRays(const std::size_t &count)
+        {
+            std::mt19937 random(5);
+            SceneData scene;
+            scene.width = scene.height = sideFor(count, 64 * 64);
+            scene.rayLength = scene.width / 2;
+
+            std::uniform_real_distribution<Bump::Number> position(0, scene.width);
+            std::uniform_real_distribution<Bump::Number> size(8, 48);
+
+            scene.rects.resize(count);
+            for (std::size_t i = 0; i < count; i++)
+            {
+                scene.rects[i] = { position(random), position(random), size(random), size(random) };
+                scene.movers.push_back(i);
+                scene.velocities.push_back({ 0, 0 });
+            }
+            return scene;
+        }
+
+        // 16x200 bars pushing 2000 units into a lattice of 16x16 tiles, so that every move
+        // sorts up to 1000 collisions before touching the first one. The tiles of a lattice
+        // column are hit at the same ti
+        SceneData sweep(const std::size_t &count)
+        {
+            const Bump::Number pitch = 20;
+            const std::size_t bars = std::max<std::size_t>(1, count / 100);
+            const std::size_t tiles = count - bars;
+
+            std::mt19937 random(7);
+            SceneData scene;
+            scene.width = scene.height = sideFor(tiles, pitch * pitch);
+            scene.response = "touch";
+
+            const std::size_t columns = std::max<std::size_t>(1, static_cast<std::size_t>(scene.width / pitch));
+            scene.rects.reserve(count);
+            for (std::size_t i = 0; i < tiles; i++)
+            {
+                scene.rects.push_back({ (i % columns) * pitch, (i / columns) * pitch, 16, 16 });
+            }
+
+            std::uniform_real_distribution<Bump::Number> px(0, scene.width);
+            std::uniform_real_distribution<Bump::Number> py(0, scene.height);
+            for (std::size_t i = 0; i < bars; i++)
+            {
+                scene.movers.push_back(scene.rects.size());
+                scene.velocities.push_back({ 2000, 0 });
+                scene.rects.push_back({ px(random), py(random), 16, 200 });
+            }
+            return scene;
+        }
+
+        // Sizes spread log-uniformly between 1 and 4096 units
+        SceneData mixedSizes(const std::size_t &count)
+        {
+            std::mt19937 random(6);
+            SceneData scene;
+            scene.width = scene.height = sideFor(count, 65536.0 * 65536.0 / 20000);
+            scene.querySize = 256;
+            scene.jitter = 32;
+
+            std::uniform_real_distribution<Bump::Number> position(0, scene.width);
+            std::uniform_real_distribution<Bump::Number> exponent(0, 12);
+
+            scene.rects.resize(count);
+            for (std::size_t i = 0; i < count; i++)
+            {
+                scene.rects[i] = {
+                    position(random), position(random),
+                    std::exp2(exponent(random)), std::exp2(exponent(random))
+                };
+                scene.movers.push_back(i);
+                scene.velocities.push_back({ 0, 0 });
+            }
+            return scene;
+        }
+    }
+
+    /// ------------------------------------------
+    /// -- Functions
+    /// ------------------------------------------
+    Bump::Item toItem(const std::size_t &index)
+    {
+        return reinterpret_cast<Bump::Item>(static_cast<std::uintptr_t>(index + 1));
+    }
+
+    std::vector<Scene> scenes()
+    {
+        const std::size_t unbounded = static_cast<std::size_t>(-1);
+
+        return std::vector<Scene>
+        {
+            { "uniform", unbounded, uniform },
+            { "tilemap", unbounded, tilemap },
+            { "crowd", unbounded, crowd },
+            { "bullets", unbounded, bulletHell },
+            { "rays", unbounded, longRays },
+            { "sweep", unbounded, sweep },
+            // A flat grid stores ~40 cells per item here
+            { "mixed", 100000, mixedSizes },
+        };
+    }
+}
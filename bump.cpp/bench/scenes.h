@@ -0,0 +1,50 @@
+#ifndef SCENES_H_INCLUDED_0E4B7F29_6A13_4C8D_B2F5_93D81A6C0E47
+#define SCENES_H_INCLUDED_0E4B7F29_6A13_4C8D_B2F5_93D81A6C0E47
+#include "../bump/bump.h"
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace Bench
+{
+    /// ------------------------------------------
+    /// -- Structures
+    /// ------------------------------------------
+    struct SceneData
+    {
+        std::vector<Bump::Rectangle> rects;
+
+        // Items that move, with their per-move velocity. A zero velocity
+        // means a random walk of up to jitter units per axis.
+        std::vector<std::size_t> movers;
+        std::vector<Bump::Point> velocities;
+
+        Bump::Number width = 0;
+        Bump::Number height = 0;
+        Bump::Number querySize = 128;
+        Bump::Number rayLength = 512;
+        Bump::Number jitter = 8;
+        Bump::Number cellSize = 64;
+        std::string response = "slide";
+    };
+
+    struct Scene
+    {
+        std::string name;
+        std::size_t maxItems;
+        std::function<SceneData(const std::size_t &count)> generate;
+    };
+
+    /// ------------------------------------------
+    /// -- Functions
+    /// ------------------------------------------
+    Bump::Item toItem(const std::size_t &index);
+
+    // Uniform random boxes, platformer tilemap, dense crowd, bullet hell,
+    // long rays, bars sweeping a lattice and mixed item sizes
+    std::vector<Scene> scenes();
+}
+
+#endif
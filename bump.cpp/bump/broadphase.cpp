@@ -0,0 +1,1869 @@
+#include "broadphase.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <thread>
+
+// Backends count into the stats of the World that owns them, and not at all on their own
+#ifdef BUMP_ENABLE_STATS
+#define BUMP_BACKEND_STAT(counter, amount) (stats != nullptr ? (void)(stats->counter += (amount)) : (void)0)
+#else
+#define BUMP_BACKEND_STAT(counter, amount) ((void)0)
+#endif
+
+namespace Bump
+{
+    /// ------------------------------------------
+    /// -- Bulk insertion
+    /// ------------------------------------------
+    namespace
+    {
+        // Cell covered by an item of a bulk insertion
+        struct CellPair
+        {
+            std::uint64_t key = 0;
+            ItemHandle item;
+        };
+
+        // Cells an item covers, right and bottom excluded. Empty for items of another level.
+        struct CellSpan
+        {
+            Index left = 0;
+            Index top = 0;
+            Index right = 0;
+            Index bottom = 0;
+
+            bool contains(const Index &cx, const Index &cy) const
+            {
+                return left <= cx && cx < right && top <= cy && cy < bottom;
+            }
+
+            std::size_t area() const
+            {
+                return left < right && top < bottom ? static_cast<std::size_t>(right - left) * (bottom - top) : 0;
+            }
+
+            CellSpan intersect(const CellSpan &other) const
+            {
+                CellSpan span;
+                span.left = std::max(left, other.left);
+                span.top = std::max(top, other.top);
+                span.right = std::min(right, other.right);
+                span.bottom = std::min(bottom, other.bottom);
+                return span;
+            }
+
+            bool operator==(const CellSpan &other) const
+            {
+                return left == other.left && top == other.top && right == other.right && bottom == other.bottom;
+            }
+        };
+
+        CellSpan toCellSpan(const Number &cellSize, const Rectangle &rect)
+        {
+            CellSpan span;
+            Grid::toCellRects(cellSize, &rect, 1, &span.left, &span.top, &span.right, &span.bottom);
+            return span;
+        }
+
+        // toCellSpan for count rects at once, a block at a time through Grid::toCellRects
+        void toCellSpans(const Number &cellSize, const Rectangle *rects, const std::size_t &count, CellSpan *spans)
+        {
+            constexpr std::size_t blockSize = 256;
+            Index left[blockSize], top[blockSize], right[blockSize], bottom[blockSize];
+            for (std::size_t first = 0; first < count; first += blockSize)
+            {
+                const std::size_t size = std::min(blockSize, count - first);
+                Grid::toCellRects(cellSize, rects + first, size, left, top, right, bottom);
+                for (std::size_t i = 0; i < size; i++)
+                {
+                    CellSpan &span = spans[first + i];
+                    span.left = left[i];
+                    span.top = top[i];
+                    span.right = right[i];
+                    span.bottom = bottom[i];
+                }
+            }
+        }
+
+        // Spans of rects[begin, end) in a level of cellSize, left empty for the rects that
+        // inLevel(rect) puts in another level
+        template<typename InLevel>
+        void toLevelSpans(
+            const Number &cellSize,
+            const std::vector<Rectangle> &rects,
+            const InLevel &inLevel,
+            const std::size_t &begin, const std::size_t &end,
+            CellSpan *spans
+        )
+        {
+            toCellSpans(cellSize, rects.data() + begin, end - begin, spans + begin);
+            for (std::size_t i = begin; i < end; i++)
+            {
+                if (!inLevel(rects[i]))
+                {
+                    spans[i] = CellSpan();
+                }
+            }
+        }
+
+        // Cell of a key made by Grid::toCellKey
+        void fromCellKey(const std::uint64_t &key, Index &cx, Index &cy)
+        {
+            const std::uint64_t unflipped = key ^ 0x8000000080000000ull;
+            cx = static_cast<Index>(static_cast<std::uint32_t>(unflipped));
+            cy = static_cast<Index>(static_cast<std::uint32_t>(unflipped >> 32));
+        }
+
+        // Position of a cell within its 8x8 tile, the bits of x and y interleaved
+        std::uint32_t toMortonIndex(const Index &cx, const Index &cy)
+        {
+            const auto spread = [](const std::uint32_t &v)
+            {
+                return (v & 1) | (v & 2) << 1 | (v & 4) << 2;
+            };
+            return spread(cx & 7) | spread(cy & 7) << 1;
+        }
+
+        // Below this many elements per thread, starting one costs more than it saves
+        constexpr std::size_t minChunk = 16384;
+
+        std::size_t countChunks(const std::size_t &count, const std::size_t &threads)
+        {
+            return std::max<std::size_t>(1, std::min(threads, count / minChunk));
+        }
+
+        // Calls function(chunk, begin, end) for chunks contiguous ranges of count
+        // elements at once, the first one on the calling thread. function must not throw.
+        template<typename Function>
+        void forEachChunk(const std::size_t &count, const std::size_t &chunks, const Function &function)
+        {
+            std::vector<std::thread> workers;
+            workers.reserve(chunks - 1);
+            for (std::size_t chunk = 1; chunk < chunks; chunk++)
+            {
+                workers.emplace_back([&function, &count, &chunks, chunk]()
+                {
+                    function(chunk, count * chunk / chunks, count * (chunk + 1) / chunks);
+                });
+            }
+
+            function(0, 0, count / chunks);
+            for (std::thread &worker : workers)
+            {
+                worker.join();
+            }
+        }
+
+        // Stable LSD radix sort on key, a byte per pass. Bytes that are the same in
+        // every key are skipped, so a grid a few hundred cells wide takes four passes.
+        // Each pass counts and scatters the chunks in parallel.
+        void sortPairs(std::vector<CellPair> &pairs, std::vector<CellPair> &scratch, const std::size_t &threads)
+        {
+            const std::size_t count = pairs.size();
+            if (count < 2)
+            {
+                return;
+            }
+
+            const std::size_t chunks = countChunks(count, threads);
+            const std::uint64_t firstKey = pairs[0].key;
+            std::vector<std::uint64_t> differences(chunks, 0);
+            forEachChunk(count, chunks, [&](const std::size_t &chunk, const std::size_t &begin, const std::size_t &end)
+            {
+                std::uint64_t difference = 0;
+                for (std::size_t i = begin; i < end; i++)
+                {
+                    difference |= pairs[i].key ^ firstKey;
+                }
+                differences[chunk] = difference;
+            });
+
+            std::uint64_t difference = 0;
+            for (const std::uint64_t &chunkDifference : differences)
+            {
+                difference |= chunkDifference;
+            }
+
+            scratch.resize(count);
+            std::vector<std::array<std::size_t, 256>> offsets(chunks);
+            for (std::uint32_t shift = 0; shift < 64; shift += 8)
+            {
+                if (((difference >> shift) & 0xff) == 0)
+                {
+                    continue;
+                }
+
+                forEachChunk(count, chunks, [&](const std::size_t &chunk, const std::size_t &begin, const std::size_t &end)
+                {
+                    std::array<std::size_t, 256> &counts = offsets[chunk];
+                    counts.fill(0);
+                    for (std::size_t i = begin; i < end; i++)
+                    {
+                        counts[(pairs[i].key >> shift) & 0xff]++;
+                    }
+                });
+
+                // Digit major, chunk minor, which keeps the sort stable
+                std::size_t offset = 0;
+                for (std::size_t digit = 0; digit < 256; digit++)
+                {
+                    for (std::array<std::size_t, 256> &chunkOffsets : offsets)
+                    {
+                        const std::size_t digitCount = chunkOffsets[digit];
+                        chunkOffsets[digit] = offset;
+                        offset += digitCount;
+                    }
+                }
+
+                forEachChunk(count, chunks, [&](const std::size_t &chunk, const std::size_t &begin, const std::size_t &end)
+                {
+                    std::array<std::size_t, 256> &chunkOffsets = offsets[chunk];
+                    for (std::size_t i = begin; i < end; i++)
+                    {
+                        scratch[chunkOffsets[(pairs[i].key >> shift) & 0xff]++] = pairs[i];
+                    }
+                });
+                pairs.swap(scratch);
+            }
+        }
+
+        // Every (cell key, item) pair of items, sorted by cell and then by position in
+        // items. spansOf(begin, end, spans, skips) sets the cells of items[begin, end):
+        // those of spans[i] that are not in skips[i], both empty unless it sets them.
+        // skips is nullptr unless skipping, which spares addMany a second array.
+        template<bool skipping, typename Spans>
+        void collectPairs(
+            const std::vector<ItemHandle> &items,
+            const Spans &spansOf,
+            const std::size_t &threads,
+            std::vector<CellPair> &pairs,
+            std::vector<CellPair> &scratch
+        )
+        {
+            const std::size_t count = items.size();
+            const std::size_t chunks = countChunks(count, threads);
+
+            // Counting first lets every chunk write its pairs in place, in item order
+            std::vector<CellSpan> spans(count);
+            std::vector<CellSpan> skips(skipping ? count : 0);
+            std::vector<std::size_t> starts(chunks + 1, 0);
+            forEachChunk(count, chunks, [&](const std::size_t &chunk, const std::size_t &begin, const std::size_t &end)
+            {
+                spansOf(begin, end, spans.data(), skipping ? skips.data() : nullptr);
+
+                std::size_t pairCount = 0;
+                for (std::size_t i = begin; i < end; i++)
+                {
+                    pairCount += spans[i].area() - (skipping ? spans[i].intersect(skips[i]).area() : 0);
+                }
+                starts[chunk + 1] = pairCount;
+            });
+            for (std::size_t chunk = 0; chunk < chunks; chunk++)
+            {
+                starts[chunk + 1] += starts[chunk];
+            }
+
+            pairs.resize(starts[chunks]);
+            forEachChunk(count, chunks, [&](const std::size_t &chunk, const std::size_t &begin, const std::size_t &end)
+            {
+                CellPair *pair = pairs.data() + starts[chunk];
+                for (std::size_t i = begin; i < end; i++)
+                {
+                    const CellSpan &span = spans[i];
+                    const CellSpan skipped = skipping ? skips[i] : CellSpan();
+                    for (Index cy = span.top; cy < span.bottom; cy++)
+                    {
+                        for (Index cx = span.left; cx < span.right; cx++)
+                        {
+                            if (!skipping || !skipped.contains(cx, cy))
+                            {
+                                pair->key = Grid::toCellKey(cx, cy);
+                                pair->item = items[i];
+                                pair++;
+                            }
+                        }
+                    }
+                }
+            });
+
+            sortPairs(pairs, scratch, threads);
+        }
+
+        // Calls function(key, first, last) for every run of pairs sharing a cell
+        template<typename Function>
+        void forEachRun(std::vector<CellPair> &pairs, const Function &function)
+        {
+            std::size_t first = 0;
+            while (first < pairs.size())
+            {
+                const std::uint64_t key = pairs[first].key;
+                std::size_t last = first + 1;
+                while (last < pairs.size() && pairs[last].key == key)
+                {
+                    last++;
+                }
+
+                function(key, pairs.data() + first, pairs.data() + last);
+                first = last;
+            }
+        }
+    }
+
+    /// ------------------------------------------
+    /// -- Grid
+    /// ------------------------------------------
+    constexpr std::uint32_t GridBroadPhase::kind;
+    constexpr std::uint32_t GridBroadPhase::inlineItems;
+    constexpr std::uint32_t GridBroadPhase::minBlock;
+    constexpr std::size_t GridBroadPhase::minBucketedUpdates;
+    constexpr Index GridBroadPhase::tileBits;
+    constexpr std::uint32_t GridBroadPhase::tileCells;
+
+    GridBroadPhase::GridBroadPhase(const Number &cellSize, const Index &levels_, const Layout &layout)
+        : layout(layout)
+    {
+        if (cellSize <= 0 || levels_ < 1)
+        {
+            throw Exception::InvalidArgumentError();
+        }
+
+        levels.resize(levels_);
+        for (Index i = 0; i < levels_; i++)
+        {
+            levels[i].cellSize = std::ldexp(cellSize, i);
+        }
+    }
+
+    void GridBroadPhase::add(const ItemHandle &item, const Rectangle &rect)
+    {
+        Level &level = levels[getLevelIndex(rect.w, rect.h)];
+
+        Number cl, ct, cw, ch;
+        std::tie(cl, ct, cw, ch) = Grid::toCellRect(level.cellSize, rect.x, rect.y, rect.w, rect.h);
+
+        for (Number cy = ct; cy < ct + ch; cy++)
+        {
+            for (Number cx = cl; cx < cl + cw; cx++)
+            {
+                addItemToCell(level, item, cx, cy);
+            }
+        }
+    }
+
+    void GridBroadPhase::remove(const ItemHandle &item, const Rectangle &rect)
+    {
+        Level &level = levels[getLevelIndex(rect.w, rect.h)];
+
+        Number cl, ct, cw, ch;
+        std::tie(cl, ct, cw, ch) = Grid::toCellRect(level.cellSize, rect.x, rect.y, rect.w, rect.h);
+
+        for (Number cy = ct; cy < ct + ch; cy++)
+        {
+            for (Number cx = cl; cx < cl + cw; cx++)
+            {
+                removeItemFromCell(level, item, cx, cy);
+            }
+        }
+    }
+
+    void GridBroadPhase::update(const ItemHandle &item, const Rectangle &from, const Rectangle &to)
+    {
+        const Index index = getLevelIndex(to.w, to.h);
+        if (getLevelIndex(from.w, from.h) != index)
+        {
+            remove(item, from);
+            add(item, to);
+            return;
+        }
+
+        Level &level = levels[index];
+        const CellSpan fromSpan = toCellSpan(level.cellSize, from);
+        const CellSpan toSpan = toCellSpan(level.cellSize, to);
+
+        // Most moves stay within the same cells
+        if (fromSpan == toSpan)
+        {
+            return;
+        }
+
+        // Cells in both spans keep the item as it is
+        for (Index cy = fromSpan.top; cy < fromSpan.bottom; cy++)
+        {
+            for (Index cx = fromSpan.left; cx < fromSpan.right; cx++)
+            {
+                if (!toSpan.contains(cx, cy))
+                {
+                    removeItemFromCell(level, item, cx, cy);
+                }
+            }
+        }
+        for (Index cy = toSpan.top; cy < toSpan.bottom; cy++)
+        {
+            for (Index cx = toSpan.left; cx < toSpan.right; cx++)
+            {
+                if (!fromSpan.contains(cx, cy))
+                {
+                    addItemToCell(level, item, cx, cy);
+                }
+            }
+        }
+    }
+
+    void GridBroadPhase::addMany(
+        const std::vector<ItemHandle> &items,
+        const std::vector<Rectangle> &rects,
+        const std::size_t &threads
+    )
+    {
+        std::vector<CellPair> pairs;
+        std::vector<CellPair> scratch;
+        for (Index index = 0; index < static_cast<Index>(levels.size()); index++)
+        {
+            Level &level = levels[index];
+            const auto inLevel = [this, &index](const Rectangle &rect)
+            {
+                return getLevelIndex(rect.w, rect.h) == index;
+            };
+            collectPairs<false>(items, [&level, &rects, &inLevel](
+                const std::size_t &begin, const std::size_t &end, CellSpan *spans, CellSpan *)
+                {
+                    toLevelSpans(level.cellSize, rects, inLevel, begin, end, spans);
+                }, threads, pairs, scratch);
+
+            std::size_t cellCount = 0;
+            for (std::size_t i = 0; i < pairs.size(); i++)
+            {
+                cellCount += i == 0 || pairs[i].key != pairs[i - 1].key;
+            }
+            if (layout == Layout::Hashed)
+            {
+                level.cells.reserve(level.cells.size() + cellCount);
+            }
+            // Blocks round up to a power of two, so this is enough for a level that was empty
+            level.pool.reserve(level.pool.size() + 2 * pairs.size());
+
+            forEachRun(pairs, [this, &level](const std::uint64_t &key, const CellPair *first, const CellPair *last)
+            {
+                appendRun(level, key, first, last);
+            });
+        }
+    }
+
+    void GridBroadPhase::removeMany(const std::vector<ItemHandle> &items, const std::vector<Rectangle> &rects)
+    {
+        std::vector<CellPair> pairs;
+        std::vector<CellPair> scratch;
+        for (Index index = 0; index < static_cast<Index>(levels.size()); index++)
+        {
+            Level &level = levels[index];
+            const auto inLevel = [this, &index](const Rectangle &rect)
+            {
+                return getLevelIndex(rect.w, rect.h) == index;
+            };
+            collectPairs<false>(items, [&level, &rects, &inLevel](
+                const std::size_t &begin, const std::size_t &end, CellSpan *spans, CellSpan *)
+                {
+                    toLevelSpans(level.cellSize, rects, inLevel, begin, end, spans);
+                }, 1, pairs, scratch);
+
+            forEachRun(pairs, [this, &level](const std::uint64_t &key, CellPair *first, CellPair *last)
+            {
+                removeRun(level, key, first, last);
+            });
+        }
+    }
+
+    void GridBroadPhase::updateMany(
+        const std::vector<ItemHandle> &items,
+        const std::vector<Rectangle> &froms,
+        const std::vector<Rectangle> &tos,
+        const std::size_t &threads
+    )
+    {
+        // Bucketing only pays off once its pair collection and sort run in parallel
+        if (threads < 2 || items.size() < minBucketedUpdates)
+        {
+            BroadPhase::updateMany(items, froms, tos, threads);
+            return;
+        }
+
+        // Like update, only the cells an item leaves or enters are touched, but each
+        // of them once for the whole batch
+        std::vector<CellPair> pairs;
+        std::vector<CellPair> scratch;
+        for (Index index = 0; index < static_cast<Index>(levels.size()); index++)
+        {
+            Level &level = levels[index];
+            const auto inLevel = [this, &index](const Rectangle &rect)
+            {
+                return getLevelIndex(rect.w, rect.h) == index;
+            };
+            collectPairs<true>(items, [&level, &froms, &tos, &inLevel](
+                const std::size_t &begin, const std::size_t &end, CellSpan *spans, CellSpan *skips)
+                {
+                    toLevelSpans(level.cellSize, froms, inLevel, begin, end, spans);
+                    toLevelSpans(level.cellSize, tos, inLevel, begin, end, skips);
+                }, threads, pairs, scratch);
+            forEachRun(pairs, [this, &level](const std::uint64_t &key, CellPair *first, CellPair *last)
+            {
+                removeRun(level, key, first, last);
+            });
+
+            collectPairs<true>(items, [&level, &froms, &tos, &inLevel](
+                const std::size_t &begin, const std::size_t &end, CellSpan *spans, CellSpan *skips)
+                {
+                    toLevelSpans(level.cellSize, tos, inLevel, begin, end, spans);
+                    toLevelSpans(level.cellSize, froms, inLevel, begin, end, skips);
+                }, threads, pairs, scratch);
+            forEachRun(pairs, [this, &level](const std::uint64_t &key, const CellPair *first, const CellPair *last)
+            {
+                appendRun(level, key, first, last);
+            });
+        }
+    }
+
+    void GridBroadPhase::clear()
+    {
+        for (Level &level : levels)
+        {
+            level.cells.clear();
+            level.tileIndices.clear();
+            level.tiles.clear();
+            level.pool.clear();
+            for (std::vector<std::uint32_t> &blocks : level.freeBlocks)
+            {
+                blocks.clear();
+            }
+        }
+    }
+
+    void GridBroadPhase::queryRect(const Rectangle &rect, std::vector<ItemHandle> &items) const
+    {
+        beginQuery();
+
+        for (const Level &level : levels)
+        {
+            const CellSpan span = toCellSpan(level.cellSize, rect);
+            forEachCell(level, span.left, span.top, span.right, span.bottom,
+                [this, &level, &items](const Cell &cell)
+                {
+                    // No cell.itemCount > 1 because tunneling
+                    if (cell.itemCount == 0)
+                    {
+                        return;
+                    }
+
+                    BUMP_BACKEND_STAT(cellsVisited, 1);
+                    appendUnvisited(level, cell, items);
+                });
+        }
+    }
+
+    void GridBroadPhase::queryPoint(const Number &x, const Number &y, std::vector<ItemHandle> &items) const
+    {
+        for (const Level &level : levels)
+        {
+            Number cx, cy;
+            std::tie(cx, cy) = Grid::toCell(level.cellSize, x, y);
+
+            const Cell *cell = getCell(level, cx, cy);
+            if (cell != nullptr)
+            {
+                BUMP_BACKEND_STAT(cellsVisited, 1);
+                const ItemHandle *cellItems = getItems(level, *cell);
+                items.insert(items.end(), cellItems, cellItems + cell->itemCount);
+            }
+        }
+    }
+
+    void GridBroadPhase::querySegment(
+        const Number &x1, const Number &y1,
+        const Number &x2, const Number &y2,
+        std::vector<ItemHandle> &items
+    ) const
+    {
+        beginQuery();
+
+        for (const Level &level : levels)
+        {
+            // The walk only ever steps forward, so a cell can only come up twice in a row
+            const Cell *last = nullptr;
+            Grid::traverse(level.cellSize, x1, y1, x2, y2,
+                [this, &level, &items, &last](const Number &cx, const Number &cy)
+                {
+                    const Cell *cell = getCell(level, cx, cy);
+                    if (cell == nullptr || cell == last)
+                    {
+                        return;
+                    }
+                    last = cell;
+
+                    BUMP_BACKEND_STAT(cellsVisited, 1);
+                    appendUnvisited(level, *cell, items);
+                });
+        }
+    }
+
+    std::size_t GridBroadPhase::countCells() const
+    {
+        std::size_t count = 0;
+        for (const Level &level : levels)
+        {
+            count += level.cells.size();
+            for (const Tile &tile : level.tiles)
+            {
+                for (std::uint64_t created = tile.createdCells; created != 0; created &= created - 1)
+                {
+                    count++;
+                }
+            }
+        }
+        return count;
+    }
+
+    void GridBroadPhase::save(std::vector<std::uint8_t> &blob) const
+    {
+        Blob::write(blob, kind);
+        Blob::write(blob, static_cast<std::uint32_t>(layout));
+        Blob::write(blob, static_cast<std::uint32_t>(levels.size()));
+        for (const Level &level : levels)
+        {
+            Blob::write(blob, level.cellSize);
+            level.cells.save(blob);
+            level.tileIndices.save(blob);
+            Blob::writeArray(blob, level.tiles);
+            Blob::writeArray(blob, level.pool);
+            for (const std::vector<std::uint32_t> &blocks : level.freeBlocks)
+            {
+                Blob::writeArray(blob, blocks);
+            }
+        }
+    }
+
+    void GridBroadPhase::load(Blob::Reader &reader, const std::vector<std::uint8_t> *generations)
+    {
+        if (reader.read<std::uint32_t>() != kind)
+        {
+            throw Exception::InvalidArgumentError();
+        }
+
+        const std::uint32_t layout_ = reader.read<std::uint32_t>();
+        if (layout_ > static_cast<std::uint32_t>(Layout::Tiled))
+        {
+            throw Exception::InvalidArgumentError();
+        }
+
+        const std::uint32_t count = reader.read<std::uint32_t>();
+        if (count < 1)
+        {
+            throw Exception::InvalidArgumentError();
+        }
+
+        const auto readLevels = [&reader](std::vector<Level> &into)
+        {
+            for (Level &level : into)
+            {
+                level.cellSize = reader.read<Number>();
+                level.cells.load(reader);
+                level.tileIndices.load(reader);
+                reader.readArray(level.tiles);
+                reader.readArray(level.pool);
+                for (std::vector<std::uint32_t> &blocks : level.freeBlocks)
+                {
+                    reader.readArray(blocks);
+                }
+            }
+        };
+
+        if (generations == nullptr)
+        {
+            // Trusted, straight over the levels so that their storage gets reused
+            layout = static_cast<Layout>(layout_);
+            levels.resize(count);
+            readLevels(levels);
+            if (!reader.atEnd())
+            {
+                throw Exception::InvalidArgumentError();
+            }
+            return;
+        }
+
+        // Read aside, so that a bad blob leaves the grid as it was
+        std::vector<Level> loaded(count);
+        readLevels(loaded);
+        if (!reader.atEnd())
+        {
+            throw Exception::InvalidArgumentError();
+        }
+
+        for (const Level &level : loaded)
+        {
+            if (!isValid(level, *generations))
+            {
+                throw Exception::InvalidArgumentError();
+            }
+        }
+
+        layout = static_cast<Layout>(layout_);
+        levels.swap(loaded);
+    }
+
+    bool GridBroadPhase::isValid(const Level &level, const std::vector<std::uint8_t> &generations)
+    {
+        if (!(level.cellSize > 0) || !level.cells.isValid() || !level.tileIndices.isValid())
+        {
+            return false;
+        }
+
+        const auto isValidCell = [&level, &generations](const Cell &cell)
+        {
+            const ItemHandle *items = cell.items;
+            if (cell.isSpilled())
+            {
+                const std::uint64_t capacity = cell.blockCapacity();
+                if (cell.itemCount > capacity || cell.blockOffset() + capacity > level.pool.size())
+                {
+                    return false;
+                }
+                items = level.pool.data() + cell.blockOffset();
+            }
+
+            for (std::uint32_t i = 0; i < cell.itemCount; i++)
+            {
+                if (!isLive(items[i], generations))
+                {
+                    return false;
+                }
+            }
+            return true;
+        };
+
+        for (const auto &slot : level.cells)
+        {
+            if (!isValidCell(slot.second))
+            {
+                return false;
+            }
+        }
+
+        for (const auto &slot : level.tileIndices)
+        {
+            if (slot.second >= level.tiles.size())
+            {
+                return false;
+            }
+        }
+
+        for (const Tile &tile : level.tiles)
+        {
+            for (const Cell &cell : tile.cells)
+            {
+                if (!isValidCell(cell))
+                {
+                    return false;
+                }
+            }
+        }
+
+        for (std::size_t blockClass = 0; blockClass < blockClasses; blockClass++)
+        {
+            const std::uint64_t capacity = static_cast<std::uint64_t>(minBlock) << blockClass;
+            for (const std::uint32_t &offset : level.freeBlocks[blockClass])
+            {
+                if (offset + capacity > level.pool.size())
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    Index GridBroadPhase::getLevelIndex(const Number &w, const Number &h) const
+    {
+        const Number size = std::max(w, h);
+        const Index last = static_cast<Index>(levels.size()) - 1;
+
+        Index index = 0;
+        while (index < last && levels[index].cellSize < size)
+        {
+            index++;
+        }
+        return index;
+    }
+
+    const GridBroadPhase::Cell *GridBroadPhase::getCell(const Level &level, const Number &cx, const Number &cy) const
+    {
+        if (layout == Layout::Tiled)
+        {
+            // Arithmetic shifts, so that negative cells floor to their tile too
+            const Index x = static_cast<Index>(cx);
+            const Index y = static_cast<Index>(cy);
+            auto found = level.tileIndices.find(Grid::toCellKey(x >> tileBits, y >> tileBits));
+            if (found == level.tileIndices.end())
+            {
+                return nullptr;
+            }
+
+            const Tile &tile = level.tiles[found->second];
+            const std::uint32_t index = toMortonIndex(x, y);
+            return (tile.createdCells >> index & 1) != 0 ? &tile.cells[index] : nullptr;
+        }
+
+        auto found = level.cells.find(Grid::toCellKey(cx, cy));
+        if (found == level.cells.end())
+        {
+            return nullptr;
+        }
+        return &found->second;
+    }
+
+    GridBroadPhase::Cell *GridBroadPhase::getCell(Level &level, const Number &cx, const Number &cy)
+    {
+        return const_cast<Cell*>(static_cast<const GridBroadPhase*>(this)->getCell(level, cx, cy));
+    }
+
+    std::pair<GridBroadPhase::Cell*, bool> GridBroadPhase::insertCell(Level &level, const Number &cx, const Number &cy)
+    {
+        if (layout == Layout::Tiled)
+        {
+            const Index x = static_cast<Index>(cx);
+            const Index y = static_cast<Index>(cy);
+            const std::uint32_t tileCount = static_cast<std::uint32_t>(level.tiles.size());
+            BUMP_BACKEND_STAT(allocations, level.tileIndices.isFull());
+            auto inserted = level.tileIndices.insert(Grid::toCellKey(x >> tileBits, y >> tileBits), tileCount);
+            if (inserted.second)
+            {
+                BUMP_BACKEND_STAT(allocations, level.tiles.size() == level.tiles.capacity());
+                level.tiles.emplace_back();
+            }
+
+            Tile &tile = level.tiles[inserted.first->second];
+            const std::uint32_t index = toMortonIndex(x, y);
+            const bool created = (tile.createdCells >> index & 1) == 0;
+            tile.createdCells |= std::uint64_t(1) << index;
+            return std::make_pair(&tile.cells[index], created);
+        }
+
+        BUMP_BACKEND_STAT(allocations, level.cells.isFull());
+        auto inserted = level.cells.insert(Grid::toCellKey(cx, cy), Cell());
+        return std::make_pair(&inserted.first->second, inserted.second);
+    }
+
+    template<typename Function>
+    void GridBroadPhase::forEachCell(
+        const Level &level,
+        const Index &left, const Index &top,
+        const Index &right, const Index &bottom,
+        const Function &function
+    ) const
+    {
+        if (layout == Layout::Hashed)
+        {
+            for (Index cy = top; cy < bottom; cy++)
+            {
+                for (Index cx = left; cx < right; cx++)
+                {
+                    const Cell *cell = getCell(level, cx, cy);
+                    if (cell != nullptr)
+                    {
+                        function(*cell);
+                    }
+                }
+            }
+            return;
+        }
+
+        if (left >= right || top >= bottom)
+        {
+            return;
+        }
+
+        // One lookup per tile, missing tiles skipped whole
+        constexpr Index tileSize = 1 << tileBits;
+        for (Index ty = top >> tileBits; ty <= (bottom - 1) >> tileBits; ty++)
+        {
+            for (Index tx = left >> tileBits; tx <= (right - 1) >> tileBits; tx++)
+            {
+                auto found = level.tileIndices.find(Grid::toCellKey(tx, ty));
+                if (found == level.tileIndices.end())
+                {
+                    continue;
+                }
+
+                const Tile &tile = level.tiles[found->second];
+                const Index tileBottom = std::min(bottom, ty * tileSize + tileSize);
+                const Index tileRight = std::min(right, tx * tileSize + tileSize);
+                for (Index cy = std::max(top, ty * tileSize); cy < tileBottom; cy++)
+                {
+                    for (Index cx = std::max(left, tx * tileSize); cx < tileRight; cx++)
+                    {
+                        const std::uint32_t index = toMortonIndex(cx, cy);
+                        if ((tile.createdCells >> index & 1) != 0)
+                        {
+                            function(tile.cells[index]);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    void GridBroadPhase::addItemToCell(Level &level, const ItemHandle &item, const Number &cx, const Number &cy)
+    {
+        auto inserted = insertCell(level, cx, cy);
+
+        Cell &cell = *inserted.first;
+        const ItemHandle *cellItems = getItems(level, cell);
+        if (std::find(cellItems, cellItems + cell.itemCount, item) != cellItems + cell.itemCount)
+        {
+            return;
+        }
+
+        const std::uint32_t itemCount = cell.itemCount;
+        growCell(level, cell, itemCount + 1)[itemCount] = item;
+    }
+
+    bool GridBroadPhase::removeItemFromCell(Level &level, const ItemHandle &item, const Number &cx, const Number &cy)
+    {
+        Cell *found = getCell(level, cx, cy);
+        if (found == nullptr)
+        {
+            return false;
+        }
+
+        // The cell itself stays, like in bump.lua, even once empty
+        Cell &cell = *found;
+        ItemHandle *cellItems = getItems(level, cell);
+        ItemHandle *position = std::find(cellItems, cellItems + cell.itemCount, item);
+        if (position == cellItems + cell.itemCount)
+        {
+            return false;
+        }
+
+        *position = cellItems[cell.itemCount - 1];
+        shrinkCell(level, cell, cell.itemCount - 1);
+        return true;
+    }
+
+    template<typename Pair>
+    void GridBroadPhase::appendRun(Level &level, const std::uint64_t &key, const Pair *first, const Pair *last)
+    {
+        Index cx, cy;
+        fromCellKey(key, cx, cy);
+        auto inserted = insertCell(level, cx, cy);
+        Cell &cell = *inserted.first;
+
+        const std::uint32_t itemCount = cell.itemCount;
+        ItemHandle *cellItems = growCell(level, cell, itemCount + static_cast<std::uint32_t>(last - first)) + itemCount;
+        for (const Pair *pair = first; pair != last; pair++)
+        {
+            *cellItems++ = pair->item;
+        }
+    }
+
+    template<typename Pair>
+    void GridBroadPhase::removeRun(Level &level, const std::uint64_t &key, Pair *first, Pair *last)
+    {
+        Index cx, cy;
+        fromCellKey(key, cx, cy);
+        Cell *found = getCell(level, cx, cy);
+        if (found == nullptr)
+        {
+            return;
+        }
+
+        const auto byItem = [](const Pair &a, const Pair &b) { return a.item.value < b.item.value; };
+        std::sort(first, last, byItem);
+
+        // Kept items stay in order, unlike with removeItemFromCell
+        Cell &cell = *found;
+        ItemHandle *cellItems = getItems(level, cell);
+        std::uint32_t kept = 0;
+        for (std::uint32_t i = 0; i < cell.itemCount; i++)
+        {
+            Pair probe;
+            probe.item = cellItems[i];
+            if (!std::binary_search(first, last, probe, byItem))
+            {
+                cellItems[kept++] = cellItems[i];
+            }
+        }
+        shrinkCell(level, cell, kept);
+    }
+
+    ItemHandle *GridBroadPhase::getItems(Level &level, Cell &cell)
+    {
+        return cell.isSpilled() ? level.pool.data() + cell.blockOffset() : cell.items;
+    }
+
+    const ItemHandle *GridBroadPhase::getItems(const Level &level, const Cell &cell)
+    {
+        return cell.isSpilled() ? level.pool.data() + cell.blockOffset() : cell.items;
+    }
+
+    ItemHandle *GridBroadPhase::growCell(Level &level, Cell &cell, const std::uint32_t &itemCount)
+    {
+        const bool spilled = cell.isSpilled();
+        const std::uint32_t oldCapacity = spilled ? cell.blockCapacity() : inlineItems;
+        if (itemCount <= oldCapacity)
+        {
+            cell.itemCount = itemCount;
+            return getItems(level, cell);
+        }
+
+        std::uint32_t capacity = spilled ? oldCapacity * 2 : minBlock;
+        while (capacity < itemCount)
+        {
+            capacity *= 2;
+        }
+
+        // Allocating may move the pool, so the handles are found only afterwards
+        const std::uint32_t offset = allocateBlock(level, capacity);
+        std::copy_n(getItems(level, cell), cell.itemCount, level.pool.data() + offset);
+        if (spilled)
+        {
+            freeBlock(level, cell.blockOffset(), oldCapacity);
+        }
+
+        cell.itemCount = itemCount;
+        cell.blockOffset() = offset;
+        cell.blockCapacity() = capacity;
+        return level.pool.data() + offset;
+    }
+
+    void GridBroadPhase::shrinkCell(Level &level, Cell &cell, const std::uint32_t &itemCount)
+    {
+        if (cell.isSpilled() && itemCount <= inlineItems)
+        {
+            const std::uint32_t offset = cell.blockOffset();
+            const std::uint32_t capacity = cell.blockCapacity();
+            std::copy_n(level.pool.data() + offset, itemCount, cell.items);
+            freeBlock(level, offset, capacity);
+        }
+        cell.itemCount = itemCount;
+    }
+
+    std::uint32_t GridBroadPhase::allocateBlock(Level &level, const std::uint32_t &capacity)
+    {
+        std::vector<std::uint32_t> &blocks = level.freeBlocks[getBlockClass(capacity)];
+        if (!blocks.empty())
+        {
+            const std::uint32_t offset = blocks.back();
+            blocks.pop_back();
+            return offset;
+        }
+
+        const std::size_t offset = level.pool.size();
+        if (offset + capacity > std::numeric_limits<std::uint32_t>::max())
+        {
+            throw Exception::ComputationError();
+        }
+
+        BUMP_BACKEND_STAT(allocations, offset + capacity > level.pool.capacity());
+        level.pool.resize(offset + capacity);
+        return static_cast<std::uint32_t>(offset);
+    }
+
+    void GridBroadPhase::freeBlock(Level &level, const std::uint32_t &offset, const std::uint32_t &capacity)
+    {
+        if (capacity > 0)
+        {
+            level.freeBlocks[getBlockClass(capacity)].push_back(offset);
+        }
+    }
+
+    std::size_t GridBroadPhase::getBlockClass(const std::uint32_t &capacity)
+    {
+        std::size_t blockClass = 0;
+        while ((minBlock << blockClass) < capacity)
+        {
+            blockClass++;
+        }
+        return blockClass;
+    }
+
+    void GridBroadPhase::beginQuery() const
+    {
+        // Stamps of past queries could match again once the epoch wraps around
+        if (++visitEpoch == 0)
+        {
+            std::fill(visitStamps.begin(), visitStamps.end(), 0);
+            visitEpoch = 1;
+        }
+    }
+
+    void GridBroadPhase::appendUnvisited(const Level &level, const Cell &cell, std::vector<ItemHandle> &items) const
+    {
+        const ItemHandle *cellItems = getItems(level, cell);
+        for (std::uint32_t i = 0; i < cell.itemCount; i++)
+        {
+            const std::uint32_t index = cellItems[i].getIndex();
+            if (index >= visitStamps.size())
+            {
+                const std::size_t size = std::max<std::size_t>(index + 1, visitStamps.size() * 2);
+                BUMP_BACKEND_STAT(allocations, size > visitStamps.capacity());
+                visitStamps.resize(size, 0);
+            }
+
+            if (visitStamps[index] == visitEpoch)
+            {
+                BUMP_BACKEND_STAT(dedupeRejects, 1);
+                continue;
+            }
+            visitStamps[index] = visitEpoch;
+            items.push_back(cellItems[i]);
+        }
+    }
+
+    /// ------------------------------------------
+    /// -- AABB tree
+    /// ------------------------------------------
+    constexpr std::uint32_t AabbTreeBroadPhase::kind;
+
+    AabbTreeBroadPhase::AabbTreeBroadPhase(const Number &margin_) : margin(margin_)
+    {
+        if (margin_ < 0)
+        {
+            throw Exception::InvalidArgumentError();
+        }
+    }
+
+    void AabbTreeBroadPhase::add(const ItemHandle &item, const Rectangle &rect)
+    {
+        const Index leaf = allocateNode();
+        nodes[leaf].bounds = fatten(rect);
+        nodes[leaf].height = 0;
+        nodes[leaf].item = item;
+
+        BUMP_BACKEND_STAT(allocations, leaves.isFull());
+        leaves[item] = leaf;
+        insertLeaf(leaf);
+    }
+
+    void AabbTreeBroadPhase::remove(const ItemHandle &item, const Rectangle &rect)
+    {
+        auto found = leaves.find(item);
+        if (found == leaves.end())
+        {
+            return;
+        }
+
+        const Index leaf = found->second;
+        leaves.erase(found);
+
+        removeLeaf(leaf);
+        freeNode(leaf);
+    }
+
+    void AabbTreeBroadPhase::clear()
+    {
+        nodes.clear();
+        root = -1;
+        freeList = -1;
+        nodeCount = 0;
+        leaves.clear();
+    }
+
+    void AabbTreeBroadPhase::update(const ItemHandle &item, const Rectangle &from, const Rectangle &to)
+    {
+        const Index leaf = leaves.at(item);
+
+        const Bounds tight{ to.x, to.y, to.x + to.w, to.y + to.h };
+        if (contains(nodes[leaf].bounds, tight))
+        {
+            return;
+        }
+
+        removeLeaf(leaf);
+        nodes[leaf].bounds = fatten(to);
+        insertLeaf(leaf);
+    }
+
+    void AabbTreeBroadPhase::queryRect(const Rectangle &rect, std::vector<ItemHandle> &items) const
+    {
+        const Bounds query{ rect.x, rect.y, rect.x + rect.w, rect.y + rect.h };
+        collect([&query](const Bounds &bounds) { return overlaps(bounds, query); }, items);
+    }
+
+    void AabbTreeBroadPhase::queryPoint(const Number &x, const Number &y, std::vector<ItemHandle> &items) const
+    {
+        const Bounds query{ x, y, x, y };
+        collect([&query](const Bounds &bounds) { return overlaps(bounds, query); }, items);
+    }
+
+    void AabbTreeBroadPhase::querySegment(
+        const Number &x1, const Number &y1,
+        const Number &x2, const Number &y2,
+        std::vector<ItemHandle> &items
+    ) const
+    {
+        collect([&x1, &y1, &x2, &y2](const Bounds &bounds)
+            {
+                return std::get<0>(Rect::getSegmentIntersectionIndices(
+                    bounds.minX, bounds.minY,
+                    bounds.maxX - bounds.minX, bounds.maxY - bounds.minY,
+                    x1, y1, x2, y2, 0, 1
+                ));
+            }, items);
+    }
+
+    std::size_t AabbTreeBroadPhase::countCells() const
+    {
+        return nodeCount;
+    }
+
+    void AabbTreeBroadPhase::save(std::vector<std::uint8_t> &blob) const
+    {
+        Blob::write(blob, kind);
+        Blob::write(blob, margin);
+        Blob::write(blob, root);
+        Blob::write(blob, freeList);
+        Blob::write(blob, static_cast<std::uint64_t>(nodeCount));
+        Blob::writeArray(blob, nodes);
+        leaves.save(blob);
+    }
+
+    void AabbTreeBroadPhase::load(Blob::Reader &reader, const std::vector<std::uint8_t> *generations)
+    {
+        if (reader.read<std::uint32_t>() != kind)
+        {
+            throw Exception::InvalidArgumentError();
+        }
+
+        if (generations == nullptr)
+        {
+            // Trusted, straight over the tree so that its storage gets reused
+            margin = reader.read<Number>();
+            root = reader.read<Index>();
+            freeList = reader.read<Index>();
+            nodeCount = static_cast<std::size_t>(reader.read<std::uint64_t>());
+            reader.readArray(nodes);
+            leaves.load(reader);
+            if (!reader.atEnd())
+            {
+                throw Exception::InvalidArgumentError();
+            }
+            return;
+        }
+
+        // Read aside, so that a bad blob leaves the tree as it was
+        const Number loadedMargin = reader.read<Number>();
+        const Index loadedRoot = reader.read<Index>();
+        const Index loadedFreeList = reader.read<Index>();
+        const std::uint64_t loadedNodeCount = reader.read<std::uint64_t>();
+        std::vector<Node> loadedNodes;
+        FlatMap<ItemHandle, Index> loadedLeaves;
+        reader.readArray(loadedNodes);
+        loadedLeaves.load(reader);
+
+        if (!reader.atEnd())
+        {
+            throw Exception::InvalidArgumentError();
+        }
+
+        if (!(loadedMargin >= 0) || !loadedLeaves.isValid()
+            || !isValid(loadedRoot, loadedFreeList, loadedNodeCount, loadedNodes, loadedLeaves, *generations))
+        {
+            throw Exception::InvalidArgumentError();
+        }
+
+        margin = loadedMargin;
+        root = loadedRoot;
+        freeList = loadedFreeList;
+        nodeCount = static_cast<std::size_t>(loadedNodeCount);
+        nodes.swap(loadedNodes);
+        std::swap(leaves, loadedLeaves);
+    }
+
+    bool AabbTreeBroadPhase::isValid(
+        const Index &root,
+        const Index &freeList,
+        const std::uint64_t &nodeCount,
+        const std::vector<Node> &nodes,
+        const FlatMap<ItemHandle, Index> &leaves,
+        const std::vector<std::uint8_t> &generations
+    )
+    {
+        const Index size = static_cast<Index>(nodes.size());
+        const auto isLiveNode = [&nodes, &size](const Index &node)
+        {
+            return node >= 0 && node < size && nodes[node].height >= 0;
+        };
+
+        // Walked from the root: every child links back to its parent, so no node is reached
+        // twice and the walk ends, and heights are exact, which balance relies on
+        std::size_t reached = 0;
+        std::size_t leafCount = 0;
+        if (root != -1)
+        {
+            if (!isLiveNode(root) || nodes[root].parent != -1)
+            {
+                return false;
+            }
+
+            std::vector<Index> stack{ root };
+            while (!stack.empty())
+            {
+                const Index index = stack.back();
+                const Node &node = nodes[index];
+                stack.pop_back();
+                if (++reached > nodes.size())
+                {
+                    return false;
+                }
+
+                if (node.height == 0)
+                {
+                    // The one leaf of a live item
+                    const auto found = leaves.find(node.item);
+                    if (!isLive(node.item, generations) || found == leaves.end() || found->second != index)
+                    {
+                        return false;
+                    }
+                    leafCount++;
+                    continue;
+                }
+
+                if (!isLiveNode(node.left) || !isLiveNode(node.right)
+                    || nodes[node.left].parent != index || nodes[node.right].parent != index
+                    || node.height != 1 + std::max(nodes[node.left].height, nodes[node.right].height))
+                {
+                    return false;
+                }
+                stack.push_back(node.left);
+                stack.push_back(node.right);
+            }
+        }
+
+        std::size_t liveCount = 0;
+        for (const std::uint8_t &generation : generations)
+        {
+            liveCount += generation != 0;
+        }
+
+        // Nothing live outside the tree, and nothing but free nodes in the free list
+        std::size_t freeCount = 0;
+        for (Index index = freeList; index != -1; index = nodes[index].parent)
+        {
+            if (index < 0 || index >= size || nodes[index].height != -1 || ++freeCount > nodes.size())
+            {
+                return false;
+            }
+        }
+
+        return reached == nodeCount && reached + freeCount <= nodes.size()
+            && leafCount == leaves.size() && leafCount == liveCount;
+    }
+
+    AabbTreeBroadPhase::Bounds AabbTreeBroadPhase::merge(const Bounds &a, const Bounds &b)
+    {
+        return Bounds
+        {
+            std::min(a.minX, b.minX), std::min(a.minY, b.minY),
+            std::max(a.maxX, b.maxX), std::max(a.maxY, b.maxY)
+        };
+    }
+
+    Number AabbTreeBroadPhase::perimeter(const Bounds &bounds)
+    {
+        return 2 * ((bounds.maxX - bounds.minX) + (bounds.maxY - bounds.minY));
+    }
+
+    bool AabbTreeBroadPhase::contains(const Bounds &outer, const Bounds &inner)
+    {
+        return outer.minX <= inner.minX && outer.minY <= inner.minY &&
+            inner.maxX <= outer.maxX && inner.maxY <= outer.maxY;
+    }
+
+    bool AabbTreeBroadPhase::overlaps(const Bounds &a, const Bounds &b)
+    {
+        return a.minX <= b.maxX && b.minX <= a.maxX &&
+            a.minY <= b.maxY && b.minY <= a.maxY;
+    }
+
+    AabbTreeBroadPhase::Bounds AabbTreeBroadPhase::fatten(const Rectangle &rect) const
+    {
+        return Bounds
+        {
+            rect.x - margin, rect.y - margin,
+            rect.x + rect.w + margin, rect.y + rect.h + margin
+        };
+    }
+
+    Index AabbTreeBroadPhase::allocateNode()
+    {
+        Index node;
+        if (freeList != -1)
+        {
+            node = freeList;
+            freeList = nodes[node].parent;
+            nodes[node] = Node();
+        }
+        else
+        {
+            node = static_cast<Index>(nodes.size());
+            BUMP_BACKEND_STAT(allocations, nodes.size() == nodes.capacity());
+            nodes.emplace_back();
+        }
+
+        nodeCount++;
+        return node;
+    }
+
+    void AabbTreeBroadPhase::freeNode(const Index &node)
+    {
+        nodes[node] = Node();
+        nodes[node].parent = freeList;
+        freeList = node;
+        nodeCount--;
+    }
+
+    void AabbTreeBroadPhase::insertLeaf(const Index &leaf)
+    {
+        if (root == -1)
+        {
+            root = leaf;
+            nodes[root].parent = -1;
+            return;
+        }
+
+        // Find the best sibling using the surface area heuristic
+        const Bounds leafBounds = nodes[leaf].bounds;
+        Index index = root;
+        while (nodes[index].height > 0)
+        {
+            const Index left = nodes[index].left;
+            const Index right = nodes[index].right;
+
+            const Number area = perimeter(nodes[index].bounds);
+            const Number combinedArea = perimeter(merge(nodes[index].bounds, leafBounds));
+
+            // Cost of creating a new parent for this node and the new leaf
+            const Number cost = 2 * combinedArea;
+            // Minimum cost of pushing the leaf further down the tree
+            const Number inheritanceCost = 2 * (combinedArea - area);
+
+            const auto descendCost = [this, &leafBounds, &inheritanceCost](const Index &child)
+            {
+                const Number merged = perimeter(merge(leafBounds, nodes[child].bounds));
+                if (nodes[child].height == 0)
+                {
+                    return merged + inheritanceCost;
+                }
+                return merged - perimeter(nodes[child].bounds) + inheritanceCost;
+            };
+
+            const Number costLeft = descendCost(left);
+            const Number costRight = descendCost(right);
+
+            if (cost < costLeft && cost < costRight)
+            {
+                break;
+            }
+
+            index = costLeft < costRight ? left : right;
+        }
+
+        const Index sibling = index;
+        const Index oldParent = nodes[sibling].parent;
+        const Index newParent = allocateNode();
+
+        nodes[newParent].parent = oldParent;
+        nodes[newParent].bounds = merge(leafBounds, nodes[sibling].bounds);
+        nodes[newParent].height = nodes[sibling].height + 1;
+        nodes[newParent].left = sibling;
+        nodes[newParent].right = leaf;
+        nodes[sibling].parent = newParent;
+        nodes[leaf].parent = newParent;
+
+        if (oldParent == -1)
+        {
+            root = newParent;
+        }
+        else if (nodes[oldParent].left == sibling)
+        {
+            nodes[oldParent].left = newParent;
+        }
+        else
+        {
+            nodes[oldParent].right = newParent;
+        }
+
+        refit(nodes[leaf].parent);
+    }
+
+    void AabbTreeBroadPhase::removeLeaf(const Index &leaf)
+    {
+        if (leaf == root)
+        {
+            root = -1;
+            return;
+        }
+
+        const Index parent = nodes[leaf].parent;
+        const Index grandParent = nodes[parent].parent;
+        const Index sibling = nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+
+        if (grandParent == -1)
+        {
+            root = sibling;
+            nodes[sibling].parent = -1;
+            freeNode(parent);
+            return;
+        }
+
+        if (nodes[grandParent].left == parent)
+        {
+            nodes[grandParent].left = sibling;
+        }
+        else
+        {
+            nodes[grandParent].right = sibling;
+        }
+        nodes[sibling].parent = grandParent;
+        freeNode(parent);
+
+        refit(grandParent);
+    }
+
+    // Performs a left or right rotation if node is imbalanced, returns the new subtree root
+    Index AabbTreeBroadPhase::balance(const Index &a)
+    {
+        if (nodes[a].height < 2)
+        {
+            return a;
+        }
+
+        const Index b = nodes[a].left;
+        const Index c = nodes[a].right;
+        const Index difference = nodes[c].height - nodes[b].height;
+
+        // Rotate the taller child up, the shorter grandchild goes down to a
+        const auto rotate = [this, &a](const Index &up, const Index &stay, const bool &upIsRight)
+        {
+            const Index f = nodes[up].left;
+            const Index g = nodes[up].right;
+
+            nodes[up].left = a;
+            nodes[up].parent = nodes[a].parent;
+            nodes[a].parent = up;
+
+            const Index upParent = nodes[up].parent;
+            if (upParent == -1)
+            {
+                root = up;
+            }
+            else if (nodes[upParent].left == a)
+            {
+                nodes[upParent].left = up;
+            }
+            else
+            {
+                nodes[upParent].right = up;
+            }
+
+            Index keep = f;
+            Index give = g;
+            if (nodes[f].height <= nodes[g].height)
+            {
+                std::swap(keep, give);
+            }
+
+            nodes[up].right = keep;
+            if (upIsRight)
+            {
+                nodes[a].right = give;
+            }
+            else
+            {
+                nodes[a].left = give;
+            }
+            nodes[give].parent = a;
+
+            nodes[a].bounds = merge(nodes[stay].bounds, nodes[give].bounds);
+            nodes[up].bounds = merge(nodes[a].bounds, nodes[keep].bounds);
+
+            nodes[a].height = 1 + std::max(nodes[stay].height, nodes[give].height);
+            nodes[up].height = 1 + std::max(nodes[a].height, nodes[keep].height);
+        };
+
+        if (difference > 1)
+        {
+            rotate(c, b, true);
+            return c;
+        }
+        if (difference < -1)
+        {
+            rotate(b, c, false);
+            return b;
+        }
+        return a;
+    }
+
+    void AabbTreeBroadPhase::refit(Index index)
+    {
+        while (index != -1)
+        {
+            index = balance(index);
+
+            const Index left = nodes[index].left;
+            const Index right = nodes[index].right;
+
+            nodes[index].height = 1 + std::max(nodes[left].height, nodes[right].height);
+            nodes[index].bounds = merge(nodes[left].bounds, nodes[right].bounds);
+
+            index = nodes[index].parent;
+        }
+    }
+
+    template<typename Predicate>
+    void AabbTreeBroadPhase::collect(const Predicate &predicate, std::vector<ItemHandle> &items) const
+    {
+        if (root == -1)
+        {
+            return;
+        }
+
+        stack.assign(1, root);
+        while (!stack.empty())
+        {
+            const Node &node = nodes[stack.back()];
+            stack.pop_back();
+            BUMP_BACKEND_STAT(cellsVisited, 1);
+
+            if (!predicate(node.bounds))
+            {
+                continue;
+            }
+
+            if (node.height == 0)
+            {
+                items.push_back(node.item);
+            }
+            else
+            {
+                BUMP_BACKEND_STAT(allocations, stack.size() + 2 > stack.capacity());
+                stack.push_back(node.left);
+                stack.push_back(node.right);
+            }
+        }
+    }
+
+    /// ------------------------------------------
+    /// -- Sort and sweep
+    /// ------------------------------------------
+    constexpr std::uint32_t SweepAndPruneBroadPhase::kind;
+
+    void SweepAndPruneBroadPhase::add(const ItemHandle &item, const Rectangle &rect)
+    {
+        BUMP_BACKEND_STAT(allocations, positions.isFull() + (entries.size() == entries.capacity()));
+        positions[item] = entries.size();
+        entries.push_back(Entry{ rect.x, rect.x + rect.w, rect.y, rect.y + rect.h, item });
+        maxWidth = std::max(maxWidth, rect.w);
+    }
+
+    void SweepAndPruneBroadPhase::remove(const ItemHandle &item, const Rectangle &rect)
+    {
+        auto found = positions.find(item);
+        if (found == positions.end())
+        {
+            return;
+        }
+
+        entries[found->second].item = ItemHandle();
+        positions.erase(found);
+        removedCount++;
+    }
+
+    void SweepAndPruneBroadPhase::clear()
+    {
+        entries.clear();
+        positions.clear();
+        sortedCount = 0;
+        removedCount = 0;
+        maxWidth = 0;
+    }
+
+    void SweepAndPruneBroadPhase::update(const ItemHandle &item, const Rectangle &from, const Rectangle &to)
+    {
+        std::size_t position = positions.at(item);
+        entries[position] = Entry{ to.x, to.x + to.w, to.y, to.y + to.h, item };
+        maxWidth = std::max(maxWidth, to.w);
+
+        if (position >= sortedCount)
+        {
+            return;
+        }
+
+        // Insertion sort step: coherent motion only moves an entry a few slots
+        while (position > 0 && entries[position - 1].minX > entries[position].minX)
+        {
+            std::swap(entries[position - 1], entries[position]);
+            if (entries[position].item != ItemHandle())
+            {
+                positions[entries[position].item] = position;
+            }
+            position--;
+        }
+        while (position + 1 < sortedCount && entries[position + 1].minX < entries[position].minX)
+        {
+            std::swap(entries[position + 1], entries[position]);
+            if (entries[position].item != ItemHandle())
+            {
+                positions[entries[position].item] = position;
+            }
+            position++;
+        }
+        positions[item] = position;
+    }
+
+    void SweepAndPruneBroadPhase::queryRect(const Rectangle &rect, std::vector<ItemHandle> &items) const
+    {
+        sweep(rect.x, rect.y, rect.x + rect.w, rect.y + rect.h, items);
+    }
+
+    void SweepAndPruneBroadPhase::queryPoint(const Number &x, const Number &y, std::vector<ItemHandle> &items) const
+    {
+        sweep(x, y, x, y, items);
+    }
+
+    void SweepAndPruneBroadPhase::querySegment(
+        const Number &x1, const Number &y1,
+        const Number &x2, const Number &y2,
+        std::vector<ItemHandle> &items
+    ) const
+    {
+        sweep(std::min(x1, x2), std::min(y1, y2), std::max(x1, x2), std::max(y1, y2), items);
+    }
+
+    std::size_t SweepAndPruneBroadPhase::countCells() const
+    {
+        return 0;
+    }
+
+    void SweepAndPruneBroadPhase::save(std::vector<std::uint8_t> &blob) const
+    {
+        // Storing the merged order means a restored index is query-ready
+        flush();
+
+        Blob::write(blob, kind);
+        Blob::write(blob, maxWidth);
+        Blob::write(blob, static_cast<std::uint64_t>(removedCount));
+        Blob::writeArray(blob, entries);
+        positions.save(blob);
+    }
+
+    void SweepAndPruneBroadPhase::load(Blob::Reader &reader, const std::vector<std::uint8_t> *generations)
+    {
+        if (reader.read<std::uint32_t>() != kind)
+        {
+            throw Exception::InvalidArgumentError();
+        }
+
+        if (generations == nullptr)
+        {
+            // Trusted, straight over the index so that its storage gets reused
+            maxWidth = reader.read<Number>();
+            removedCount = static_cast<std::size_t>(reader.read<std::uint64_t>());
+            reader.readArray(entries);
+            positions.load(reader);
+            sortedCount = entries.size();
+            if (!reader.atEnd())
+            {
+                throw Exception::InvalidArgumentError();
+            }
+            return;
+        }
+
+        // Read aside, so that a bad blob leaves the index as it was
+        const Number loadedMaxWidth = reader.read<Number>();
+        const std::uint64_t loadedRemovedCount = reader.read<std::uint64_t>();
+        std::vector<Entry> loadedEntries;
+        FlatMap<ItemHandle, std::size_t> loadedPositions;
+        reader.readArray(loadedEntries);
+        loadedPositions.load(reader);
+
+        if (!reader.atEnd() || loadedRemovedCount > loadedEntries.size() || !loadedPositions.isValid())
+        {
+            throw Exception::InvalidArgumentError();
+        }
+
+        for (const Entry &entry : loadedEntries)
+        {
+            if (entry.item != ItemHandle() && !isLive(entry.item, *generations))
+            {
+                throw Exception::InvalidArgumentError();
+            }
+        }
+
+        for (const auto &slot : loadedPositions)
+        {
+            if (slot.second >= loadedEntries.size() || loadedEntries[slot.second].item != slot.first)
+            {
+                throw Exception::InvalidArgumentError();
+            }
+        }
+
+        maxWidth = loadedMaxWidth;
+        removedCount = static_cast<std::size_t>(loadedRemovedCount);
+        entries.swap(loadedEntries);
+        std::swap(positions, loadedPositions);
+        sortedCount = entries.size();
+    }
+
+    void SweepAndPruneBroadPhase::flush() const
+    {
+        const bool pending = sortedCount < entries.size();
+        if (!pending && removedCount * 4 <= entries.size())
+        {
+            return;
+        }
+
+        const auto byMinX = [](const Entry &a, const Entry &b) { return a.minX < b.minX; };
+
+        // Sort the new tail and merge it into the sorted prefix, dropping removed entries
+        std::sort(entries.begin() + sortedCount, entries.end(), byMinX);
+        std::inplace_merge(entries.begin(), entries.begin() + sortedCount, entries.end(), byMinX);
+        entries.erase(
+            std::remove_if(entries.begin(), entries.end(), [](const Entry &entry) { return entry.item == ItemHandle(); }),
+            entries.end()
+        );
+
+        maxWidth = 0;
+        for (std::size_t i = 0; i < entries.size(); i++)
+        {
+            positions[entries[i].item] = i;
+            maxWidth = std::max(maxWidth, entries[i].maxX - entries[i].minX);
+        }
+
+        sortedCount = entries.size();
+        removedCount = 0;
+    }
+
+    void SweepAndPruneBroadPhase::sweep(
+        const Number &minX, const Number &minY,
+        const Number &maxX, const Number &maxY,
+        std::vector<ItemHandle> &items
+    ) const
+    {
+        flush();
+
+        // No entry wider than maxWidth can start before minX - maxWidth and still reach minX
+        auto entry = std::lower_bound(entries.begin(), entries.end(), minX - maxWidth,
+            [](const Entry &entry, const Number &x) { return entry.minX < x; });
+
+        for (; entry != entries.end() && entry->minX <= maxX; ++entry)
+        {
+            BUMP_BACKEND_STAT(cellsVisited, 1);
+            if (entry->item != ItemHandle() && entry->maxX >= minX &&
+                entry->minY <= maxY && entry->maxY >= minY)
+            {
+                items.push_back(entry->item);
+            }
+        }
+    }
+}
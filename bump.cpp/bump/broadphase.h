@@ -0,0 +1,328 @@
+#ifndef BROADPHASE_H_INCLUDED_5A0C8E3B_91D7_4F26_B8E4_2D6F17C3A9B0
+#define BROADPHASE_H_INCLUDED_5A0C8E3B_91D7_4F26_B8E4_2D6F17C3A9B0
+#include "bump.h"
+
+namespace Bump
+{
+    /// ------------------------------------------
+    /// -- Broad phase backends
+    /// ------------------------------------------
+
+    // Uniform grid from bump.lua, optionally split into levels of
+    // cellSize * 2^k so that every item lands in a level matching its size.
+    class GridBroadPhase : public BroadPhase
+    {
+    public:
+        enum class Layout : std::uint32_t
+        {
+            // Every cell hashed on its own, like in bump.lua
+            Hashed = 0,
+            // Tiles of 8x8 cells in Morton order, allocated as a whole on demand. Neighbouring
+            // cells share a tile, so rect queries and segment walks mostly stay in contiguous
+            // memory, for up to 63 unused cells per tile in sparse worlds.
+            Tiled = 1,
+        };
+
+        GridBroadPhase(const Number &cellSize = 64, const Index &levels = 1, const Layout &layout = Layout::Hashed);
+
+        void add(const ItemHandle &item, const Rectangle &rect) override;
+        void remove(const ItemHandle &item, const Rectangle &rect) override;
+        // Only touches the cells the item leaves or enters, none for moves within its cells
+        void update(const ItemHandle &item, const Rectangle &from, const Rectangle &to) override;
+        // Sorts every (cell, item) pair by cell, then fills each cell with its whole run
+        void addMany(
+            const std::vector<ItemHandle> &items,
+            const std::vector<Rectangle> &rects,
+            const std::size_t &threads
+        ) override;
+        // Same bucketing, then each cell drops its whole run in one pass
+        void removeMany(const std::vector<ItemHandle> &items, const std::vector<Rectangle> &rects) override;
+        // Same cells as update. With threads > 1, large batches bucket them so that each
+        // is looked up once per batch.
+        void updateMany(
+            const std::vector<ItemHandle> &items,
+            const std::vector<Rectangle> &froms,
+            const std::vector<Rectangle> &tos,
+            const std::size_t &threads
+        ) override;
+        void clear() override;
+
+        void queryRect(const Rectangle &rect, std::vector<ItemHandle> &items) const override;
+        void queryPoint(const Number &x, const Number &y, std::vector<ItemHandle> &items) const override;
+        void querySegment(
+            const Number &x1, const Number &y1,
+            const Number &x2, const Number &y2,
+            std::vector<ItemHandle> &items
+        ) const override;
+
+        std::size_t countCells() const override;
+
+        void save(std::vector<std::uint8_t> &blob) const override;
+        void load(Blob::Reader &reader, const std::vector<std::uint8_t> *generations) override;
+
+    private:
+        static constexpr std::uint32_t kind = 1;
+
+        // Below this many items, updating them one by one beats bucketing their cells anyway
+        static constexpr std::size_t minBucketedUpdates = 256;
+
+        // Cells hold up to inlineItems handles themselves. Past that they move to a pool
+        // block of minBlock * 2^k items, freed blocks are recycled per size class.
+        static constexpr std::uint32_t inlineItems = 4;
+        static constexpr std::uint32_t minBlock = 2 * inlineItems;
+        static constexpr std::size_t blockClasses = 32;
+
+        static constexpr Index tileBits = 3;
+        static constexpr std::uint32_t tileCells = 1u << (2 * tileBits);
+
+        // Most cells hold a few items, which then sit next to the count in the cell table
+        // instead of one more pointer chase away. Once the items are in a pool block, its
+        // offset and capacity take the place of the first two inline handles.
+        struct Cell
+        {
+            std::uint32_t itemCount = 0;
+            ItemHandle items[inlineItems];
+
+            bool isSpilled() const
+            {
+                return itemCount > inlineItems;
+            }
+
+            std::uint32_t &blockOffset()
+            {
+                return items[0].value;
+            }
+
+            std::uint32_t &blockCapacity()
+            {
+                return items[1].value;
+            }
+
+            const std::uint32_t &blockOffset() const
+            {
+                return items[0].value;
+            }
+
+            const std::uint32_t &blockCapacity() const
+            {
+                return items[1].value;
+            }
+        };
+
+        struct Tile
+        {
+            std::uint64_t createdCells = 0; // Bit i is set once cells[i] was created
+            Cell cells[tileCells];
+        };
+
+        struct Level
+        {
+            Number cellSize = 0;
+            FlatMap<std::uint64_t, Cell> cells;                 // Hashed layout
+            FlatMap<std::uint64_t, std::uint32_t> tileIndices;  // Tiled layout, into tiles
+            std::vector<Tile> tiles;
+            std::vector<ItemHandle> pool;
+            std::vector<std::uint32_t> freeBlocks[blockClasses];
+        };
+
+        Index getLevelIndex(const Number &w, const Number &h) const;
+        // Cell (cx, cy) of level, nullptr if it was never created
+        const Cell *getCell(const Level &level, const Number &cx, const Number &cy) const;
+        Cell *getCell(Level &level, const Number &cx, const Number &cy);
+        // Cell (cx, cy) of level, created empty if needed, and whether it was
+        std::pair<Cell*, bool> insertCell(Level &level, const Number &cx, const Number &cy);
+        // Calls function with every created cell of level in [left, right) x [top, bottom),
+        // tile by tile with the tiled layout
+        template<typename Function>
+        void forEachCell(
+            const Level &level,
+            const Index &left, const Index &top,
+            const Index &right, const Index &bottom,
+            const Function &function
+        ) const;
+
+        void addItemToCell(Level &level, const ItemHandle &item, const Number &cx, const Number &cy);
+        bool removeItemFromCell(Level &level, const ItemHandle &item, const Number &cx, const Number &cy);
+        // Appends the items of a run of pairs sharing key to its cell, which is created if needed
+        template<typename Pair>
+        void appendRun(Level &level, const std::uint64_t &key, const Pair *first, const Pair *last);
+        // Drops the items of a run of pairs sharing key from its cell, keeping the others in order
+        template<typename Pair>
+        void removeRun(Level &level, const std::uint64_t &key, Pair *first, Pair *last);
+        // Handles of cell, inline or in its pool block
+        static ItemHandle *getItems(Level &level, Cell &cell);
+        static const ItemHandle *getItems(const Level &level, const Cell &cell);
+        // Sets the item count of cell to a larger itemCount, moving its handles to a pool
+        // block or a larger one when they no longer fit. Returns them, the new ones unset.
+        ItemHandle *growCell(Level &level, Cell &cell, const std::uint32_t &itemCount);
+        // Sets the item count of cell to a smaller itemCount once the handles to keep are
+        // at the front, moving them back inline when they fit again
+        static void shrinkCell(Level &level, Cell &cell, const std::uint32_t &itemCount);
+
+        // Whether every cell and free block of a loaded level lies within its pool,
+        // and every handle in it is live
+        static bool isValid(const Level &level, const std::vector<std::uint8_t> &generations);
+
+        std::uint32_t allocateBlock(Level &level, const std::uint32_t &capacity);
+        static void freeBlock(Level &level, const std::uint32_t &offset, const std::uint32_t &capacity);
+        static std::size_t getBlockClass(const std::uint32_t &capacity);
+
+        // Starts a query that returns every item once
+        void beginQuery() const;
+        // Appends the items of cell the current query has not returned yet
+        void appendUnvisited(const Level &level, const Cell &cell, std::vector<ItemHandle> &items) const;
+
+    private:
+        Layout layout;
+        std::vector<Level> levels;
+
+        // Query that last returned each slot index, which dedupes items with an array
+        // store instead of a hash set per query. Every query writes it, which is why const
+        // World queries are not thread-safe.
+        mutable std::vector<std::uint32_t> visitStamps;
+        mutable std::uint32_t visitEpoch = 0;
+    };
+
+    // Incrementally balanced dynamic AABB tree. Leaves are fattened by margin
+    // so that small moves do not touch the tree at all.
+    class AabbTreeBroadPhase : public BroadPhase
+    {
+    public:
+        AabbTreeBroadPhase(const Number &margin = 0);
+
+        void add(const ItemHandle &item, const Rectangle &rect) override;
+        void remove(const ItemHandle &item, const Rectangle &rect) override;
+        void update(const ItemHandle &item, const Rectangle &from, const Rectangle &to) override;
+        void clear() override;
+
+        void queryRect(const Rectangle &rect, std::vector<ItemHandle> &items) const override;
+        void queryPoint(const Number &x, const Number &y, std::vector<ItemHandle> &items) const override;
+        void querySegment(
+            const Number &x1, const Number &y1,
+            const Number &x2, const Number &y2,
+            std::vector<ItemHandle> &items
+        ) const override;
+
+        std::size_t countCells() const override;
+
+        void save(std::vector<std::uint8_t> &blob) const override;
+        void load(Blob::Reader &reader, const std::vector<std::uint8_t> *generations) override;
+
+    private:
+        static constexpr std::uint32_t kind = 2;
+
+        struct Bounds
+        {
+            Number minX = 0;
+            Number minY = 0;
+            Number maxX = 0;
+            Number maxY = 0;
+        };
+
+        struct Node
+        {
+            Bounds bounds;
+            Index parent = -1; // Next free node while in the free list
+            Index left = -1;
+            Index right = -1;
+            Index height = -1; // 0 for leaves, -1 for free nodes
+            ItemHandle item;
+        };
+
+        static Bounds merge(const Bounds &a, const Bounds &b);
+        static Number perimeter(const Bounds &bounds);
+        static bool contains(const Bounds &outer, const Bounds &inner);
+        static bool overlaps(const Bounds &a, const Bounds &b);
+
+        Bounds fatten(const Rectangle &rect) const;
+
+        // Whether a loaded tree is one whole tree over the live items of generations, with
+        // a free list of free nodes only
+        static bool isValid(
+            const Index &root,
+            const Index &freeList,
+            const std::uint64_t &nodeCount,
+            const std::vector<Node> &nodes,
+            const FlatMap<ItemHandle, Index> &leaves,
+            const std::vector<std::uint8_t> &generations
+        );
+
+        Index allocateNode();
+        void freeNode(const Index &node);
+
+        void insertLeaf(const Index &leaf);
+        void removeLeaf(const Index &leaf);
+        Index balance(const Index &node);
+        void refit(Index node);
+
+        template<typename Predicate>
+        void collect(const Predicate &predicate, std::vector<ItemHandle> &items) const;
+
+    private:
+        Number margin;
+        std::vector<Node> nodes;
+        Index root = -1;
+        Index freeList = -1;
+        std::size_t nodeCount = 0;
+        FlatMap<ItemHandle, Index> leaves;
+
+        // Nodes left to visit by collect, kept so that queries stop allocating once it has grown
+        mutable std::vector<Index> stack;
+    };
+
+    // Incremental sort-and-sweep on x. Entries stay sorted by their left edge:
+    // moves are fixed up by insertion sort, additions and removals are batched
+    // and merged before the next query.
+    class SweepAndPruneBroadPhase : public BroadPhase
+    {
+    public:
+        SweepAndPruneBroadPhase() = default;
+
+        void add(const ItemHandle &item, const Rectangle &rect) override;
+        void remove(const ItemHandle &item, const Rectangle &rect) override;
+        void update(const ItemHandle &item, const Rectangle &from, const Rectangle &to) override;
+        void clear() override;
+
+        void queryRect(const Rectangle &rect, std::vector<ItemHandle> &items) const override;
+        void queryPoint(const Number &x, const Number &y, std::vector<ItemHandle> &items) const override;
+        void querySegment(
+            const Number &x1, const Number &y1,
+            const Number &x2, const Number &y2,
+            std::vector<ItemHandle> &items
+        ) const override;
+
+        std::size_t countCells() const override;
+
+        void save(std::vector<std::uint8_t> &blob) const override;
+        void load(Blob::Reader &reader, const std::vector<std::uint8_t> *generations) override;
+
+    private:
+        static constexpr std::uint32_t kind = 3;
+
+        struct Entry
+        {
+            Number minX = 0;
+            Number maxX = 0;
+            Number minY = 0;
+            Number maxY = 0;
+            ItemHandle item;    // The zero handle marks a removed entry
+        };
+
+        void flush() const;
+        void sweep(
+            const Number &minX, const Number &minY,
+            const Number &maxX, const Number &maxY,
+            std::vector<ItemHandle> &items
+        ) const;
+
+    private:
+        // Sorting is deferred to the next query, hence mutable
+        mutable std::vector<Entry> entries;
+        mutable FlatMap<ItemHandle, std::size_t> positions;
+        mutable std::size_t sortedCount = 0;
+        mutable std::size_t removedCount = 0;
+        mutable Number maxWidth = 0;
+    };
+}
+
+#endif
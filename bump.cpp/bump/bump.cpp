@@ -1,9 +1,23 @@
 #include "bump.h"
+#include "broadphase.h"
+#include "geometry.h"
+#include "snapshot.h"
+#include "trace.h"
 
 #include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <deque>
 #include <limits>
+#include <mutex>
+#include <unordered_map>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
 
 namespace Bump
 {
@@ -33,6 +47,308 @@ namespace Bump
         {
             return std::abs(first - value) < std::abs(second - value) ? first : second;
         }
+
+        // Min-heap with Arity children per node: shallower than a binary heap, and the
+        // children of a node share a cache line when values are small
+        template<typename T, typename Less, std::size_t Arity = 4>
+        class DaryHeap
+        {
+        public:
+            bool empty() const
+            {
+                return values.empty();
+            }
+
+            const T &top() const
+            {
+                return values.front();
+            }
+
+            void push(const T &value)
+            {
+                values.push_back(value);
+
+                std::size_t index = values.size() - 1;
+                while (index > 0)
+                {
+                    const std::size_t parent = (index - 1) / Arity;
+                    if (!less(values[index], values[parent]))
+                    {
+                        break;
+                    }
+                    std::swap(values[index], values[parent]);
+                    index = parent;
+                }
+            }
+
+            void pop()
+            {
+                values.front() = values.back();
+                values.pop_back();
+
+                std::size_t index = 0;
+                while (true)
+                {
+                    const std::size_t first = index * Arity + 1;
+                    const std::size_t last = std::min(first + Arity, values.size());
+                    std::size_t smallest = index;
+                    for (std::size_t child = first; child < last; child++)
+                    {
+                        if (less(values[child], values[smallest]))
+                        {
+                            smallest = child;
+                        }
+                    }
+                    if (smallest == index)
+                    {
+                        break;
+                    }
+                    std::swap(values[index], values[smallest]);
+                    index = smallest;
+                }
+            }
+
+        private:
+            std::vector<T> values;
+            Less less;
+        };
+
+        // Maps a number onto an integer with the same order: positives get their sign
+        // bit set and negatives get every bit flipped. -0 is folded into 0 first
+        inline std::uint64_t toRadixKey(Number value)
+        {
+            value += 0;
+            std::uint64_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            const std::uint64_t signBit = std::uint64_t(1) << 63;
+            return (bits & signBit) != 0 ? ~bits : bits | signBit;
+        }
+
+        struct SortKey
+        {
+            std::uint64_t major = 0;
+            std::uint64_t minor = 0;
+            std::uint32_t index = 0;
+        };
+
+        // Index last, so that the order is total and every sort below is stable
+        struct KeyLess
+        {
+            bool operator()(const SortKey &a, const SortKey &b) const
+            {
+                if (a.major != b.major)
+                {
+                    return a.major < b.major;
+                }
+                if (a.minor != b.minor)
+                {
+                    return a.minor < b.minor;
+                }
+                return a.index < b.index;
+            }
+        };
+
+        inline void insertionSort(SortKey *first, SortKey *last)
+        {
+            for (SortKey *i = first + 1; i < last; i++)
+            {
+                const SortKey key = *i;
+                SortKey *j = i;
+                for (; j > first && KeyLess()(key, *(j - 1)); j--)
+                {
+                    *j = *(j - 1);
+                }
+                *j = key;
+            }
+        }
+
+        inline void sortRun(SortKey *first, SortKey *last)
+        {
+            if (last - first <= 16)
+            {
+                insertionSort(first, last);
+            }
+            else
+            {
+                std::sort(first, last, KeyLess());
+            }
+        }
+
+        // Sorts by (major, minor, index). Few keys are insertion sorted. Past radixSortMin
+        // an 8 bit LSD radix sort orders them by major, with every histogram counted in
+        // one pass and the passes whose digit is the same in every key skipped, and the
+        // runs of equal major left behind are then sorted by minor
+        const std::size_t radixSortMin = 1024;
+
+        inline void sortKeys(std::vector<SortKey> &keys, std::vector<SortKey> &scratch)
+        {
+            const std::size_t count = keys.size();
+            if (count < radixSortMin)
+            {
+                sortRun(keys.data(), keys.data() + count);
+                return;
+            }
+
+            const std::size_t passes = sizeof(std::uint64_t);
+            std::uint32_t counts[passes][256] = {};
+            for (const SortKey &key : keys)
+            {
+                for (std::size_t pass = 0; pass < passes; pass++)
+                {
+                    counts[pass][(key.major >> (pass * 8)) & 0xff]++;
+                }
+            }
+
+            scratch.resize(count);
+            for (std::size_t pass = 0; pass < passes; pass++)
+            {
+                std::uint32_t *offsets = counts[pass];
+                const std::size_t shift = pass * 8;
+                if (offsets[(keys.front().major >> shift) & 0xff] == count)
+                {
+                    continue;
+                }
+
+                std::uint32_t offset = 0;
+                for (std::size_t bucket = 0; bucket < 256; bucket++)
+                {
+                    const std::uint32_t size = offsets[bucket];
+                    offsets[bucket] = offset;
+                    offset += size;
+                }
+                for (const SortKey &key : keys)
+                {
+                    scratch[offsets[(key.major >> shift) & 0xff]++] = key;
+                }
+                keys.swap(scratch);
+            }
+
+            SortKey *run = keys.data();
+            SortKey *const end = keys.data() + count;
+            for (SortKey *i = run + 1; i <= end; i++)
+            {
+                if (i == end || i->major != run->major)
+                {
+                    if (i - run > 1)
+                    {
+                        sortRun(run, i);
+                    }
+                    run = i;
+                }
+            }
+        }
+
+        // Narrow phase of a projection over the others from first to last. Every other the
+        // layers let item meet, the filter gives a response for and item actually collides
+        // with adds a contact, indexed like the others, and its response to types.
+        // itemOf(i) and rectOf(i) describe other i, and collides(i) checks the layers.
+        template<typename ItemOf, typename RectOf, typename Collides>
+        void detectContacts(
+            const Item &item,
+            const Number &x, const Number &y,
+            const Number &w, const Number &h,
+            const Number &goalX, const Number &goalY,
+            const Filter &filter,
+            const std::size_t &first, const std::size_t &last,
+            const ItemOf &itemOf,
+            const RectOf &rectOf,
+            const Collides &collides,
+            Stats &stats,
+            std::vector<Contact> &contacts,
+            std::vector<ResponseId> &types
+        )
+        {
+            for (std::size_t i = first; i < last; i++)
+            {
+                const Item &other = itemOf(i);
+                if (other == item)
+                {
+                    BUMP_STAT(stats.dedupeRejects, 1);
+                    continue;
+                }
+
+                if (!collides(i))
+                {
+                    continue;
+                }
+
+                const ResponseId type = toResponseId(filter(item, other));
+                if (type == 0)
+                {
+                    continue;
+                }
+
+                const Rectangle &rect = rectOf(i);
+                BUMP_STAT(stats.candidatesTested, 1);
+
+                Contact contact;
+                if (Rect::detectContact(x, y, w, h, rect.x, rect.y, rect.w, rect.h, goalX, goalY, contact))
+                {
+                    contact.other = static_cast<std::uint32_t>(i);
+
+                    BUMP_STAT(stats.narrowPhaseHits, 1);
+                    BUMP_STAT(stats.allocations, contacts.size() == contacts.capacity());
+                    contacts.push_back(contact);
+                    types.push_back(type);
+                }
+            }
+        }
+
+        // Sorts contacts like World::sortByTiAndDistance, working out every key once, and
+        // only then expands them into collisions. Contact i was found against the item
+        // itemOf(contacts[i].other), whose rect is rectOf(contacts[i].other).
+        template<typename ItemOf, typename RectOf>
+        void toCollisions(
+            const Item &item,
+            const Number &x, const Number &y,
+            const Number &w, const Number &h,
+            const Number &goalX, const Number &goalY,
+            const std::vector<Contact> &contacts,
+            std::vector<ResponseId> &types,
+            const ItemOf &itemOf,
+            const RectOf &rectOf,
+            std::vector<Collision> &collisions
+        )
+        {
+            const std::size_t count = contacts.size();
+
+            // Kept per thread, so that moves do not allocate them over and over
+            thread_local std::vector<SortKey> keys, scratch;
+            keys.resize(count);
+            for (std::size_t i = 0; i < count; i++)
+            {
+                const Rectangle &rect = rectOf(contacts[i].other);
+                keys[i].major = toRadixKey(contacts[i].ti);
+                keys[i].minor = toRadixKey(Rect::getSquareDistance(
+                    x, y, w, h,
+                    rect.x, rect.y, rect.w, rect.h
+                ));
+                keys[i].index = static_cast<std::uint32_t>(i);
+            }
+
+            sortKeys(keys, scratch);
+
+            // Collisions left from a previous call are overwritten field by field
+            collisions.resize(count);
+            for (std::size_t i = 0; i < count; i++)
+            {
+                const Contact &contact = contacts[keys[i].index];
+
+                Collision &col = collisions[i];
+                col.move = { goalX - x, goalY - y };
+                col.normal = { Number(contact.nx), Number(contact.ny) };
+                col.touch = contact.touch;
+                col.itemRect = { x, y, w, h };
+                col.otherRect = rectOf(contact.other);
+                col.overlaps = contact.overlaps;
+                col.ti = contact.ti;
+                col.item = item;
+                col.other = itemOf(contact.other);
+                col.type = types[keys[i].index];
+                col.slide = Point();
+                col.bounce = Point();
+            }
+        }
     }
 
     /// ------------------------------------------
@@ -53,9 +369,9 @@ namespace Bump
 
         // This is a generalized implementation of the liang - barsky algorithm, which also returns
         // the normals of the sides where the segment intersects.
-        // Returns nil if the segment never touches the rect
+        // The first value is false if the segment never touches the rect
         // Notice that normals are only guaranteed to be accurate when initially ti1, ti2 == -math.huge, math.huge
-        std::tuple<Number, Number, Number, Number, Number, Number> 
+        std::tuple<bool, Number, Number, Number, Number, Number, Number> 
             getSegmentIntersectionIndices(
                 const Number &x, const Number &y, 
                 const Number &w, const Number &h,
@@ -108,7 +424,7 @@ namespace Bump
                 {
                     if (q <= 0)
                     {
-                        throw Exception::ComputationError();
+                        return std::make_tuple(false, ti1, ti2, nx1, ny1, nx2, ny2);
                     }
                 }
                 else
@@ -118,7 +434,7 @@ namespace Bump
                     {
                         if (r > ti2)
                         {
-                            throw Exception::ComputationError();
+                            return std::make_tuple(false, ti1, ti2, nx1, ny1, nx2, ny2);
                         }
                         if (r > ti1)
                         {
@@ -129,7 +445,7 @@ namespace Bump
                     {
                         if (r < ti1)
                         {
-                            throw Exception::ComputationError();
+                            return std::make_tuple(false, ti1, ti2, nx1, ny1, nx2, ny2);
                         }
                         if (r < ti2)
                         {
@@ -139,7 +455,7 @@ namespace Bump
                 }
             }
 
-            return std::make_tuple(ti1, ti2, nx1, ny1, nx2, ny2);
+            return std::make_tuple(true, ti1, ti2, nx1, ny1, nx2, ny2);
         }
 
         // Calculates the minkowsky difference between 2 rects, which is another rect
@@ -191,12 +507,13 @@ namespace Bump
             return dx * dx + dy * dy;
         }
 
-        Collision detectCollision(
-            const Number &x1, const Number &y1, 
+        bool detectContact(
+            const Number &x1, const Number &y1,
             const Number &w1, const Number &h1,
-            const Number &x2, const Number &y2, 
+            const Number &x2, const Number &y2,
             const Number &w2, const Number &h2,
-            const Number &goalX, const Number &goalY
+            const Number &goalX, const Number &goalY,
+            Contact &contact
         )
         {
             const Number dx = goalX - x1;
@@ -206,6 +523,7 @@ namespace Bump
             std::tie(x, y, w, h) = getDiff(x1, y1, w1, h1, x2, y2, w2, h2);
 
             bool overlaps = false;
+            bool found = false;
             Number ti = 0;
             Number nx = 0;
             Number ny = 0;
@@ -222,26 +540,35 @@ namespace Bump
                 // ti is the negative area of intersection
                 ti = -wi * hi;
                 overlaps = true;
+                found = true;
             }
             else
             {
+                bool intersects;
                 Number ti1, ti2, nx1, ny1, nx2, ny2;
-                std::tie(ti1, ti2, nx1, ny1, nx2, ny2) =
+                std::tie(intersects, ti1, ti2, nx1, ny1, nx2, ny2) =
                     getSegmentIntersectionIndices(
                         x, y, w, h, 0, 0, dx, dy,
                         -std::numeric_limits<Number>::max(),
                         std::numeric_limits<Number>::max()
                         );
 
-                if (ti < 1 &&
-                    (std::abs(ti1 - ti2) >= deltaError) &&
+                // Item tunnels into other
+                if (intersects && ti1 < 1 &&
+                    (std::abs(ti1 - ti2) >= deltaError) && // Special case for rect going through another rect's corner
                     (ti1 + deltaError > 0 || (ti1 == 0 && ti2 > 0)))
                 {
                     std::tie(ti, nx, ny) = std::make_tuple(ti1, nx1, ny1);
                     overlaps = false;
+                    found = true;
                 }
             }
 
+            if (!found)
+            {
+                return false;
+            }
+
             Number tx = 0;
             Number ty = 0;
 
@@ -249,6 +576,7 @@ namespace Bump
             {
                 if (dx == 0 && dy == 0)
                 {
+                    // Intersecting and not moving - use minimum displacement vector
                     Number px = 0;
                     Number py = 0;
                     std::tie(px, py) = getNearestCorner(x, y, w, h, 0, 0);
@@ -265,12 +593,18 @@ namespace Bump
                 }
                 else
                 {
+                    // Intersecting and moving - move in the opposite direction
+                    bool intersects;
                     Number ti1, _1, _2, _3;
-                    std::tie(ti1, _1, nx, ny, _2, _3) =
+                    std::tie(intersects, ti1, _1, nx, ny, _2, _3) =
                         getSegmentIntersectionIndices(
                             x, y, w, h, 0, 0, dx, dy,
                             -std::numeric_limits<Number>::max(), 1
                             );
+                    if (!intersects)
+                    {
+                        return false;
+                    }
                     std::tie(tx, ty) = std::make_tuple(x1 + dx * ti1, y1 + dy * ti1);
                 }
             }
@@ -279,18 +613,40 @@ namespace Bump
                 std::tie(tx, ty) = std::make_tuple(x1 + dx * ti, y1 + dy * ti);
             }
 
-            return Collision
+            contact.ti = ti;
+            contact.touch = { tx, ty };
+            contact.nx = static_cast<std::int8_t>(nx);
+            contact.ny = static_cast<std::int8_t>(ny);
+            contact.overlaps = overlaps;
+            return true;
+        }
+
+        std::tuple<bool, Collision> detectCollision(
+            const Number &x1, const Number &y1, 
+            const Number &w1, const Number &h1,
+            const Number &x2, const Number &y2, 
+            const Number &w2, const Number &h2,
+            const Number &goalX, const Number &goalY
+        )
+        {
+            Contact contact;
+            if (!detectContact(x1, y1, w1, h1, x2, y2, w2, h2, goalX, goalY, contact))
+            {
+                return std::make_tuple(false, Collision());
+            }
+
+            return std::make_tuple(true, Collision
             {
-                { dx, dy }, { nx, ny }, { tx, ty },
+                { goalX - x1, goalY - y1 }, { Number(contact.nx), Number(contact.ny) }, contact.touch,
                 { x1, y1, w1, h1 },
                 { x2, y2, w2, h2 },
-                overlaps, ti,
-                nullptr, nullptr,
+                contact.overlaps, contact.ti,
+                nullptr, nullptr, 0,
                 { 0, 0 }, { 0, 0 }
-            };
+            });
         }
 
-        Collision detectCollision(
+        std::tuple<bool, Collision> detectCollision(
             const Number &x1, const Number &y1, 
             const Number &w1, const Number &h1,
             const Number &x2, const Number &y2, 
@@ -299,6 +655,67 @@ namespace Bump
         {
             return detectCollision(x1, y1, w1, h1, x2, y2, w2, h2, x1, y1);
         }
+
+        std::tuple<bool, Collision> detectCollision(
+            const Number &x1, const Number &y1,
+            const Number &w1, const Number &h1,
+            const Number &goalX1, const Number &goalY1,
+            const Number &x2, const Number &y2,
+            const Number &w2, const Number &h2,
+            const Number &goalX2, const Number &goalY2
+        )
+        {
+            const Number dx1 = goalX1 - x1;
+            const Number dy1 = goalY1 - y1;
+            const Number dx2 = goalX2 - x2;
+            const Number dy2 = goalY2 - y2;
+
+            bool found;
+            Collision col;
+            std::tie(found, col) = detectCollision(
+                x1, y1, w1, h1, x2, y2, w2, h2, goalX1 - dx2, goalY1 - dy2
+            );
+            if (!found)
+            {
+                return std::make_tuple(false, Collision());
+            }
+
+            // Back from the frame of other, where it stays at its start
+            const Number t = col.overlaps ? 0 : col.ti;
+            col.move = { dx1, dy1 };
+            col.touch = { col.touch.x + dx2 * t, col.touch.y + dy2 * t };
+            col.otherRect = { x2 + dx2 * t, y2 + dy2 * t, w2, h2 };
+            return std::make_tuple(true, col);
+        }
+
+        std::tuple<bool, Number, Number, Number> getSegmentTouch(
+            const Number &x, const Number &y,
+            const Number &w, const Number &h,
+            const Number &x1, const Number &y1,
+            const Number &x2, const Number &y2
+        )
+        {
+            bool intersects;
+            Number ti1, ti2, _1, _2, _3, _4;
+            std::tie(intersects, ti1, ti2, _1, _2, _3, _4) =
+                getSegmentIntersectionIndices(x, y, w, h, x1, y1, x2, y2, 0, 1);
+
+            if (!intersects || !((0 < ti1 && ti1 < 1) || (0 < ti2 && ti2 < 1)))
+            {
+                return std::make_tuple(false, 0.0, 0.0, 0.0);
+            }
+
+            // The sorting is according to the t of an infinite line, not the segment
+            Number tii0, tii1;
+            std::tie(intersects, tii0, tii1, _1, _2, _3, _4) =
+                getSegmentIntersectionIndices(
+                    x, y, w, h, x1, y1, x2, y2,
+                    -std::numeric_limits<Number>::max(),
+                    std::numeric_limits<Number>::max()
+                );
+
+            return std::make_tuple(true, ti1, ti2, std::min(tii0, tii1));
+        }
     }
 
     /// ------------------------------------------
@@ -320,8 +737,8 @@ namespace Bump
         )
         {
             return std::make_tuple(
-                static_cast<Number>(x / cellSize) + 1,
-                static_cast<Number>(y / cellSize) + 1
+                std::floor(x / cellSize) + 1,
+                std::floor(y / cellSize) + 1
             );
         }
 
@@ -412,186 +829,2047 @@ namespace Bump
             std::tie(cx, cy) = toCell(cellSize, x, y);
             Number cr, cb;
             std::tie(cr, cb) = std::make_tuple(
-                std::ceil(x + w) / cellSize,
-                std::ceil(y + h) / cellSize
+                std::ceil((x + w) / cellSize),
+                std::ceil((y + h) / cellSize)
             );
 
             return std::make_tuple(cx, cy, cr - cx + 1, cb - cy + 1);
         }
-    }
 
-    /// ------------------------------------------
-    /// -- Responses functions
-    /// ------------------------------------------
-    namespace Responses
-    {
-        Response touch(
-            World &world, Collision &col,
-            const Number &x, const Number &y,
-            const Number &w, const Number &h,
-            const Number &goalX, const Number &goalY,
-            const Filter &filter
+        void toCellRects(
+            const Number &cellSize,
+            const Rectangle *rects, const std::size_t &count,
+            Index *left, Index *top, Index *right, Index *bottom
         )
         {
-            return Response{ col.touch.x, col.touch.y, {}, 0 };
+            std::size_t i = 0;
+#if defined(__AVX__)
+            // Same operations as toCellRect, so the cells match it exactly
+            const __m256d size = _mm256_set1_pd(cellSize);
+            const __m256d one = _mm256_set1_pd(1);
+            for (; i + 4 <= count; i += 4)
+            {
+                // Four (x, y, w, h) rows into x, y, w and h columns
+                const __m256d r0 = _mm256_loadu_pd(&rects[i].x);
+                const __m256d r1 = _mm256_loadu_pd(&rects[i + 1].x);
+                const __m256d r2 = _mm256_loadu_pd(&rects[i + 2].x);
+                const __m256d r3 = _mm256_loadu_pd(&rects[i + 3].x);
+                const __m256d xw01 = _mm256_unpacklo_pd(r0, r1);
+                const __m256d yh01 = _mm256_unpackhi_pd(r0, r1);
+                const __m256d xw23 = _mm256_unpacklo_pd(r2, r3);
+                const __m256d yh23 = _mm256_unpackhi_pd(r2, r3);
+                const __m256d x = _mm256_permute2f128_pd(xw01, xw23, 0x20);
+                const __m256d y = _mm256_permute2f128_pd(yh01, yh23, 0x20);
+                const __m256d w = _mm256_permute2f128_pd(xw01, xw23, 0x31);
+                const __m256d h = _mm256_permute2f128_pd(yh01, yh23, 0x31);
+
+                const __m256d l = _mm256_add_pd(_mm256_floor_pd(_mm256_div_pd(x, size)), one);
+                const __m256d t = _mm256_add_pd(_mm256_floor_pd(_mm256_div_pd(y, size)), one);
+                const __m256d r = _mm256_add_pd(_mm256_ceil_pd(_mm256_div_pd(_mm256_add_pd(x, w), size)), one);
+                const __m256d b = _mm256_add_pd(_mm256_ceil_pd(_mm256_div_pd(_mm256_add_pd(y, h), size)), one);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(left + i), _mm256_cvtpd_epi32(l));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(top + i), _mm256_cvtpd_epi32(t));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(right + i), _mm256_cvtpd_epi32(r));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(bottom + i), _mm256_cvtpd_epi32(b));
+            }
+#endif
+            for (; i < count; i++)
+            {
+                const Rectangle &rect = rects[i];
+                left[i] = static_cast<Index>(std::floor(rect.x / cellSize) + 1);
+                top[i] = static_cast<Index>(std::floor(rect.y / cellSize) + 1);
+                right[i] = static_cast<Index>(std::ceil((rect.x + rect.w) / cellSize) + 1);
+                bottom[i] = static_cast<Index>(std::ceil((rect.y + rect.h) / cellSize) + 1);
+            }
         }
 
-        Response cross(
-            World &world, Collision &col,
-            const Number &x, const Number &y,
-            const Number &w, const Number &h,
-            const Number &goalX, const Number &goalY,
-            const Filter &filter
-        )
+        std::uint64_t toCellKey(const Number &cx, const Number &cy)
         {
-            std::vector<Collision> cols;
-            std::uint32_t len;
-            std::tie(cols, len) = world.project(
-                col.item, x, y, w, h, goalX, goalY, filter
-            );
-
-            return Response{ goalX, goalY, cols, len };
+            // Flipping the sign bits keeps cell (0, 0) away from the empty key
+            const std::uint64_t x = static_cast<std::uint32_t>(static_cast<Index>(cx));
+            const std::uint64_t y = static_cast<std::uint32_t>(static_cast<Index>(cy));
+            return ((y << 32) | x) ^ 0x8000000080000000ull;
         }
+    }
 
-        Response slide(
-            World &world, Collision &col,
-            const Number &x, const Number &y,
-            const Number &w, const Number &h,
-            const Number &goalX, const Number &goalY,
-            const Filter &filter
-        )
+    /// ------------------------------------------
+    /// -- Blobs
+    /// ------------------------------------------
+    namespace Blob
+    {
+        std::uint64_t checksum(const std::uint8_t *data, const std::size_t &size)
         {
-            Point touch = col.touch;
-            Point move = col.move;
+            constexpr std::uint64_t prime1 = 0x9e3779b185ebca87ull;
+            constexpr std::uint64_t prime2 = 0xc2b2ae3d27d4eb4full;
+            alignas(16) constexpr std::uint64_t keys[8] = {
+                0xbe4ba423396cfeb8ull, 0x1cad21f72c81017cull, 0xdb979083e96dd4deull, 0x1f67b3b7a4a44072ull,
+                0x78e5c0cc4ee679cbull, 0x2172ffcc7dd05a82ull, 0x8e2443f7744608b8ull, 0x4c263a81e69035e0ull,
+            };
 
-            Number sx = touch.x;
-            Number sy = touch.y;
+            // Eight lanes, each adding its neighbour word and the product of the halves of its
+            // keyed word, in the spirit of XXH3, so that hashing keeps up with reading the blob
+            alignas(16) std::uint64_t lanes[8] = { prime1, prime2, keys[2], keys[3], keys[4], keys[5], keys[6], keys[7] };
+            constexpr std::size_t stripe = sizeof(lanes);
+            constexpr std::size_t block = 16 * stripe;
+            const auto accumulate = [&lanes, &keys](const std::uint8_t *words_)
+            {
+                std::uint64_t words[8];
+                std::memcpy(words, words_, sizeof(words));
+                for (int lane = 0; lane < 8; lane++)
+                {
+                    const std::uint64_t keyed = words[lane] ^ keys[lane];
+                    lanes[lane] += words[lane ^ 1] + (keyed & 0xffffffffull) * (keyed >> 32);
+                }
+            };
 
-            if (move.x != 0 || move.y != 0)
+            std::size_t offset = 0;
+            for (; offset + block <= size; offset += block)
             {
-                if (col.normal.x == 0)
+#if defined(__SSE2__) || defined(_M_X64)
+                // The same sums two lanes at a time, compilers do not find the 32-bit multiplies
+                __m128i sums[4];
+                for (int i = 0; i < 4; i++)
                 {
-                    sx = goalX;
+                    sums[i] = _mm_load_si128(reinterpret_cast<const __m128i *>(lanes) + i);
                 }
-                else
+                for (std::size_t at = offset; at < offset + block; at += stripe)
+                {
+                    for (int i = 0; i < 4; i++)
+                    {
+                        const __m128i words = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + at) + i);
+                        const __m128i keyed = _mm_xor_si128(words, _mm_load_si128(reinterpret_cast<const __m128i *>(keys) + i));
+                        const __m128i product = _mm_mul_epu32(keyed, _mm_shuffle_epi32(keyed, _MM_SHUFFLE(0, 3, 0, 1)));
+                        const __m128i swapped = _mm_shuffle_epi32(words, _MM_SHUFFLE(1, 0, 3, 2));
+                        sums[i] = _mm_add_epi64(sums[i], _mm_add_epi64(product, swapped));
+                    }
+                }
+                for (int i = 0; i < 4; i++)
                 {
-                    sy = goalY;
+                    _mm_store_si128(reinterpret_cast<__m128i *>(lanes) + i, sums[i]);
                 }
-            }
+#else
+                for (std::size_t at = offset; at < offset + block; at += stripe)
+                {
+                    accumulate(data + at);
+                }
+#endif
 
-            col.slide = { sx, sy };
+                // Scrambled every block, so that bytes far apart cannot cancel out
+                for (int lane = 0; lane < 8; lane++)
+                {
+                    lanes[lane] = (lanes[lane] ^ (lanes[lane] >> 47) ^ keys[lane]) * prime1;
+                }
+            }
+            for (; offset + stripe <= size; offset += stripe)
+            {
+                accumulate(data + offset);
+            }
 
-            Number newX = touch.x;
-            Number newY = touch.y;
+            std::uint64_t hash = static_cast<std::uint64_t>(size) * prime1;
+            for (const std::uint64_t &lane : lanes)
+            {
+                hash = (hash ^ lane) * prime2;
+                hash ^= hash >> 29;
+            }
+            for (; offset < size; offset++)
+            {
+                hash = (hash ^ data[offset]) * prime1;
+                hash ^= hash >> 31;
+            }
 
-            Number newGoalX = sx;
-            Number newGoalY = sy;
+            hash ^= hash >> 33;
+            hash *= prime2;
+            hash ^= hash >> 29;
+            hash *= prime1;
+            hash ^= hash >> 32;
+            return hash;
+        }
+    }
 
-            std::vector<Collision> cols;
-            std::uint32_t len;
-            std::tie(cols, len) = world.project(
-                col.item, newX, newY, w, h, newGoalX, newGoalY, filter
-            );
+    /// ------------------------------------------
+    /// -- Response names
+    /// ------------------------------------------
+    namespace
+    {
+        // Every name ever interned. A deque, so that names stay put as it grows.
+        struct ResponseNames
+        {
+            std::mutex mutex;
+            std::deque<std::string> names{ std::string() };
+            std::unordered_map<std::string, ResponseId> ids{ { std::string(), 0 } };
+        };
 
-            return Response{ newGoalX, newGoalY, cols, len };
+        ResponseNames &getResponseNames()
+        {
+            static ResponseNames responseNames;
+            return responseNames;
         }
+    }
 
-        Response bounce(
-            World &world, Collision &col,
-            const Number &x, const Number &y,
-            const Number &w, const Number &h,
-            const Number &goalX, const Number &goalY,
-            const Filter &filter
-        )
+    ResponseId toResponseId(const std::string &name)
+    {
+        if (name.empty())
         {
-            Point touch = col.touch;
-            Point move = col.move;
+            return 0;
+        }
+
+        // Filters mostly give the same name over and over, which then skips the lock
+        thread_local std::string lastName;
+        thread_local ResponseId lastId = 0;
+        if (lastId != 0 && name == lastName)
+        {
+            return lastId;
+        }
+
+        ResponseNames &responseNames = getResponseNames();
+        std::lock_guard<std::mutex> lock(responseNames.mutex);
+        auto inserted = responseNames.ids.insert(std::make_pair(name, static_cast<ResponseId>(responseNames.names.size())));
+        if (inserted.second)
+        {
+            responseNames.names.push_back(name);
+        }
+
+        lastName = name;
+        lastId = inserted.first->second;
+        return lastId;
+    }
+
+    const std::string &toResponseName(const ResponseId &id)
+    {
+        ResponseNames &responseNames = getResponseNames();
+        std::lock_guard<std::mutex> lock(responseNames.mutex);
+        if (id >= responseNames.names.size())
+        {
+            throw Exception::NotFoundError();
+        }
+        return responseNames.names[id];
+    }
+
+    /// ------------------------------------------
+    /// -- Responses functions
+    /// ------------------------------------------
+    namespace Responses
+    {
+        namespace
+        {
+            // Runs handler the way the ResponseFunction signature expects
+            template<typename Handler>
+            Response toResponse(
+                const Handler &handler,
+                World &world, Collision &col,
+                const Number &x, const Number &y,
+                const Number &w, const Number &h,
+                const Number &goalX, const Number &goalY,
+                const Filter &filter
+            )
+            {
+                std::vector<Collision> cols;
+                ResponseContext ctx{ world, x, y, w, h, goalX, goalY, filter, cols };
+                const Point goal = handler.resolve(ctx, col);
+
+                const std::uint32_t len = static_cast<std::uint32_t>(cols.size());
+                return Response{ goal.x, goal.y, std::move(cols), len };
+            }
+        }
+
+        Point Touch::resolve(ResponseContext &ctx, Collision &col) const
+        {
+            ctx.collisions.clear();
+            return col.touch;
+        }
+
+        Point Cross::resolve(ResponseContext &ctx, Collision &col) const
+        {
+            ctx.project(col.item, ctx.x, ctx.y, ctx.goalX, ctx.goalY);
+            return Point{ ctx.goalX, ctx.goalY };
+        }
+
+        Point Slide::resolve(ResponseContext &ctx, Collision &col) const
+        {
+            BUMP_TRACE_SPAN("Responses::slide", col.item);
+
+            Point touch = col.touch;
+            Point move = col.move;
+
+            Number sx = touch.x;
+            Number sy = touch.y;
+
+            if (move.x != 0 || move.y != 0)
+            {
+                if (col.normal.x == 0)
+                {
+                    sx = ctx.goalX;
+                }
+                else
+                {
+                    sy = ctx.goalY;
+                }
+            }
+
+            col.slide = { sx, sy };
+
+            ctx.project(col.item, touch.x, touch.y, sx, sy);
+            return Point{ sx, sy };
+        }
+
+        Point Bounce::resolve(ResponseContext &ctx, Collision &col) const
+        {
+            BUMP_TRACE_SPAN("Responses::bounce", col.item);
+
+            Point touch = col.touch;
+            Point move = col.move;
 
             Number tx = touch.x;
             Number ty = touch.y;
 
-            Number bx = tx;
-            Number by = ty;
+            Number bx = tx;
+            Number by = ty;
+
+            if (move.x != 0 || move.y != 0)
+            {
+                Number bnx, bny;
+                std::tie(bnx, bny) = std::make_tuple(ctx.goalX - tx, ctx.goalY - ty);
+                if (col.normal.x == 0)
+                {
+                    bny = -bny;
+                }
+                else
+                {
+                    bnx = -bnx;
+                }
+
+                std::tie(bx, by) = std::make_tuple(tx + bnx, ty + bny);
+            }
+
+            col.bounce = { bx, by };
+
+            ctx.project(col.item, touch.x, touch.y, bx, by);
+            return Point{ bx, by };
+        }
+
+        Point OneWay::resolve(ResponseContext &ctx, Collision &col) const
+        {
+            // Items already inside the platform keep going until they are out of it
+            if (col.normal.y < 0 && !col.overlaps)
+            {
+                return Slide().resolve(ctx, col);
+            }
+
+            // Unlike Cross, goes on from where the item met the platform rather than from
+            // where the move started, which a slide before may have left. moveMany carries
+            // on from the impact too, so both pass through along the same line.
+            const Point from = col.overlaps ? Point{ col.itemRect.x, col.itemRect.y } : col.touch;
+            ctx.project(col.item, from.x, from.y, ctx.goalX, ctx.goalY);
+            return Point{ ctx.goalX, ctx.goalY };
+        }
+
+        Response touch(
+            World &world, Collision &col,
+            const Number &x, const Number &y,
+            const Number &w, const Number &h,
+            const Number &goalX, const Number &goalY,
+            const Filter &filter
+        )
+        {
+            return toResponse(Touch(), world, col, x, y, w, h, goalX, goalY, filter);
+        }
+
+        Response cross(
+            World &world, Collision &col,
+            const Number &x, const Number &y,
+            const Number &w, const Number &h,
+            const Number &goalX, const Number &goalY,
+            const Filter &filter
+        )
+        {
+            return toResponse(Cross(), world, col, x, y, w, h, goalX, goalY, filter);
+        }
+
+        Response slide(
+            World &world, Collision &col,
+            const Number &x, const Number &y,
+            const Number &w, const Number &h,
+            const Number &goalX, const Number &goalY,
+            const Filter &filter
+        )
+        {
+            return toResponse(Slide(), world, col, x, y, w, h, goalX, goalY, filter);
+        }
+
+        Response bounce(
+            World &world, Collision &col,
+            const Number &x, const Number &y,
+            const Number &w, const Number &h,
+            const Number &goalX, const Number &goalY,
+            const Filter &filter
+        )
+        {
+            return toResponse(Bounce(), world, col, x, y, w, h, goalX, goalY, filter);
+        }
+
+        Response oneWay(
+            World &world, Collision &col,
+            const Number &x, const Number &y,
+            const Number &w, const Number &h,
+            const Number &goalX, const Number &goalY,
+            const Filter &filter
+        )
+        {
+            return toResponse(OneWay(), world, col, x, y, w, h, goalX, goalY, filter);
+        }
+    }
+
+    void ResponseContext::project(
+        const Item &item,
+        const Number &fromX, const Number &fromY,
+        const Number &toX, const Number &toY
+    )
+    {
+        world.project(item, fromX, fromY, w, h, toX, toY, filter, collisions);
+    }
+
+    namespace
+    {
+        // Response added as a ResponseFunction
+        class FunctionResponse final : public ResponseHandler
+        {
+        public:
+            explicit FunctionResponse(const ResponseFunction &function)
+                : function(function)
+            {
+            }
+
+            Point resolve(ResponseContext &ctx, Collision &col) const override
+            {
+                Point goal;
+                std::uint32_t len;
+                std::tie(goal.x, goal.y, ctx.collisions, len) = function(
+                    ctx.world, col, ctx.x, ctx.y, ctx.w, ctx.h, ctx.goalX, ctx.goalY, ctx.filter
+                );
+                ctx.collisions.resize(std::min<std::size_t>(len, ctx.collisions.size()));
+                return goal;
+            }
+
+        private:
+            ResponseFunction function;
+        };
+    }
+
+    /// ------------------------------------------
+    /// -- Filters
+    /// ------------------------------------------
+    std::string defaultFilter(const Item &item, const Item &other)
+    {
+        return "slide";
+    }
+
+    /// ------------------------------------------
+    /// -- Classes
+    /// ------------------------------------------
+    void BroadPhase::addMany(
+        const std::vector<ItemHandle> &items,
+        const std::vector<Rectangle> &rects,
+        const std::size_t &threads
+    )
+    {
+        for (std::size_t i = 0; i < items.size(); i++)
+        {
+            add(items[i], rects[i]);
+        }
+    }
+
+    void BroadPhase::removeMany(const std::vector<ItemHandle> &items, const std::vector<Rectangle> &rects)
+    {
+        for (std::size_t i = 0; i < items.size(); i++)
+        {
+            remove(items[i], rects[i]);
+        }
+    }
+
+    void BroadPhase::updateMany(
+        const std::vector<ItemHandle> &items,
+        const std::vector<Rectangle> &froms,
+        const std::vector<Rectangle> &tos,
+        const std::size_t &threads
+    )
+    {
+        for (std::size_t i = 0; i < items.size(); i++)
+        {
+            update(items[i], froms[i], tos[i]);
+        }
+    }
+
+    World::World(const Number &cellSize_, const Index &levels)
+        : World(std::unique_ptr<BroadPhase>(new GridBroadPhase(cellSize_, levels)), cellSize_)
+    {
+    }
+
+    World::World(std::unique_ptr<BroadPhase> broadPhase_, const Number &cellSize_)
+        : cellSize(cellSize_), broadPhase(std::move(broadPhase_)), stats(new Stats())
+    {
+        if (!broadPhase)
+        {
+            throw Exception::InvalidArgumentError();
+        }
+        broadPhase->stats = stats.get();
+
+        addResponseEntry("touch").type = FilterType::Touch;
+        addResponseEntry("cross").type = FilterType::Cross;
+        addResponseEntry("slide").type = FilterType::Slide;
+        addResponseEntry("bounce").type = FilterType::Bounce;
+        addResponseEntry("oneWay").type = FilterType::OneWay;
+    }
+
+    World::~World() = default;
+
+    World::World(World &&a) = default;
+
+    constexpr std::uint32_t World::bakedSlot;
+
+    template<typename Query>
+    void World::gatherCandidates(const Query &query, std::vector<Candidate> &candidates) const
+    {
+        flushUpdates();
+
+#ifdef BUMP_ENABLE_STATS
+        const std::size_t handlesCapacity = gatheredHandles.capacity(), bakedCapacity = gatheredBaked.capacity();
+#endif
+        gatheredHandles.clear();
+        query(*broadPhase, gatheredHandles);
+        BUMP_STAT(stats->allocations, gatheredHandles.capacity() != handlesCapacity);
+        BUMP_STAT(stats->allocations, candidates.size() + gatheredHandles.size() > candidates.capacity());
+        candidates.reserve(candidates.size() + gatheredHandles.size());
+        for (const ItemHandle &handle : gatheredHandles)
+        {
+            candidates.push_back(Candidate{ slots[handle.getIndex()].item, handle.getIndex() });
+        }
+
+        if (staticGeometry)
+        {
+            gatheredBaked.clear();
+            query(*staticGeometry, gatheredBaked);
+            BUMP_STAT(stats->allocations, gatheredBaked.capacity() != bakedCapacity);
+            BUMP_STAT(stats->allocations, candidates.size() + gatheredBaked.size() > candidates.capacity());
+            candidates.reserve(candidates.size() + gatheredBaked.size());
+            for (const Item &item : gatheredBaked)
+            {
+                candidates.push_back(Candidate{ item, bakedSlot });
+            }
+        }
+    }
+
+    void World::add(
+        const Item &item,
+        const Number &x, const Number &y,
+        const Number &w, const Number &h
+    )
+    {
+        // Everything is checked before a slot is taken, which would leak otherwise
+        if (hasItem(item))
+        {
+            throw Exception::AlreadyExistsError();
+        }
+        if (item == nullptr || w <= 0 || h <= 0)
+        {
+            throw Exception::InvalidArgumentError();
+        }
+
+        std::uint32_t slot;
+        if (!freeSlots.empty())
+        {
+            slot = freeSlots.back();
+            freeSlots.pop_back();
+        }
+        else
+        {
+            if (slots.size() > ItemHandle::maxIndex)
+            {
+                throw Exception::ComputationError();
+            }
+            slot = static_cast<std::uint32_t>(slots.size());
+            BUMP_STAT(stats->allocations, slots.size() == slots.capacity());
+            slots.emplace_back();
+        }
+
+        const Rectangle rect{ x, y, w, h };
+        const ItemHandle handle(slot, slots[slot].generation);
+        std::tie(slots[slot].item, slots[slot].rect) = std::make_tuple(item, rect);
+        BUMP_STAT(stats->allocations, handles.isFull());
+        handles.insert(item, handle);
+        broadPhase->add(handle, rect);
+        if (snapshots)
+        {
+            snapshots->add(item, rect);
+        }
+    }
+
+    void World::addBulk(
+        const std::vector<Item> &items,
+        const std::vector<Rectangle> &rects,
+        const std::size_t &threads
+    )
+    {
+        BUMP_TRACE_SPAN("World::addBulk", nullptr);
+
+        if (items.size() != rects.size())
+        {
+            throw Exception::InvalidArgumentError();
+        }
+        for (std::size_t i = 0; i < items.size(); i++)
+        {
+            if (hasItem(items[i]))
+            {
+                throw Exception::AlreadyExistsError();
+            }
+            if (items[i] == nullptr || rects[i].w <= 0 || rects[i].h <= 0)
+            {
+                throw Exception::InvalidArgumentError();
+            }
+        }
+
+        const std::size_t reused = std::min(freeSlots.size(), items.size());
+        if (slots.size() + (items.size() - reused) > static_cast<std::size_t>(ItemHandle::maxIndex) + 1)
+        {
+            throw Exception::ComputationError();
+        }
+
+        // Slots are handed out as add would, so handles do not depend on how items were added
+        std::vector<ItemHandle> itemHandles(items.size());
+        for (std::size_t i = 0; i < items.size(); i++)
+        {
+            const std::uint32_t slot = i < reused
+                ? freeSlots[freeSlots.size() - 1 - i]
+                : static_cast<std::uint32_t>(slots.size() + (i - reused));
+            itemHandles[i] = ItemHandle(slot, slot < slots.size() ? slots[slot].generation : 1);
+        }
+
+        BUMP_STAT(stats->allocations, !handles.fits(handles.size() + items.size()));
+        handles.reserve(handles.size() + items.size());
+        for (std::size_t i = 0; i < items.size(); i++)
+        {
+            if (!handles.insert(items[i], itemHandles[i]).second)
+            {
+                for (std::size_t j = 0; j < i; j++)
+                {
+                    handles.erase(items[j]);
+                }
+                throw Exception::InvalidArgumentError();
+            }
+        }
+
+        freeSlots.resize(freeSlots.size() - reused);
+        BUMP_STAT(stats->allocations, slots.size() + (items.size() - reused) > slots.capacity());
+        slots.resize(slots.size() + (items.size() - reused));
+        for (std::size_t i = 0; i < items.size(); i++)
+        {
+            Slot &slot = slots[itemHandles[i].getIndex()];
+            std::tie(slot.item, slot.rect) = std::make_tuple(items[i], rects[i]);
+        }
+
+        broadPhase->addMany(itemHandles, rects, threads);
+        if (snapshots)
+        {
+            for (std::size_t i = 0; i < items.size(); i++)
+            {
+                snapshots->add(items[i], rects[i]);
+            }
+        }
+    }
+
+    void World::remove(const Item &item)
+    {
+        flushUpdates();
+
+        auto found = handles.find(item);
+        if (found == handles.end())
+        {
+            throw Exception::NotFoundError();
+        }
+
+        const ItemHandle handle = found->second;
+        Slot &slot = slots[handle.getIndex()];
+        broadPhase->remove(handle, slot.rect);
+        if (snapshots)
+        {
+            snapshots->remove(item, slot.rect);
+        }
+        handles.erase(found);
+
+        slot.release();
+        freeSlots.push_back(handle.getIndex());
+    }
+
+    void World::removeMany(const std::vector<Item> &items)
+    {
+        flushUpdates();
+
+        std::vector<ItemHandle> itemHandles(items.size());
+        std::vector<Rectangle> rects(items.size());
+        for (std::size_t i = 0; i < items.size(); i++)
+        {
+            auto found = handles.find(items[i]);
+            if (found == handles.end())
+            {
+                throw Exception::NotFoundError();
+            }
+            itemHandles[i] = found->second;
+            rects[i] = slots[found->second.getIndex()].rect;
+        }
+
+        std::vector<std::uint32_t> sorted(items.size());
+        for (std::size_t i = 0; i < items.size(); i++)
+        {
+            sorted[i] = itemHandles[i].value;
+        }
+        std::sort(sorted.begin(), sorted.end());
+        if (std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end())
+        {
+            throw Exception::InvalidArgumentError();
+        }
+
+        broadPhase->removeMany(itemHandles, rects);
+        for (std::size_t i = 0; i < items.size(); i++)
+        {
+            if (snapshots)
+            {
+                snapshots->remove(items[i], rects[i]);
+            }
+            handles.erase(items[i]);
+
+            slots[itemHandles[i].getIndex()].release();
+            freeSlots.push_back(itemHandles[i].getIndex());
+        }
+    }
+
+    void World::clear()
+    {
+        dropUpdates();
+        broadPhase->clear();
+        handles.clear();
+        freeSlots.clear();
+
+        // Every slot is free again, highest first so that the next adds fill the lowest ones
+        for (std::size_t i = slots.size(); i-- > 0;)
+        {
+            Slot &slot = slots[i];
+            if (slot.item != nullptr)
+            {
+                if (snapshots)
+                {
+                    snapshots->remove(slot.item, slot.rect);
+                }
+                slot.release();
+            }
+            freeSlots.push_back(static_cast<std::uint32_t>(i));
+        }
+    }
+
+    void World::update(const Item &item, const Number &x, const Number &y)
+    {
+        Number _1, _2, w, h;
+        std::tie(_1, _2, w, h) = getRect(item);
+        update(item, x, y, w, h);
+    }
+
+    void World::update(
+        const Item &item,
+        const Number &x, const Number &y,
+        const Number &w, const Number &h
+    )
+    {
+        auto found = handles.find(item);
+        if (found == handles.end())
+        {
+            throw Exception::NotFoundError();
+        }
+        if (w <= 0 || h <= 0)
+        {
+            throw Exception::InvalidArgumentError();
+        }
+
+        updateSlot(found->second.getIndex(), Rectangle{ x, y, w, h });
+    }
+
+    void World::setDeferredUpdates(const bool &deferred, const std::size_t &threads)
+    {
+        if (!deferred)
+        {
+            flushUpdates();
+        }
+        std::tie(deferring, flushThreads) = std::make_tuple(deferred, std::max<std::size_t>(threads, 1));
+    }
+
+    void World::flush()
+    {
+        flushUpdates();
+    }
+
+    Movement World::move(
+        const Item &item,
+        const Number &goalX, const Number &goalY,
+        const Filter &filter
+    )
+    {
+        BUMP_TRACE_SPAN("World::move", item);
+
+        Number actualX, actualY;
+        std::vector<Collision> cols;
+        std::uint32_t len;
+        std::tie(actualX, actualY, cols, len) = check(item, goalX, goalY, filter);
+
+        update(item, actualX, actualY);
+
+        return Movement{ actualX, actualY, std::move(cols), len };
+    }
+
+    Movement World::moveSubstepped(
+        const Item &item,
+        const Number &goalX, const Number &goalY,
+        const Filter &filter
+    )
+    {
+        // Responses call back into project, which is where the sweep gets split
+        substepping = true;
+        try
+        {
+            Movement movement = move(item, goalX, goalY, filter);
+            substepping = false;
+            return movement;
+        }
+        catch (...)
+        {
+            substepping = false;
+            throw;
+        }
+    }
+
+    struct World::Mover
+    {
+        Item item = nullptr;
+        Number w = 0;
+        Number h = 0;
+
+        // Moves in a straight line from x, y at time to goalX, goalY at the end of the tick
+        Number x = 0;
+        Number y = 0;
+        Number time = 0;
+        Number goalX = 0;
+        Number goalY = 0;
+
+        // Done once a response stops projecting, as check would be
+        bool settled = false;
+
+        std::unordered_set<Item> visited;
+        std::vector<Collision> cols;
+
+        // Earliest impact from the last check on, valid while version is unchanged.
+        // course counts the responses, which change the line the mover is on.
+        Collision impact;
+        std::uint32_t version = 0;
+        std::uint32_t course = 0;
+
+        Point at(const Number &t) const
+        {
+            if (time >= 1)
+            {
+                return Point{ goalX, goalY };
+            }
+            const Number f = (t - time) / (1 - time);
+            return Point{ x + (goalX - x) * f, y + (goalY - y) * f };
+        }
+
+        // What the broad phase holds for a mover: the rect swept until the end of the tick
+        Rectangle getSweep(const Number &t) const
+        {
+            const Point p = at(t);
+            const Number left = std::min(p.x, goalX);
+            const Number top = std::min(p.y, goalY);
+            return Rectangle{ left, top, std::max(p.x, goalX) + w - left, std::max(p.y, goalY) + h - top };
+        }
+    };
+
+    namespace
+    {
+        struct Impact
+        {
+            Number time = 0;                // Within the tick, from 0 to 1
+            Number ti = 0;
+            std::size_t mover = 0;
+            std::uint32_t version = 0;      // Of the mover, stale once it moves on
+            std::size_t other = 0;          // Mover hit, or the mover count for anything else
+            std::uint32_t course = 0;       // Of the mover hit, stale once it turns
+        };
+
+        struct ImpactLess
+        {
+            bool operator()(const Impact &a, const Impact &b) const
+            {
+                return std::tie(a.time, a.ti, a.mover) < std::tie(b.time, b.ti, b.mover);
+            }
+        };
+    }
+
+    std::vector<Movement> World::moveMany(
+        const std::vector<Item> &items,
+        const std::vector<Point> &goals,
+        const Filter &filter
+    )
+    {
+        BUMP_TRACE_SPAN("World::moveMany", nullptr);
+
+        if (items.size() != goals.size())
+        {
+            throw Exception::InvalidArgumentError();
+        }
+
+        std::vector<std::size_t> indices(slots.size(), items.size());
+        std::vector<Mover> movers(items.size());
+        for (std::size_t i = 0; i < items.size(); i++)
+        {
+            auto found = handles.find(items[i]);
+            if (found == handles.end())
+            {
+                throw Exception::NotFoundError();
+            }
+
+            const std::uint32_t slot = found->second.getIndex();
+            if (indices[slot] != items.size())
+            {
+                throw Exception::InvalidArgumentError();
+            }
+            indices[slot] = i;
+
+            Mover &mover = movers[i];
+            const Rectangle &rect = slots[slot].rect;
+            std::tie(mover.item, mover.w, mover.h) = std::make_tuple(items[i], rect.w, rect.h);
+            std::tie(mover.x, mover.y) = std::make_tuple(rect.x, rect.y);
+            std::tie(mover.goalX, mover.goalY) = std::make_tuple(goals[i].x, goals[i].y);
+        }
+
+        // While the tick is resolved, movers sit in the broad phase as their sweeps, so
+        // that querying one sweep finds every mover that may cross it. It is queried right
+        // after every update, so none are deferred until the tick is over.
+        flushUpdates();
+        const bool deferred = deferring;
+        deferring = false;
+
+        Number time = 0;
+        try
+        {
+            for (const Mover &mover : movers)
+            {
+                const Rectangle sweep = mover.getSweep(time);
+                update(mover.item, sweep.x, sweep.y, sweep.w, sweep.h);
+            }
+
+            // Earliest impact of every mover in time order. Resolving one only re-checks
+            // the movers whose sweeps meet the sweeps that changed, the others keep theirs.
+            Aux::DaryHeap<Impact, ImpactLess> impacts;
+            const auto schedule = [this, &movers, &indices, &filter, &impacts, &time](const std::size_t &i)
+            {
+                Mover &mover = movers[i];
+                mover.version++;
+
+                std::size_t other;
+                if (mover.settled || !findImpact(mover, time, movers, indices, filter, mover.impact, other))
+                {
+                    return;
+                }
+
+                impacts.push(Impact
+                {
+                    time + std::max<Number>(mover.impact.ti, 0) * (1 - time), mover.impact.ti,
+                    i, mover.version,
+                    other, other < movers.size() ? movers[other].course : 0
+                });
+            };
+
+            for (std::size_t i = 0; i < movers.size(); i++)
+            {
+                schedule(i);
+            }
+
+            std::vector<ItemHandle> swept;
+            std::vector<std::size_t> affected;
+            while (!impacts.empty())
+            {
+                const Impact next = impacts.top();
+                impacts.pop();
+                if (next.version != movers[next.mover].version)
+                {
+                    continue;
+                }
+
+                // Every mover stays on its line until then, so an impact only needs
+                // checking again when the mover it hits has turned since
+                time = next.time;
+                if (next.other < movers.size() && next.course != movers[next.other].course)
+                {
+                    schedule(next.mover);
+                    continue;
+                }
+
+                // When two movers meet, both respond to the impact as they were heading
+                // into it, so that neither gets to turn away first
+                Mover &mover = movers[next.mover];
+                Collision impact = std::move(mover.impact);
+                Mover *target = next.other < movers.size() ? &movers[next.other] : nullptr;
+
+                Collision reaction;
+                bool reacts = false;
+                if (target != nullptr && !target->settled &&
+                    target->visited.find(mover.item) == target->visited.end())
+                {
+                    const ResponseId type = toResponseId(filter(target->item, mover.item));
+                    if (type != 0)
+                    {
+                        const Point from = target->at(time);
+                        const Point to = mover.at(time);
+                        std::tie(reacts, reaction) = Rect::detectCollision(
+                            from.x, from.y, target->w, target->h, target->goalX, target->goalY,
+                            to.x, to.y, mover.w, mover.h, mover.goalX, mover.goalY
+                        );
+                        std::tie(reaction.item, reaction.other, reaction.type) =
+                            std::make_tuple(target->item, mover.item, type);
+                    }
+                }
+
+                // Movers are never baked, so the static geometry has nothing to add here
+                swept.clear();
+                broadPhase->queryRect(mover.getSweep(time), swept);
+                respond(mover, time, impact, filter);
+                broadPhase->queryRect(mover.getSweep(time), swept);
+                if (reacts)
+                {
+                    broadPhase->queryRect(target->getSweep(time), swept);
+                    respond(*target, time, reaction, filter);
+                    broadPhase->queryRect(target->getSweep(time), swept);
+                }
+
+                affected.clear();
+                for (const ItemHandle &candidate : swept)
+                {
+                    const std::size_t index = indices[candidate.getIndex()];
+                    if (index != movers.size())
+                    {
+                        affected.push_back(index);
+                    }
+                }
+                std::sort(affected.begin(), affected.end());
+                affected.erase(std::unique(affected.begin(), affected.end()), affected.end());
+
+                for (const std::size_t &i : affected)
+                {
+                    schedule(i);
+                }
+            }
+        }
+        catch (...)
+        {
+            // Leave every mover where it got to
+            batching = nullptr;
+            for (const Mover &mover : movers)
+            {
+                if (handles.find(mover.item) != handles.end())
+                {
+                    const Point position = mover.at(time);
+                    update(mover.item, position.x, position.y, mover.w, mover.h);
+                }
+            }
+            deferring = deferred;
+            throw;
+        }
+
+        std::vector<Movement> movements;
+        movements.reserve(movers.size());
+        for (Mover &mover : movers)
+        {
+            update(mover.item, mover.goalX, mover.goalY, mover.w, mover.h);
+
+            const std::uint32_t len = static_cast<std::uint32_t>(mover.cols.size());
+            movements.emplace_back(mover.goalX, mover.goalY, std::move(mover.cols), len);
+        }
+        deferring = deferred;
+        return movements;
+    }
+
+    Movement World::check(
+        const Item &item,
+        const Number &goalX_, const Number &goalY_,
+        const Filter &filter
+    )
+    {
+        Number goalX = goalX_;
+        Number goalY = goalY_;
+
+        std::unordered_set<Item> visited{ item };
+        const Filter visitedFilter = [this, &visited, &filter](const Item &itm, const Item &other)
+        {
+            if (visited.find(other) != visited.end())
+            {
+                BUMP_STAT(stats->dedupeRejects, 1);
+                return std::string();
+            }
+            return filter(itm, other);
+        };
+
+        std::vector<Collision> cols;
+        std::uint32_t len = 0;
+
+        Number x, y, w, h;
+        std::tie(x, y, w, h) = getRect(item);
+
+        // Every response projects into the same buffer
+        std::vector<Collision> projected;
+        project(item, x, y, w, h, goalX, goalY, visitedFilter, projected);
+
+        ResponseContext ctx{ *this, x, y, w, h, goalX, goalY, visitedFilter, projected };
+        while (!projected.empty())
+        {
+            Collision col = std::move(projected[0]);
+            visited.insert(col.other);
+            BUMP_STAT(stats->responseIterations, 1);
+
+            const Point goal = resolve(getResponse(col.type), ctx, col);
+            std::tie(ctx.goalX, ctx.goalY) = std::make_tuple(goal.x, goal.y);
+
+            BUMP_STAT(stats->allocations, cols.size() == cols.capacity());
+            cols.push_back(std::move(col));
+            len++;
+        }
+
+        return Movement{ ctx.goalX, ctx.goalY, std::move(cols), len };
+    }
+
+    Collisions World::project(
+        const Item &item,
+        const Number &x, const Number &y,
+        const Number &w, const Number &h,
+        const Number &goalX, const Number &goalY,
+        const Filter &filter
+    )
+    {
+        std::vector<Collision> collisions;
+        const std::uint32_t len = project(item, x, y, w, h, goalX, goalY, filter, collisions);
+        return Collisions{ std::move(collisions), len };
+    }
+
+    std::uint32_t World::project(
+        const Item &item,
+        const Number &x, const Number &y,
+        const Number &w, const Number &h,
+        const Number &goalX, const Number &goalY,
+        const Filter &filter,
+        std::vector<Collision> &collisions
+    )
+    {
+        // moveMany finds the next impacts itself, it only needs to know where the
+        // response carries on from
+        if (batching)
+        {
+            std::tie(batching->x, batching->y, batching->settled) = std::make_tuple(x, y, false);
+            collisions.clear();
+            return 0;
+        }
+
+        // Sweeps within a cell gain nothing from being split
+        if (substepping && std::max(std::abs(goalX - x), std::abs(goalY - y)) > cellSize)
+        {
+            projectSubstepped(item, x, y, w, h, goalX, goalY, filter, collisions);
+            return static_cast<std::uint32_t>(collisions.size());
+        }
+
+        BUMP_TRACE_SPAN("World::project", item);
+
+        // This could probably be done with less cells using a polygon raster over the cells instead of a
+        // bounding rect of the whole movement. Conditional to building a queryPolygon method
+        const Number tl = std::min(goalX, x);
+        const Number tt = std::min(goalY, y);
+        const Number tr = std::max(goalX + w, x + w);
+        const Number tb = std::max(goalY + h, y + h);
+
+        std::vector<Candidate> candidates;
+        {
+            BUMP_TRACE_SPAN("BroadPhase::queryRect", item);
+            const Rectangle rect{ tl, tt, tr - tl, tb - tt };
+            gatherCandidates([&rect](const auto &index, auto &found) { index.queryRect(rect, found); }, candidates);
+        }
+
+        std::vector<Contact> contacts;
+        std::vector<ResponseId> types;
+        detectContacts(item, x, y, w, h, goalX, goalY, filter, candidates, 0, contacts, types);
+
+        toCollisions(item, x, y, w, h, goalX, goalY, candidates, contacts, types, collisions);
+        return static_cast<std::uint32_t>(collisions.size());
+    }
+
+    Items World::queryRect(
+        const Number &x, const Number &y,
+        const Number &w, const Number &h,
+        const QueryFilter &filter
+    ) const
+    {
+        if (w <= 0 || h <= 0)
+        {
+            throw Exception::InvalidArgumentError();
+        }
+
+        std::vector<Candidate> candidates;
+        {
+            BUMP_TRACE_SPAN("BroadPhase::queryRect", nullptr);
+            const Rectangle query{ x, y, w, h };
+            gatherCandidates([&query](const auto &index, auto &found) { index.queryRect(query, found); }, candidates);
+        }
+
+        std::vector<Item> items;
+        for (const Candidate &candidate : candidates)
+        {
+            const Rectangle &rect = getCandidateRect(candidate);
+            BUMP_STAT(stats->candidatesTested, 1);
+            if ((!filter || filter(candidate.item)) &&
+                Rect::isIntersecting(x, y, w, h, rect.x, rect.y, rect.w, rect.h))
+            {
+                BUMP_STAT(stats->narrowPhaseHits, 1);
+                BUMP_STAT(stats->allocations, items.size() == items.capacity());
+                items.push_back(candidate.item);
+            }
+        }
+
+        const std::uint32_t len = static_cast<std::uint32_t>(items.size());
+        return Items{ std::move(items), len };
+    }
+
+    Items World::queryPoint(
+        const Number &x, const Number &y,
+        const QueryFilter &filter
+    ) const
+    {
+        std::vector<Candidate> candidates;
+        {
+            BUMP_TRACE_SPAN("BroadPhase::queryPoint", nullptr);
+            gatherCandidates([&x, &y](const auto &index, auto &found) { index.queryPoint(x, y, found); }, candidates);
+        }
+
+        std::vector<Item> items;
+        for (const Candidate &candidate : candidates)
+        {
+            const Rectangle &rect = getCandidateRect(candidate);
+            BUMP_STAT(stats->candidatesTested, 1);
+            if ((!filter || filter(candidate.item)) &&
+                Rect::containsPoint(rect.x, rect.y, rect.w, rect.h, x, y))
+            {
+                BUMP_STAT(stats->narrowPhaseHits, 1);
+                BUMP_STAT(stats->allocations, items.size() == items.capacity());
+                items.push_back(candidate.item);
+            }
+        }
+
+        const std::uint32_t len = static_cast<std::uint32_t>(items.size());
+        return Items{ std::move(items), len };
+    }
+
+    Items World::querySegment(
+        const Number &x1, const Number &y1,
+        const Number &x2, const Number &y2,
+        const QueryFilter &filter
+    ) const
+    {
+        std::vector<ItemInfo> itemInfo;
+        std::uint32_t len;
+        std::tie(itemInfo, len) = getInfoAboutItemsTouchedBySegment(x1, y1, x2, y2, filter);
+
+        std::vector<Item> items;
+        items.reserve(len);
+        for (const ItemInfo &info : itemInfo)
+        {
+            items.push_back(info.item);
+        }
+
+        return Items{ std::move(items), len };
+    }
+
+    ItemInfos World::querySegmentWithCoords(
+        const Number &x1, const Number &y1,
+        const Number &x2, const Number &y2,
+        const QueryFilter &filter
+    ) const
+    {
+        std::vector<ItemInfo> itemInfo;
+        std::uint32_t len;
+        std::tie(itemInfo, len) = getInfoAboutItemsTouchedBySegment(x1, y1, x2, y2, filter);
+
+        const Number dx = x2 - x1;
+        const Number dy = y2 - y1;
+
+        for (ItemInfo &info : itemInfo)
+        {
+            info.weight = 0;
+            info.x1 = x1 + dx * info.ti1;
+            info.y1 = y1 + dy * info.ti1;
+            info.x2 = x1 + dx * info.ti2;
+            info.y2 = y1 + dy * info.ti2;
+        }
+
+        return ItemInfos{ std::move(itemInfo), len };
+    }
+
+    bool World::hasItem(const Item &item) const
+    {
+        return handles.find(item) != handles.end() || (staticGeometry && staticGeometry->hasItem(item));
+    }
+
+    std::vector<Item> World::getItems() const
+    {
+        std::vector<Item> items;
+        items.reserve(countItems());
+        for (const auto &handle : handles)
+        {
+            items.push_back(handle.first);
+        }
+        if (staticGeometry)
+        {
+            staticGeometry->getItems(items);
+        }
+        return items;
+    }
+
+    std::size_t World::countItems() const
+    {
+        return handles.size() + (staticGeometry ? staticGeometry->countItems() : 0);
+    }
+
+    std::size_t World::countCells() const
+    {
+        flushUpdates();
+        return broadPhase->countCells() + (staticGeometry ? staticGeometry->countCells() : 0);
+    }
+
+    std::tuple<Number, Number, Number, Number> World::getRect(const Item &item) const
+    {
+        const Rectangle &rect = getItemRect(item);
+        return std::make_tuple(rect.x, rect.y, rect.w, rect.h);
+    }
+
+    void World::setLayers(const Item &item, const Layers &layers)
+    {
+        slots[handles.at(item).getIndex()].layers = layers;
+    }
+
+    Layers World::getLayers(const Item &item) const
+    {
+        auto found = handles.find(item);
+        if (found != handles.end())
+        {
+            return slots[found->second.getIndex()].layers;
+        }
+
+        if (staticGeometry == nullptr || staticGeometry->getRect(item) == nullptr)
+        {
+            throw Exception::NotFoundError();
+        }
+        return Layers();
+    }
+
+    ItemHandle World::getHandle(const Item &item) const
+    {
+        return handles.at(item);
+    }
+
+    bool World::hasHandle(const ItemHandle &handle) const
+    {
+        const std::uint32_t slot = handle.getIndex();
+        return slot < slots.size() && slots[slot].item != nullptr &&
+            slots[slot].generation == handle.getGeneration();
+    }
+
+    Item World::getItem(const ItemHandle &handle) const
+    {
+        return slots[getSlot(handle)].item;
+    }
+
+    std::tuple<Number, Number, Number, Number> World::getRect(const ItemHandle &handle) const
+    {
+        const Rectangle &rect = slots[getSlot(handle)].rect;
+        return std::make_tuple(rect.x, rect.y, rect.w, rect.h);
+    }
+
+    void World::update(const ItemHandle &handle, const Number &x, const Number &y)
+    {
+        const std::uint32_t slot = getSlot(handle);
+        updateSlot(slot, Rectangle{ x, y, slots[slot].rect.w, slots[slot].rect.h });
+    }
+
+    void World::update(
+        const ItemHandle &handle,
+        const Number &x, const Number &y,
+        const Number &w, const Number &h
+    )
+    {
+        const std::uint32_t slot = getSlot(handle);
+        if (w <= 0 || h <= 0)
+        {
+            throw Exception::InvalidArgumentError();
+        }
+
+        updateSlot(slot, Rectangle{ x, y, w, h });
+    }
+
+    const Stats &World::getStats() const
+    {
+        return *stats;
+    }
 
-            if (move.x != 0 || move.y != 0)
+    void World::resetStats()
+    {
+        *stats = Stats();
+    }
+
+    void World::serialize(std::vector<std::uint8_t> &blob) const
+    {
+        flushUpdates();
+
+        blob.clear();
+        Blob::write(blob, Blob::magic);
+        Blob::write(blob, Blob::version);
+        Blob::write(blob, Blob::byteOrder);
+        Blob::write(blob, static_cast<std::uint32_t>(sizeof(Item)));
+        Blob::write(blob, cellSize);
+
+        Blob::writeArray(blob, slots);
+        Blob::writeArray(blob, freeSlots);
+        handles.save(blob);
+        broadPhase->save(blob);
+
+        Blob::write(blob, Blob::checksum(blob.data(), blob.size()));
+    }
+
+    void World::deserialize(const std::vector<std::uint8_t> &blob, const Blob::Check &check)
+    {
+        std::uint64_t stored = 0;
+        if (blob.size() < sizeof(stored))
+        {
+            throw Exception::InvalidArgumentError();
+        }
+
+        const std::size_t size = blob.size() - sizeof(stored);
+        std::memcpy(&stored, blob.data() + size, sizeof(stored));
+
+        Blob::Reader reader(blob.data(), size);
+        if (reader.read<std::uint32_t>() != Blob::magic ||
+            reader.read<std::uint32_t>() != Blob::version ||
+            reader.read<std::uint32_t>() != Blob::byteOrder ||
+            reader.read<std::uint32_t>() != sizeof(Item) ||
+            Blob::checksum(blob.data(), size) != stored)
+        {
+            throw Exception::InvalidArgumentError();
+        }
+
+        if (check == Blob::Check::Full)
+        {
+            deserializeChecked(reader);
+            return;
+        }
+
+        // The backend comes last in the blob and checks its kind before touching anything,
+        // so skim past the world's arrays to let it go first
+        Blob::Reader world = reader;
+        const Number loadedCellSize = reader.read<Number>();
+        reader.skipArray<Slot>();
+        reader.skipArray<std::uint32_t>();
+        FlatMap<Item, ItemHandle>::skip(reader);
+        if (!(loadedCellSize > 0))
+        {
+            throw Exception::InvalidArgumentError();
+        }
+        broadPhase->load(reader, nullptr);
+
+        dropUpdates();
+        cellSize = world.read<Number>();
+        world.readArray(slots);
+        world.readArray(freeSlots);
+        handles.load(world);
+
+        // Rebuilt from the restored rects by the next snapshot
+        snapshots.reset();
+    }
+
+    void World::deserializeChecked(Blob::Reader &reader)
+    {
+        // Everything is read and checked aside first, so that a bad blob leaves the world as it was
+        const Number loadedCellSize = reader.read<Number>();
+        std::vector<Slot> loadedSlots;
+        std::vector<std::uint32_t> loadedFreeSlots;
+        FlatMap<Item, ItemHandle> loadedHandles;
+        reader.readArray(loadedSlots);
+        reader.readArray(loadedFreeSlots);
+        loadedHandles.load(reader);
+
+        if (!(loadedCellSize > 0) || loadedSlots.size() > static_cast<std::size_t>(ItemHandle::maxIndex) + 1
+            || !loadedHandles.isValid())
+        {
+            throw Exception::InvalidArgumentError();
+        }
+
+        // Generation of the item in each slot, 0 for free ones, which is all the broad phase may hold.
+        // Every handle must name a distinct live slot holding its item...
+        loadGenerations.assign(loadedSlots.size(), 0);
+        for (const auto &entry : loadedHandles)
+        {
+            const std::uint32_t index = entry.second.getIndex();
+            if (index >= loadedSlots.size() || loadGenerations[index] != 0)
             {
-                Number bnx, bny;
-                std::tie(bnx, bny) = std::make_tuple(goalX - tx, goalY - ty);
-                if (col.normal.x == 0)
+                throw Exception::InvalidArgumentError();
+            }
+
+            const Slot &slot = loadedSlots[index];
+            if (slot.item != entry.first || slot.generation != entry.second.getGeneration()
+                || !(slot.rect.w > 0) || !(slot.rect.h > 0))
+            {
+                throw Exception::InvalidArgumentError();
+            }
+            loadGenerations[index] = static_cast<std::uint8_t>(slot.generation);
+        }
+
+        // ...free slots are listed once...
+        loadListed.assign(loadedSlots.size(), false);
+        for (const std::uint32_t &index : loadedFreeSlots)
+        {
+            if (index >= loadedSlots.size() || loadListed[index])
+            {
+                throw Exception::InvalidArgumentError();
+            }
+            loadListed[index] = true;
+        }
+
+        // ...and in one pass over the slots, every live one must have been named, and every
+        // free one listed
+        for (std::size_t index = 0; index < loadedSlots.size(); index++)
+        {
+            const Slot &slot = loadedSlots[index];
+            if (slot.generation < 1 || slot.generation > ItemHandle::maxGeneration
+                || (slot.item != nullptr && loadGenerations[index] == 0)
+                || loadListed[index] != (slot.item == nullptr))
+            {
+                throw Exception::InvalidArgumentError();
+            }
+        }
+
+        // Last in the blob, the backend only replaces its index once all of it checks out
+        broadPhase->load(reader, &loadGenerations);
+
+        dropUpdates();
+        cellSize = loadedCellSize;
+        slots.swap(loadedSlots);
+        freeSlots.swap(loadedFreeSlots);
+        std::swap(handles, loadedHandles);
+
+        // Rebuilt from the restored rects by the next snapshot
+        snapshots.reset();
+    }
+
+    std::tuple<Number, Number> World::toWorld(const Number &cx, const Number &cy) const
+    {
+        return Grid::toWorld(cellSize, cx, cy);
+    }
+
+    std::tuple<Number, Number> World::toCell(const Number &x, const Number &y) const
+    {
+        return Grid::toCell(cellSize, x, y);
+    }
+
+    void World::addResponse(const std::string &name, const ResponseFunction &handler)
+    {
+        addResponseEntry(name).handler.reset(new FunctionResponse(handler));
+    }
+
+    void World::addResponse(const std::string &name, std::unique_ptr<ResponseHandler> handler)
+    {
+        if (!handler)
+        {
+            throw Exception::InvalidArgumentError();
+        }
+
+        addResponseEntry(name).handler = std::move(handler);
+    }
+
+    void World::setStaticGeometry(std::shared_ptr<const StaticGeometry> geometry)
+    {
+        if (geometry)
+        {
+            for (const auto &handle : handles)
+            {
+                if (geometry->hasItem(handle.first))
                 {
-                    bny = -bny;
+                    throw Exception::AlreadyExistsError();
                 }
-                else
+            }
+        }
+        staticGeometry = std::move(geometry);
+    }
+
+    std::shared_ptr<const Snapshot> World::snapshot()
+    {
+        if (!snapshots)
+        {
+            snapshots.reset(new SnapshotWriter(cellSize));
+            for (const Slot &slot : slots)
+            {
+                if (slot.item != nullptr)
                 {
-                    bnx = -bnx;
+                    snapshots->add(slot.item, slot.rect);
                 }
+            }
+        }
+        return snapshots->snapshot(staticGeometry);
+    }
 
-                std::tie(bx, by) = std::make_tuple(tx + bnx, ty + bny);
+    const Rectangle &World::getItemRect(const Item &item) const
+    {
+        auto found = handles.find(item);
+        if (found != handles.end())
+        {
+            return slots[found->second.getIndex()].rect;
+        }
+
+        const Rectangle *rect = staticGeometry ? staticGeometry->getRect(item) : nullptr;
+        if (rect == nullptr)
+        {
+            throw Exception::NotFoundError();
+        }
+        return *rect;
+    }
+
+    const Rectangle &World::getCandidateRect(const Candidate &candidate) const
+    {
+        if (candidate.slot != bakedSlot)
+        {
+            return slots[candidate.slot].rect;
+        }
+        return *staticGeometry->getRect(candidate.item);
+    }
+
+    Layers World::getItemLayers(const Item &item) const
+    {
+        auto found = handles.find(item);
+        return found != handles.end() ? slots[found->second.getIndex()].layers : Layers();
+    }
+
+    const Layers &World::getCandidateLayers(const Candidate &candidate) const
+    {
+        static const Layers baked;
+        return candidate.slot != bakedSlot ? slots[candidate.slot].layers : baked;
+    }
+
+    std::uint32_t World::getSlot(const ItemHandle &handle) const
+    {
+        if (!hasHandle(handle))
+        {
+            throw Exception::NotFoundError();
+        }
+        return handle.getIndex();
+    }
+
+    void World::updateSlot(const std::uint32_t &slot, const Rectangle &rect)
+    {
+        Slot &entry = slots[slot];
+        const Rectangle from = entry.rect;
+        if (from.x == rect.x && from.y == rect.y && from.w == rect.w && from.h == rect.h)
+        {
+            return;
+        }
+
+        entry.rect = rect;
+        if (snapshots)
+        {
+            snapshots->update(entry.item, from, rect);
+        }
+
+        if (!deferring)
+        {
+            broadPhase->update(ItemHandle(slot, entry.generation), from, rect);
+            return;
+        }
+
+        // Only the first update since the last flush knows what the broad phase holds
+        if (dirtySlots.size() <= slot)
+        {
+            dirtySlots.resize(slots.size(), false);
+        }
+        if (!dirtySlots[slot])
+        {
+            dirtySlots[slot] = true;
+            dirtyItems.push_back(DirtyItem{ slot, from });
+        }
+    }
+
+    void World::flushUpdates() const
+    {
+        if (dirtyItems.empty())
+        {
+            return;
+        }
+
+        BUMP_TRACE_SPAN("World::flush", nullptr);
+
+        std::vector<ItemHandle> itemHandles;
+        std::vector<Rectangle> froms;
+        std::vector<Rectangle> tos;
+        itemHandles.reserve(dirtyItems.size());
+        froms.reserve(dirtyItems.size());
+        tos.reserve(dirtyItems.size());
+        for (const DirtyItem &dirty : dirtyItems)
+        {
+            dirtySlots[dirty.slot] = false;
+
+            // Items that went back where they were have nothing to catch up with
+            const Slot &slot = slots[dirty.slot];
+            const Rectangle &from = dirty.from;
+            if (from.x == slot.rect.x && from.y == slot.rect.y && from.w == slot.rect.w && from.h == slot.rect.h)
+            {
+                continue;
             }
 
-            col.bounce = { bx, by };
-            
-            Number newX = touch.x;
-            Number newY = touch.y;
+            itemHandles.emplace_back(dirty.slot, slot.generation);
+            froms.push_back(from);
+            tos.push_back(slot.rect);
+        }
+        dirtyItems.clear();
+
+        broadPhase->updateMany(itemHandles, froms, tos, flushThreads);
+    }
+
+    void World::dropUpdates()
+    {
+        dirtyItems.clear();
+        dirtySlots.assign(dirtySlots.size(), false);
+    }
+
+    void World::projectSubstepped(
+        const Item &item,
+        const Number &x, const Number &y,
+        const Number &w, const Number &h,
+        const Number &goalX, const Number &goalY,
+        const Filter &filter,
+        std::vector<Collision> &collisions
+    )
+    {
+        BUMP_TRACE_SPAN("World::projectSubstepped", item);
+
+        const Number dx = goalX - x;
+        const Number dy = goalY - y;
+        const Number steps = std::ceil(std::max(std::abs(dx), std::abs(dy)) / cellSize);
+
+        std::vector<Contact> contacts;
+        std::vector<ResponseId> types;
+        std::unordered_set<Item> visited{ item };
+        std::vector<Candidate> candidates;     // Of every sub-sweep, as contacts index them
+
+        Number cl = 0, ct = 0, cr = 0, cb = 0;  // Cells queried by the previous sub-sweep, exclusive
+        std::vector<std::tuple<Number, Number, Number, Number>> bands;
+        Number fromX = x;
+        Number fromY = y;
+        Number firstTi = std::numeric_limits<Number>::max();
+
+        for (Number step = 1; step <= steps; step++)
+        {
+            // The last sub-sweep ends exactly on the goal
+            const Number toX = step == steps ? goalX : x + dx * step / steps;
+            const Number toY = step == steps ? goalY : y + dy * step / steps;
+
+            Number l, t, cw, ch;
+            std::tie(l, t, cw, ch) = Grid::toCellRect(
+                cellSize,
+                std::min(fromX, toX), std::min(fromY, toY),
+                std::abs(toX - fromX) + w, std::abs(toY - fromY) + h
+            );
+            const Number r = l + cw;
+            const Number b = t + ch;
+
+            // Sub-sweeps move by at most a cell, so the cells they add to the previous
+            // one form up to four bands around their overlap
+            bands.clear();
+            const Number ol = std::max(l, cl), ot = std::max(t, ct);
+            const Number orr = std::min(r, cr), ob = std::min(b, cb);
+            if (step == 1 || ol >= orr || ot >= ob)
+            {
+                bands.emplace_back(l, t, r, b);
+            }
+            else
+            {
+                bands.emplace_back(l, t, r, ot);
+                bands.emplace_back(l, ob, r, b);
+                bands.emplace_back(l, ot, ol, ob);
+                bands.emplace_back(orr, ot, r, ob);
+            }
+
+            const std::size_t first = candidates.size();
+            for (const auto &band : bands)
+            {
+                Number bl, bt, br, bb;
+                std::tie(bl, bt, br, bb) = band;
+                if (bl >= br || bt >= bb)
+                {
+                    continue;
+                }
+
+                Number wx, wy;
+                std::tie(wx, wy) = Grid::toWorld(cellSize, bl, bt);
+                const Rectangle rect{ wx, wy, (br - bl) * cellSize, (bb - bt) * cellSize };
 
-            Number newGoalX = bx;
-            Number newGoalY = by;
+                BUMP_TRACE_SPAN("BroadPhase::queryRect", item);
+                gatherCandidates([&rect](const auto &index, auto &found) { index.queryRect(rect, found); }, candidates);
+            }
 
-            std::vector<Collision> cols;
-            std::uint32_t len;
-            std::tie(cols, len) = world.project(
-                col.item, newX, newY, w, h, newGoalX, newGoalY, filter
+            // Items spanning several bands or sub-sweeps are only tested once
+            candidates.erase(
+                std::remove_if(candidates.begin() + first, candidates.end(),
+                    [&visited](const Candidate &other) { return !visited.insert(other.item).second; }),
+                candidates.end()
             );
 
-            return Response{ newGoalX, newGoalY, cols, len };
+            const std::size_t found = contacts.size();
+            detectContacts(item, x, y, w, h, goalX, goalY, filter, candidates, first, contacts, types);
+            for (std::size_t i = found; i < contacts.size(); i++)
+            {
+                firstTi = std::min(firstTi, contacts[i].ti);
+            }
+
+            // Anything not found yet lies outside of the cells swept so far, and cannot
+            // be hit before the sub-sweep ahead of the last one
+            if (firstTi < (step - 1) / steps)
+            {
+                break;
+            }
+
+            std::tie(cl, ct, cr, cb) = std::make_tuple(l, t, r, b);
+            std::tie(fromX, fromY) = std::make_tuple(toX, toY);
         }
+
+        toCollisions(item, x, y, w, h, goalX, goalY, candidates, contacts, types, collisions);
     }
 
-    /// ------------------------------------------
-    /// -- Classes
-    /// ------------------------------------------
-    World::World(const Number &cellSize_) : cellSize(cellSize_)
+    void World::respond(Mover &mover, const Number &time, Collision &impact, const Filter &filter)
     {
-        addResponse("touch", Responses::touch);
-        addResponse("cross", Responses::cross);
-        addResponse("slide", Responses::slide);
-        addResponse("bounce", Responses::bounce);
+        const Point position = mover.at(time);
+        std::tie(mover.x, mover.y, mover.time) = std::make_tuple(position.x, position.y, time);
+        mover.course++;
+        mover.visited.insert(impact.other);
+        BUMP_STAT(stats->responseIterations, 1);
+
+        const std::unordered_set<Item> &visited = mover.visited;
+        const Filter visitedFilter = [&visited, &filter](const Item &itm, const Item &other)
+        {
+            return visited.find(other) != visited.end() ? std::string() : filter(itm, other);
+        };
+
+        // The response moves the start of the rest of the tick along with the
+        // projection it makes, if any
+        const ResponseEntry &response = getResponse(impact.type);
+        std::vector<Collision> projected;
+        ResponseContext ctx{ *this, mover.x, mover.y, mover.w, mover.h, mover.goalX, mover.goalY, visitedFilter, projected };
+        mover.settled = true;
+        batching = &mover;
+        const Point goal = resolve(response, ctx, impact);
+        batching = nullptr;
+        std::tie(mover.goalX, mover.goalY) = std::make_tuple(goal.x, goal.y);
+        if (mover.settled)
+        {
+            std::tie(mover.x, mover.y) = std::make_tuple(mover.goalX, mover.goalY);
+        }
+        mover.cols.push_back(std::move(impact));
+
+        const Rectangle sweep = mover.getSweep(time);
+        update(mover.item, sweep.x, sweep.y, sweep.w, sweep.h);
     }
 
-    Collisions World::project(
+    bool World::findImpact(
+        const Mover &mover,
+        const Number &time,
+        const std::vector<Mover> &movers,
+        const std::vector<std::size_t> &indices,
+        const Filter &filter,
+        Collision &impact,
+        std::size_t &target
+    )
+    {
+        const Point position = mover.at(time);
+
+        std::vector<Candidate> candidates;
+        {
+            BUMP_TRACE_SPAN("BroadPhase::queryRect", mover.item);
+            const Rectangle sweep = mover.getSweep(time);
+            gatherCandidates([&sweep](const auto &index, auto &found) { index.queryRect(sweep, found); }, candidates);
+        }
+
+        bool any = false;
+        const Layers layers = getItemLayers(mover.item);
+        for (const Candidate &candidate : candidates)
+        {
+            const Item &other = candidate.item;
+            if (other == mover.item || mover.visited.find(other) != mover.visited.end())
+            {
+                BUMP_STAT(stats->dedupeRejects, 1);
+                continue;
+            }
+
+            if (!layers.collidesWith(getCandidateLayers(candidate)))
+            {
+                continue;
+            }
+
+            const ResponseId type = toResponseId(filter(mover.item, other));
+            if (type == 0)
+            {
+                continue;
+            }
+
+            BUMP_STAT(stats->candidatesTested, 1);
+
+            bool found;
+            Collision col;
+            const std::size_t index = candidate.slot != bakedSlot ? indices[candidate.slot] : movers.size();
+            if (index != movers.size())
+            {
+                const Mover &hit = movers[index];
+                const Point at = hit.at(time);
+                std::tie(found, col) = Rect::detectCollision(
+                    position.x, position.y, mover.w, mover.h, mover.goalX, mover.goalY,
+                    at.x, at.y, hit.w, hit.h, hit.goalX, hit.goalY
+                );
+            }
+            else
+            {
+                const Rectangle &rect = getCandidateRect(candidate);
+                std::tie(found, col) = Rect::detectCollision(
+                    position.x, position.y, mover.w, mover.h,
+                    rect.x, rect.y, rect.w, rect.h,
+                    mover.goalX, mover.goalY
+                );
+            }
+
+            if (found)
+            {
+                col.other = other;
+                col.item = mover.item;
+                col.type = type;
+
+                BUMP_STAT(stats->narrowPhaseHits, 1);
+                if (!any || sortByTiAndDistance(col, impact))
+                {
+                    impact = std::move(col);
+                    target = index;
+                    any = true;
+                }
+            }
+        }
+        return any;
+    }
+
+    void World::detectContacts(
         const Item &item,
         const Number &x, const Number &y,
         const Number &w, const Number &h,
         const Number &goalX, const Number &goalY,
-        const Filter &filter
+        const Filter &filter,
+        const std::vector<Candidate> &candidates,
+        const std::size_t &first,
+        std::vector<Contact> &contacts,
+        std::vector<ResponseId> &types
     )
     {
-        return { {  }, 0 };
+        const Layers layers = getItemLayers(item);
+        Aux::detectContacts(item, x, y, w, h, goalX, goalY, filter, first, candidates.size(),
+            [&candidates](const std::size_t &i) -> const Item & { return candidates[i].item; },
+            [this, &candidates](const std::size_t &i) -> const Rectangle & { return getCandidateRect(candidates[i]); },
+            [this, &candidates, &layers](const std::size_t &i) { return layers.collidesWith(getCandidateLayers(candidates[i])); },
+            *stats, contacts, types);
     }
 
-    void World::addResponse(const std::string &name, const ResponseFunction &handler)
+    void World::toCollisions(
+        const Item &item,
+        const Number &x, const Number &y,
+        const Number &w, const Number &h,
+        const Number &goalX, const Number &goalY,
+        const std::vector<Candidate> &candidates,
+        const std::vector<Contact> &contacts,
+        std::vector<ResponseId> &types,
+        std::vector<Collision> &collisions
+    ) const
     {
-        responses[name] = handler;
+        Aux::toCollisions(item, x, y, w, h, goalX, goalY, contacts, types,
+            [&candidates](const std::uint32_t &other) -> const Item & { return candidates[other].item; },
+            [this, &candidates](const std::uint32_t &other) -> const Rectangle & { return getCandidateRect(candidates[other]); },
+            collisions);
     }
 
-    void World::addItemToCell(const Item &item, const Number &cx, const Number &cy)
+    void World::projectAgainst(
+        const Item &item,
+        const Number &x, const Number &y,
+        const Number &w, const Number &h,
+        const Number &goalX, const Number &goalY,
+        const Filter &filter,
+        const std::vector<Item> &others,
+        const std::vector<Rectangle> &rects,
+        std::vector<Collision> &collisions
+    )
     {
-        Index ix = static_cast<Index>(cx);
-        Index iy = static_cast<Index>(cy);
+        const auto itemOf = [&others](const std::size_t &i) -> const Item & { return others[i]; };
+        const auto rectOf = [&rects](const std::size_t &i) -> const Rectangle & { return rects[i]; };
+
+        // Nothing outside of a World has layers or counts stats
+        Stats stats;
+        std::vector<Contact> contacts;
+        std::vector<ResponseId> types;
+        Aux::detectContacts(item, x, y, w, h, goalX, goalY, filter, 0, others.size(),
+            itemOf, rectOf, [](const std::size_t &) { return true; }, stats, contacts, types);
+        Aux::toCollisions(item, x, y, w, h, goalX, goalY, contacts, types, itemOf, rectOf, collisions);
+    }
 
-        if (rows.size() < iy + 1)
+    ItemInfos World::getInfoAboutItemsTouchedBySegment(
+        const Number &x1, const Number &y1,
+        const Number &x2, const Number &y2,
+        const QueryFilter &filter
+    ) const
+    {
+        std::vector<Candidate> candidates;
         {
-            rows.resize(iy + 1);
+            BUMP_TRACE_SPAN("BroadPhase::querySegment", nullptr);
+            gatherCandidates([&x1, &y1, &x2, &y2](const auto &index, auto &found)
+                {
+                    index.querySegment(x1, y1, x2, y2, found);
+                }, candidates);
         }
-        auto &row = rows[iy];
-        if (row.size() < ix + 1)
+
+        std::vector<ItemInfo> itemInfo;
+        for (const Candidate &candidate : candidates)
         {
-            row.resize(ix + 1);
+            const Item &item = candidate.item;
+            if (filter && !filter(item))
+            {
+                continue;
+            }
+
+            const Rectangle &rect = getCandidateRect(candidate);
+            BUMP_STAT(stats->candidatesTested, 1);
+
+            bool touches;
+            ItemInfo info;
+            std::tie(touches, info.ti1, info.ti2, info.weight) =
+                Rect::getSegmentTouch(rect.x, rect.y, rect.w, rect.h, x1, y1, x2, y2);
+
+            if (touches)
+            {
+                info.item = item;
+                BUMP_STAT(stats->narrowPhaseHits, 1);
+                BUMP_STAT(stats->allocations, itemInfo.size() == itemInfo.capacity());
+                itemInfo.push_back(info);
+            }
         }
 
-        auto &cell = row[ix];
+        std::sort(itemInfo.begin(), itemInfo.end(), sortByWeight);
 
-        nonEmptyCells[&cell] = true;
+        const std::uint32_t len = static_cast<std::uint32_t>(itemInfo.size());
+        return ItemInfos{ std::move(itemInfo), len };
     }
 
     bool World::sortByWeight(const ItemInfo &a, const ItemInfo &b)
@@ -621,23 +2899,54 @@ namespace Bump
         return a.ti < b.ti;
     }
 
-    inline ResponseFunction World::getResponseByName(const std::string &name)
+    World::ResponseEntry &World::addResponseEntry(const std::string &name)
     {
-        auto result = responses.find(name);
-        if (result == responses.end())
+        const ResponseId id = toResponseId(name);
+        if (id == 0)
         {
-            throw Exception::NotFoundError();
+            throw Exception::InvalidArgumentError();
         }
 
-        return result->second;
+        if (id >= responses.size())
+        {
+            responses.resize(id + 1);
+        }
+        responses[id].added = true;
+        return responses[id];
     }
 
-    /// ------------------------------------------
-    /// -- Public Functions
-    /// ------------------------------------------    
+    inline const World::ResponseEntry &World::getResponse(const ResponseId &id) const
+    {
+        if (id >= responses.size() || !responses[id].added)
+        {
+            throw Exception::NotFoundError();
+        }
+
+        return responses[id];
+    }
 
-    void test()
+    Point World::resolve(const ResponseEntry &response, ResponseContext &ctx, Collision &col)
     {
-        World w;
+        if (response.handler)
+        {
+            return response.handler->resolve(ctx, col);
+        }
+
+        switch (response.type)
+        {
+        case FilterType::Touch:
+            return Responses::Touch().resolve(ctx, col);
+        case FilterType::Slide:
+            return Responses::Slide().resolve(ctx, col);
+        case FilterType::Cross:
+            return Responses::Cross().resolve(ctx, col);
+        case FilterType::Bounce:
+            return Responses::Bounce().resolve(ctx, col);
+        case FilterType::OneWay:
+            return Responses::OneWay().resolve(ctx, col);
+        default:
+            assert(false);
+            return col.touch;
+        }
     }
 }
\ No newline at end of file
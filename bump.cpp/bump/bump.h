@@ -1,10 +1,19 @@
 #ifndef BUMP_H_INCLUDED_2E6948B0_55AF_4C64_8BC6_FAE4BA07D63F
 #define BUMP_H_INCLUDED_2E6948B0_55AF_4C64_8BC6_FAE4BA07D63F
+#include <algorithm>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <exception>
 #include <functional>
 #include <map>
+#include <memory>
+#include <string>
 #include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
 namespace Bump
@@ -21,6 +30,17 @@ namespace Bump
     /// ------------------------------------------
     static const double deltaError = 1e-10;
 
+    /// ------------------------------------------
+    /// -- Instrumentation
+    /// ------------------------------------------
+    // Hot-path counters are compiled in only with BUMP_ENABLE_STATS,
+    // otherwise the arguments are not even evaluated
+#ifdef BUMP_ENABLE_STATS
+#define BUMP_STAT(counter, amount) ((counter) += (amount))
+#else
+#define BUMP_STAT(counter, amount) ((void)0)
+#endif
+
     /// ------------------------------------------
     /// -- Exceptions
     /// ------------------------------------------
@@ -28,6 +48,9 @@ namespace Bump
     {
         class ComputationError : public std::exception {};
         class NotFoundError : public std::exception {};
+        class AlreadyExistsError : public std::exception {};
+        class InvalidArgumentError : public std::exception {};
+        class IOError : public std::exception {};
     }
 
     /// ------------------------------------------
@@ -35,7 +58,7 @@ namespace Bump
     /// ------------------------------------------
     enum class FilterType
     {
-        Touch, Slide, Cross, Bounce,
+        Touch, Slide, Cross, Bounce, OneWay,
     };    
 
     /// ------------------------------------------
@@ -55,6 +78,70 @@ namespace Bump
         Number h = 0;
     };
 
+    // Collision layers of an item. Two items only collide when the category of each
+    // shares a bit with the mask of the other.
+    struct Layers
+    {
+        std::uint32_t category = 1;
+        std::uint32_t mask = 0xffffffff;
+
+        bool collidesWith(const Layers &other) const
+        {
+            return (category & other.mask) != 0 && (other.category & mask) != 0;
+        }
+    };
+
+    // Names an item by the World slot holding it: 24 bits of slot index and 8 bits of
+    // slot generation. The generation changes whenever the slot is freed, so a handle
+    // kept past the removal of its item does not name the next item put in the slot.
+    // After maxGeneration reuses the generation wraps around to 1 rather than retiring
+    // the slot, so a handle kept through that many removals of items from its slot
+    // names whichever item holds it then. The zero handle names nothing.
+    struct ItemHandle
+    {
+        static constexpr std::uint32_t indexBits = 24;
+        static constexpr std::uint32_t maxIndex = (1u << indexBits) - 1;
+        static constexpr std::uint32_t maxGeneration = (1u << (32 - indexBits)) - 1;
+
+        std::uint32_t value = 0;
+
+        ItemHandle() = default;
+        ItemHandle(const std::uint32_t &index, const std::uint32_t &generation)
+            : value(generation << indexBits | index)
+        {
+        }
+
+        std::uint32_t getIndex() const
+        {
+            return value & maxIndex;
+        }
+
+        std::uint32_t getGeneration() const
+        {
+            return value >> indexBits;
+        }
+
+        bool operator==(const ItemHandle &other) const
+        {
+            return value == other.value;
+        }
+
+        bool operator!=(const ItemHandle &other) const
+        {
+            return value != other.value;
+        }
+    };
+
+    // Response names as small ids, interned once per distinct name for the life of the
+    // process so that collisions carry 4 bytes instead of a string. 0 is the empty name.
+    using ResponseId = std::uint32_t;
+    ResponseId toResponseId(const std::string &name);
+    // Throws NotFoundError for an id toResponseId never handed out
+    const std::string &toResponseName(const ResponseId &id);
+
+    // What projections report. It keeps plain public fields rather than a compact layout
+    // behind accessors, since responses read and set them (slide, bounce) directly. The
+    // narrow phase works on 32-byte Contacts instead and only expands the ones it reports.
     struct Collision
     {
         Point move;
@@ -67,33 +154,77 @@ namespace Bump
 
         Item item;
         Item other;
+        ResponseId type = 0;    // Response the filter gave
 
         Point slide;
         Point bounce;
+
+        const std::string &getTypeName() const
+        {
+            return toResponseName(type);
+        }
     };
 
+    // What the narrow phase finds, in 32 bytes: a Collision less what the projection
+    // already knows (item, item rect, move) or can look up from other (other rect)
+    struct Contact
+    {
+        Number ti = 0;
+        Point touch;
+        std::uint32_t other = 0;    // Index into whatever the caller tested
+        std::int8_t nx = 0;
+        std::int8_t ny = 0;
+        bool overlaps = false;
+    };
+    static_assert(sizeof(Contact) == 32, "Two contacts per cache line");
+
     struct ItemInfo
     {
-        Item &item;
+        Item item = nullptr;
         Number ti1 = 0;
         Number ti2 = 0;
         Number weight = 0;
+
+        Number x1 = 0;
+        Number y1 = 0;
+        Number x2 = 0;
+        Number y2 = 0;
     };
 
+    // Counters accumulated since the last World::resetStats, usually one frame
+    struct Stats
+    {
+        std::uint64_t cellsVisited = 0;       // Grid cells, tree nodes or sweep entries looked at
+        std::uint64_t candidatesTested = 0;   // Broad phase candidates handed to the narrow phase
+        std::uint64_t narrowPhaseHits = 0;    // Candidates that actually collide or match the query
+        std::uint64_t dedupeRejects = 0;      // Items skipped because they were already seen
+        std::uint64_t responseIterations = 0; // Collisions resolved by World::check
+        std::uint64_t allocations = 0;        // Heap allocations made by containers on the way
+    };
+
+    // Cell of baked static geometry. Its items live in a block of the file's pool
+    // so that the whole grid is a handful of flat arrays.
     struct Cell
     {
-        Number itemCount = 0;
-        Number x = 0;
-        Number y = 0;
-        std::vector<std::reference_wrapper<Item>> items;
+        Index x = 0;
+        Index y = 0;
+        std::uint32_t itemCount = 0;
+        std::uint32_t capacity = 0;     // Size of the pool block
+        std::uint32_t offset = 0;       // First item of the pool block
     };
 
     class World;
+    class StaticGeometry;
+    class Snapshot;
+    class SnapshotWriter;
+    class ConcurrentWorld;
 
     /// ------------------------------------------
     /// -- Aliases
     /// ------------------------------------------
-    using Filter = std::function<bool(const Item &, const Item &)>;
+    // Returns the name of the response to use for the pair, or an empty string to ignore it
+    using Filter = std::function<std::string(const Item &, const Item &)>;
+    using QueryFilter = std::function<bool(const Item &)>;
     using Response = std::tuple<Number, Number, std::vector<Collision>, std::uint32_t>;
     using ResponseFunction = std::function<Response(
         World &world, Collision &col,
@@ -102,20 +233,702 @@ namespace Bump
         const Number &goalX, const Number &goalY,
         const Filter &filter)>;
     using Collisions = std::tuple<std::vector<Collision>, std::uint32_t>;
+    using Movement = std::tuple<Number, Number, std::vector<Collision>, std::uint32_t>;
+    using Items = std::tuple<std::vector<Item>, std::uint32_t>;
+    using ItemInfos = std::tuple<std::vector<ItemInfo>, std::uint32_t>;
+
+    /// ------------------------------------------
+    /// -- Filters
+    /// ------------------------------------------
+    std::string defaultFilter(const Item &item, const Item &other);
+
+    /// ------------------------------------------
+    /// -- Responses
+    /// ------------------------------------------
+    // Move a response resolves a collision of
+    struct ResponseContext
+    {
+        World &world;
+        Number x, y;            // Where the item was when it collided
+        Number w, h;
+        Number goalX, goalY;    // Where it was heading
+        const Filter &filter;
+        // Collisions between the item and the goal resolve returns, resolved next. The
+        // same buffer serves every collision of a move, so it stops allocating once grown.
+        std::vector<Collision> &collisions;
+
+        // Fills collisions with the projection of item from (fromX, fromY) to (toX, toY)
+        void project(
+            const Item &item,
+            const Number &fromX, const Number &fromY,
+            const Number &toX, const Number &toY
+        );
+    };
+
+    // Response registered with World::addResponse. resolve returns the new goal of the
+    // item once col is resolved, and leaves what the item meets on its way there in
+    // ctx.collisions, nothing when it stops. Costs one virtual call per collision.
+    class ResponseHandler
+    {
+    public:
+        virtual ~ResponseHandler() = default;
+
+        virtual Point resolve(ResponseContext &ctx, Collision &col) const = 0;
+    };
+
+    /// ------------------------------------------
+    /// -- Blobs
+    /// ------------------------------------------
+    namespace Blob
+    {
+        constexpr std::uint32_t magic = 0x504d5542;         // "BUMP"
+        constexpr std::uint32_t byteOrder = 0x01020304;     // Reads back differently on a foreign endianness
+        // Layout version of World::serialize, bump it whenever a stored structure changes
+        constexpr std::uint32_t version = 6;
+
+        // How much of a blob World::deserialize checks before restoring it
+        enum class Check
+        {
+            // Header, checksum and backend: catches truncated, damaged and foreign blobs
+            // written by this build, e.g. rollback states kept in memory or on disk
+            Checksum,
+            // Every slot, handle and broad phase link as well, for blobs that may have been
+            // crafted, e.g. received over the network
+            Full,
+        };
+
+        // 64-bit hash World::serialize appends to its blob, fast enough to run at memory speed
+        std::uint64_t checksum(const std::uint8_t *data, const std::size_t &size);
+
+        template<typename T>
+        void write(std::vector<std::uint8_t> &blob, const T &value)
+        {
+            static_assert(std::is_trivially_copyable<T>::value, "Blobs only hold raw bytes");
+
+            const std::size_t size = blob.size();
+            blob.resize(size + sizeof(T));
+            std::memcpy(blob.data() + size, &value, sizeof(T));
+        }
+
+        template<typename T>
+        void writeArray(std::vector<std::uint8_t> &blob, const std::vector<T> &values)
+        {
+            static_assert(std::is_trivially_copyable<T>::value, "Blobs only hold raw bytes");
+
+            write(blob, static_cast<std::uint64_t>(values.size()));
+            const std::size_t size = blob.size();
+            blob.resize(size + values.size() * sizeof(T));
+            if (!values.empty())
+            {
+                std::memcpy(blob.data() + size, values.data(), values.size() * sizeof(T));
+            }
+        }
+
+        // Reads back what write and writeArray stored. Throws InvalidArgumentError
+        // instead of reading past the end of a truncated blob.
+        class Reader
+        {
+        public:
+            Reader(const std::uint8_t *data, const std::size_t &size) : cursor(data), end(data + size)
+            {
+            }
+
+            template<typename T>
+            T read()
+            {
+                static_assert(std::is_trivially_copyable<T>::value, "Blobs only hold raw bytes");
+
+                T value;
+                std::memcpy(&value, take(sizeof(T)), sizeof(T));
+                return value;
+            }
+
+            template<typename T>
+            void readArray(std::vector<T> &values)
+            {
+                static_assert(std::is_trivially_copyable<T>::value, "Blobs only hold raw bytes");
+
+                const std::uint64_t count = read<std::uint64_t>();
+                if (count > static_cast<std::uint64_t>(end - cursor) / sizeof(T))
+                {
+                    throw Exception::InvalidArgumentError();
+                }
+
+                values.resize(static_cast<std::size_t>(count));
+                if (count > 0)
+                {
+                    std::memcpy(values.data(), take(values.size() * sizeof(T)), values.size() * sizeof(T));
+                }
+            }
+
+            template<typename T>
+            void skipArray()
+            {
+                const std::uint64_t count = read<std::uint64_t>();
+                if (count > static_cast<std::uint64_t>(end - cursor) / sizeof(T))
+                {
+                    throw Exception::InvalidArgumentError();
+                }
+                take(static_cast<std::size_t>(count) * sizeof(T));
+            }
+
+            bool atEnd() const
+            {
+                return cursor == end;
+            }
+
+        private:
+            const std::uint8_t *take(const std::size_t &size)
+            {
+                if (static_cast<std::size_t>(end - cursor) < size)
+                {
+                    throw Exception::InvalidArgumentError();
+                }
+
+                const std::uint8_t *data = cursor;
+                cursor += size;
+                return data;
+            }
+
+        private:
+            const std::uint8_t *cursor;
+            const std::uint8_t *end;
+        };
+    }
+
+    /// ------------------------------------------
+    /// -- Flat map
+    /// ------------------------------------------
+
+    // Open addressing hash map with linear probing over one flat array of slots.
+    // Keys and values must be trivially copyable, and Key() marks an empty slot,
+    // so the whole table can be saved and restored as a single block of bytes.
+    template<typename Key, typename Value>
+    class FlatMap
+    {
+        static_assert(std::is_trivially_copyable<Key>::value && sizeof(Key) <= sizeof(std::uint64_t),
+            "FlatMap keys are hashed as raw integers");
+        static_assert(std::is_trivially_copyable<Value>::value, "FlatMap slots are copied as raw bytes");
+
+    public:
+        struct Slot
+        {
+            Key first;
+            Value second;
+        };
+
+        template<typename SlotType>
+        class Iterator
+        {
+        public:
+            Iterator(SlotType *slot, SlotType *end) : slot(slot), end(end)
+            {
+                skip();
+            }
+
+            SlotType &operator*() const
+            {
+                return *slot;
+            }
+
+            SlotType *operator->() const
+            {
+                return slot;
+            }
+
+            Iterator &operator++()
+            {
+                slot++;
+                skip();
+                return *this;
+            }
+
+            bool operator==(const Iterator &other) const
+            {
+                return slot == other.slot;
+            }
+
+            bool operator!=(const Iterator &other) const
+            {
+                return slot != other.slot;
+            }
+
+        private:
+            void skip()
+            {
+                while (slot != end && slot->first == Key())
+                {
+                    slot++;
+                }
+            }
+
+        private:
+            friend class FlatMap;
+
+            SlotType *slot;
+            SlotType *end;
+        };
+
+        using iterator = Iterator<Slot>;
+        using const_iterator = Iterator<const Slot>;
+
+    public:
+        iterator begin()
+        {
+            return iterator(slots.data(), slots.data() + slots.size());
+        }
+
+        iterator end()
+        {
+            return iterator(slots.data() + slots.size(), slots.data() + slots.size());
+        }
+
+        const_iterator begin() const
+        {
+            return const_iterator(slots.data(), slots.data() + slots.size());
+        }
+
+        const_iterator end() const
+        {
+            return const_iterator(slots.data() + slots.size(), slots.data() + slots.size());
+        }
+
+        std::size_t size() const
+        {
+            return count;
+        }
+
+        bool empty() const
+        {
+            return count == 0;
+        }
+
+        iterator find(const Key &key)
+        {
+            const std::size_t index = lookup(key);
+            return index == npos ? end() : iterator(slots.data() + index, slots.data() + slots.size());
+        }
+
+        const_iterator find(const Key &key) const
+        {
+            const std::size_t index = lookup(key);
+            return index == npos ? end() : const_iterator(slots.data() + index, slots.data() + slots.size());
+        }
+
+        Value &at(const Key &key)
+        {
+            const std::size_t index = lookup(key);
+            if (index == npos)
+            {
+                throw Exception::NotFoundError();
+            }
+            return slots[index].second;
+        }
+
+        const Value &at(const Key &key) const
+        {
+            const std::size_t index = lookup(key);
+            if (index == npos)
+            {
+                throw Exception::NotFoundError();
+            }
+            return slots[index].second;
+        }
+
+        Value &operator[](const Key &key)
+        {
+            return insert(key, Value()).first->second;
+        }
+
+        // Leaves the value alone when the key is already there, like std::unordered_map::insert
+        std::pair<iterator, bool> insert(const Key &key, const Value &value)
+        {
+            if (key == Key())
+            {
+                throw Exception::InvalidArgumentError();
+            }
+
+            if (isFull())
+            {
+                rehash(slots.empty() ? 16 : slots.size() * 2);
+            }
+
+            const std::size_t mask = slots.size() - 1;
+            std::size_t index = hash(key) & mask;
+            while (!(slots[index].first == Key()))
+            {
+                if (slots[index].first == key)
+                {
+                    return { iterator(slots.data() + index, slots.data() + slots.size()), false };
+                }
+                index = (index + 1) & mask;
+            }
+
+            slots[index].first = key;
+            slots[index].second = value;
+            count++;
+            return { iterator(slots.data() + index, slots.data() + slots.size()), true };
+        }
+
+        void erase(const iterator &position)
+        {
+            // Backward shift deletion: pull later entries of the probe run into the hole
+            const std::size_t mask = slots.size() - 1;
+            std::size_t hole = static_cast<std::size_t>(position.slot - slots.data());
+            std::size_t next = (hole + 1) & mask;
+
+            while (!(slots[next].first == Key()))
+            {
+                const std::size_t home = hash(slots[next].first) & mask;
+                if (((next - home) & mask) >= ((next - hole) & mask))
+                {
+                    slots[hole] = slots[next];
+                    hole = next;
+                }
+                next = (next + 1) & mask;
+            }
+
+            slots[hole] = Slot();
+            count--;
+        }
+
+        std::size_t erase(const Key &key)
+        {
+            auto found = find(key);
+            if (found == end())
+            {
+                return 0;
+            }
+            erase(found);
+            return 1;
+        }
+
+        // Keeps the slots allocated
+        void clear()
+        {
+            std::fill(slots.begin(), slots.end(), Slot());
+            count = 0;
+        }
+
+        // Whether size keys fit without rehashing into a bigger table, which allocates
+        bool fits(const std::size_t &size) const
+        {
+            return size * 8 <= slots.size() * 7;
+        }
+
+        // Whether the next insert rehashes
+        bool isFull() const
+        {
+            return !fits(count + 1);
+        }
+
+        void reserve(const std::size_t &size)
+        {
+            std::size_t capacity = slots.empty() ? 16 : slots.size();
+            while (size * 8 > capacity * 7)
+            {
+                capacity *= 2;
+            }
+            if (capacity > slots.size())
+            {
+                rehash(capacity);
+            }
+        }
+
+        // Finds key in slots laid out by a FlatMap of the given power of two capacity,
+        // e.g. ones mapped from a file. Returns nullptr when it is not there.
+        static const Slot *probe(const Slot *slots, const std::size_t &capacity, const Key &key)
+        {
+            if (capacity == 0 || key == Key())
+            {
+                return nullptr;
+            }
+
+            const std::size_t mask = capacity - 1;
+            std::size_t index = hash(key) & mask;
+            while (!(slots[index].first == Key()))
+            {
+                if (slots[index].first == key)
+                {
+                    return slots + index;
+                }
+                index = (index + 1) & mask;
+            }
+            return nullptr;
+        }
+
+        const std::vector<Slot> &getSlots() const
+        {
+            return slots;
+        }
+
+        void save(std::vector<std::uint8_t> &blob) const
+        {
+            Blob::write(blob, static_cast<std::uint64_t>(count));
+            Blob::writeArray(blob, slots);
+        }
+
+        // Slots land exactly where they were: restoring is a single copy, no rehashing.
+        // Only the table size is checked here, isValid scans the slots of untrusted blobs.
+        // The map is left empty when the slots are not a valid table.
+        void load(Blob::Reader &reader)
+        {
+            const std::uint64_t loadedCount = reader.read<std::uint64_t>();
+            count = 0;
+            reader.readArray(slots);
+
+            if ((slots.size() & (slots.size() - 1)) != 0 || loadedCount > slots.size())
+            {
+                slots.clear();
+                throw Exception::InvalidArgumentError();
+            }
+            count = static_cast<std::size_t>(loadedCount);
+        }
+
+        static void skip(Blob::Reader &reader)
+        {
+            reader.read<std::uint64_t>();
+            reader.skipArray<Slot>();
+        }
+
+        // Whether the loaded count matches the slots in use, and probing still ends
+        bool isValid() const
+        {
+            std::size_t used = 0;
+            for (const Slot &slot : slots)
+            {
+                used += !(slot.first == Key());
+            }
+
+            // Probing stops at the first empty slot, so a full table would never end a miss
+            return used == count && (slots.empty() || used < slots.size());
+        }
+
+    private:
+        static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+        static std::size_t hash(const Key &key)
+        {
+            std::uint64_t value = 0;
+            std::memcpy(&value, &key, sizeof(Key));
+
+            // splitmix64 finalizer, pointers and packed cell coordinates have weak low bits
+            value ^= value >> 30;
+            value *= 0xbf58476d1ce4e5b9ull;
+            value ^= value >> 27;
+            value *= 0x94d049bb133111ebull;
+            value ^= value >> 31;
+            return static_cast<std::size_t>(value);
+        }
+
+        std::size_t lookup(const Key &key) const
+        {
+            const Slot *slot = probe(slots.data(), slots.size(), key);
+            return slot == nullptr ? npos : static_cast<std::size_t>(slot - slots.data());
+        }
+
+        void rehash(const std::size_t &capacity)
+        {
+            std::vector<Slot> old(capacity);
+            old.swap(slots);
+
+            const std::size_t mask = capacity - 1;
+            for (const Slot &slot : old)
+            {
+                if (slot.first == Key())
+                {
+                    continue;
+                }
+
+                std::size_t index = hash(slot.first) & mask;
+                while (!(slots[index].first == Key()))
+                {
+                    index = (index + 1) & mask;
+                }
+                slots[index] = slot;
+            }
+        }
+
+    private:
+        std::vector<Slot> slots;
+        std::size_t count = 0;
+    };
 
     /// ------------------------------------------
     /// -- Classes
     /// ------------------------------------------
+
+    // Spatial index behind a World. The world keeps the authoritative rects and
+    // runs the narrow phase, so a backend only has to return candidates: the handle
+    // of every item whose rect may touch the query, each one once. False positives are fine.
+    class BroadPhase
+    {
+    public:
+        virtual ~BroadPhase() = default;
+
+        virtual void add(const ItemHandle &item, const Rectangle &rect) = 0;
+        virtual void remove(const ItemHandle &item, const Rectangle &rect) = 0;
+        virtual void update(const ItemHandle &item, const Rectangle &from, const Rectangle &to) = 0;
+
+        // Same as add for every items[i] / rects[i], all of them new. Backends that can
+        // build their index in one go override it, threads is a hint they may ignore.
+        virtual void addMany(
+            const std::vector<ItemHandle> &items,
+            const std::vector<Rectangle> &rects,
+            const std::size_t &threads
+        );
+        // Same as remove for every items[i] / rects[i]
+        virtual void removeMany(const std::vector<ItemHandle> &items, const std::vector<Rectangle> &rects);
+        // Same as update for every items[i] from froms[i] to tos[i], threads is a hint again
+        virtual void updateMany(
+            const std::vector<ItemHandle> &items,
+            const std::vector<Rectangle> &froms,
+            const std::vector<Rectangle> &tos,
+            const std::size_t &threads
+        );
+        // Removes every item, keeping the storage for the next ones
+        virtual void clear() = 0;
+
+        virtual void queryRect(const Rectangle &rect, std::vector<ItemHandle> &items) const = 0;
+        virtual void queryPoint(const Number &x, const Number &y, std::vector<ItemHandle> &items) const = 0;
+        virtual void querySegment(
+            const Number &x1, const Number &y1,
+            const Number &x2, const Number &y2,
+            std::vector<ItemHandle> &items
+        ) const = 0;
+
+        // Cells for grids, nodes for trees
+        virtual std::size_t countCells() const = 0;
+
+        // Appends the whole index to blob / restores it from the rest of reader.
+        // Loading throws InvalidArgumentError, leaving the index untouched, unless the blob
+        // was written by the same backend. Without generations the blob is trusted and read
+        // straight into the index. With them, generations[i] being the generation of the item
+        // in slot i or 0 for a free slot, it is read aside and only swapped in once every link
+        // checks out and it only holds handles of those items.
+        virtual void save(std::vector<std::uint8_t> &blob) const = 0;
+        virtual void load(Blob::Reader &reader, const std::vector<std::uint8_t> *generations) = 0;
+
+    protected:
+        // Counters of the World that owns the backend, null while it is used on its own.
+        // Only updated when built with BUMP_ENABLE_STATS
+        Stats *stats = nullptr;
+
+        // Whether item is the live item of its slot for load
+        static bool isLive(const ItemHandle &item, const std::vector<std::uint8_t> &generations)
+        {
+            return item.getGeneration() != 0 && item.getIndex() < generations.size()
+                && generations[item.getIndex()] == item.getGeneration();
+        }
+
+        friend class World;
+    };
+
+    // Items and their rects over a broad phase, with the narrow phase and responses on top.
+    // Const queries are not thread-safe: they update scratch state shared by every query,
+    // such as the grid's visit stamps, the pending sort of sweep and prune and the stats.
+    // Query a World from one thread at a time, or query its snapshots or a ConcurrentWorld.
     class World
     {
     public:
-        World(const Number &cellSize = 64);
-        ~World() = default;
+        // levels > 1 turns the grid into a hierarchy: level k uses cells of
+        // cellSize * 2^k, and every item lives in the finest level whose cells
+        // are at least as large as the item (the last level takes the rest).
+        World(const Number &cellSize = 64, const Index &levels = 1);
+        // cellSize is used by toWorld and toCell, and as the sub-sweep length of
+        // moveSubstepped, which is a tuning parameter here: about the size of the items
+        // the moves may hit is a good start
+        explicit World(std::unique_ptr<BroadPhase> broadPhase, const Number &cellSize = 64);
+        ~World();
 
         World(const World &a) = delete;
         World &operator=(const World &a) = delete;
 
-        World(World &&a) = default;
+        World(World &&a);
+
+        void add(
+            const Item &item,
+            const Number &x, const Number &y,
+            const Number &w, const Number &h
+        );
+
+        // Same as calling add for every items[i] / rects[i], but the broad phase indexes
+        // them all in one go, on up to threads threads, instead of one at a time. Throws
+        // like add, and InvalidArgumentError when the sizes differ or an item is listed
+        // twice. Nothing is added then.
+        void addBulk(
+            const std::vector<Item> &items,
+            const std::vector<Rectangle> &rects,
+            const std::size_t &threads = 1
+        );
+
+        void remove(const Item &item);
+
+        // Same as calling remove for every item, with the broad phase visiting each of
+        // their cells once. Throws like remove, and InvalidArgumentError when an item
+        // is listed twice. Nothing is removed then.
+        void removeMany(const std::vector<Item> &items);
+
+        // Removes every dynamic item, static geometry stays. Slots, handle table and
+        // broad phase keep their storage, so refilling the world does not allocate
+        // again, and every handle handed out so far turns stale.
+        void clear();
+
+        void update(const Item &item, const Number &x, const Number &y);
+
+        void update(
+            const Item &item,
+            const Number &x, const Number &y,
+            const Number &w, const Number &h
+        );
+
+        // With deferred updates, update only stores the new rect and marks the item dirty.
+        // The broad phase catches up with every dirty item in one batch, on up to threads
+        // threads, before the next query or on flush, so an item updated several times in
+        // between moves through it once. Turning them off flushes.
+        // The first query after an update rewrites the broad phase from inside a const
+        // method, so while updates are deferred that query is a write like update itself,
+        // and not thread-safe even apart from the scratch state every query shares.
+        // Calling flush first keeps the cost of catching up out of the query.
+        void setDeferredUpdates(const bool &deferred, const std::size_t &threads = 1);
+        void flush();
+
+        Movement move(
+            const Item &item,
+            const Number &goalX, const Number &goalY,
+            const Filter &filter = defaultFilter
+        );
+
+        // Same result as move, for fast items crossing many cells. The sweep is split
+        // into sub-sweeps of at most cellSize, and only the cells of that size each one
+        // adds are queried, so the broad phase visits the corridor the item actually
+        // crosses instead of the bounding box of the whole move, and stops at the first
+        // hit. Responses re-projecting from the hit are substepped the same way. With
+        // a grid, cellSize is its finest cell size; see the constructors for the others.
+        Movement moveSubstepped(
+            const Item &item,
+            const Number &goalX, const Number &goalY,
+            const Filter &filter = defaultFilter
+        );
+
+        // Moves every items[i] towards goals[i] within one tick, as if they all moved at
+        // once: impacts are resolved in time order over all of them, and two items that
+        // both move collide where their paths actually meet, whatever their order in
+        // items. Returns the movement of items[i] at i. Throws InvalidArgumentError when
+        // the sizes differ or an item is listed twice. A lone mover ends up where move
+        // takes it, except after a cross following another response: cross goes on from
+        // where the move started in move, as in bump.lua, and from the impact here.
+        std::vector<Movement> moveMany(
+            const std::vector<Item> &items,
+            const std::vector<Point> &goals,
+            const Filter &filter = defaultFilter
+        );
+
+        Movement check(
+            const Item &item,
+            const Number &goalX, const Number &goalY,
+            const Filter &filter = defaultFilter
+        );
 
         Collisions project(
             const Item &item,
@@ -124,24 +937,279 @@ namespace Bump
             const Number &goalX, const Number &goalY,
             const Filter &filter
         );
+        // Same as project, into collisions, reusing their storage. Returns their count.
+        std::uint32_t project(
+            const Item &item,
+            const Number &x, const Number &y,
+            const Number &w, const Number &h,
+            const Number &goalX, const Number &goalY,
+            const Filter &filter,
+            std::vector<Collision> &collisions
+        );
+
+        Items queryRect(
+            const Number &x, const Number &y,
+            const Number &w, const Number &h,
+            const QueryFilter &filter = nullptr
+        ) const;
+
+        Items queryPoint(
+            const Number &x, const Number &y,
+            const QueryFilter &filter = nullptr
+        ) const;
+
+        Items querySegment(
+            const Number &x1, const Number &y1,
+            const Number &x2, const Number &y2,
+            const QueryFilter &filter = nullptr
+        ) const;
+
+        ItemInfos querySegmentWithCoords(
+            const Number &x1, const Number &y1,
+            const Number &x2, const Number &y2,
+            const QueryFilter &filter = nullptr
+        ) const;
+
+        bool hasItem(const Item &item) const;
+        std::vector<Item> getItems() const;
+        std::size_t countItems() const;
+        std::size_t countCells() const;
+
+        std::tuple<Number, Number, Number, Number> getRect(const Item &item) const;
+
+        // Pairs whose layers do not collide are skipped by move, check, project and
+        // moveMany before the filter is called. Items start in category 1 with every
+        // mask bit set, baked items keep those. Throws NotFoundError for unknown items.
+        void setLayers(const Item &item, const Layers &layers);
+        Layers getLayers(const Item &item) const;
+
+        // Handles name items by their slot, so the calls taking one index an array instead
+        // of hashing the item. Baked items have no handle, getHandle throws NotFoundError
+        // for them as for unknown items. The other calls throw it for stale handles,
+        // whose item was removed, which hasHandle tells apart in O(1).
+        ItemHandle getHandle(const Item &item) const;
+        bool hasHandle(const ItemHandle &handle) const;
+        Item getItem(const ItemHandle &handle) const;
+
+        std::tuple<Number, Number, Number, Number> getRect(const ItemHandle &handle) const;
+
+        void update(const ItemHandle &handle, const Number &x, const Number &y);
+
+        void update(
+            const ItemHandle &handle,
+            const Number &x, const Number &y,
+            const Number &w, const Number &h
+        );
+
+        const Stats &getStats() const;
+        void resetStats();
+
+        // Snapshot of the rects and the broad phase as a flat, versioned blob. Items are
+        // stored as their raw values, so restore a blob in a process where they still mean
+        // the same thing (handles or ids rather than pointers when going across processes).
+        // Restoring copies the arrays back as they are, nothing gets re-inserted.
+        void serialize(std::vector<std::uint8_t> &blob) const;
+        // Static geometry is not part of the blob.
+        // Throws InvalidArgumentError for a foreign, truncated or damaged blob, or one
+        // written by a different broad phase backend, leaving the world untouched. By
+        // default the blob is then copied straight over the world's own storage, so only
+        // pass blobs this build wrote. Check::Full also rejects blobs whose slots, handles
+        // and broad phase disagree, at the price of reading into fresh storage and a few
+        // passes over it.
+        void deserialize(const std::vector<std::uint8_t> &blob, const Blob::Check &check = Blob::Check::Checksum);
+
+        std::tuple<Number, Number> toWorld(const Number &cx, const Number &cy) const;
+        std::tuple<Number, Number> toCell(const Number &x, const Number &y) const;
 
         void addResponse(const std::string &name, const ResponseFunction &handler);
+        void addResponse(const std::string &name, std::unique_ptr<ResponseHandler> handler);
+
+        // Serves the baked items next to the dynamic ones: they are queried, collided
+        // with and reported by getRect, hasItem, getItems and countItems, but cannot be
+        // updated or removed. Throws AlreadyExistsError when a dynamic item is also baked.
+        void setStaticGeometry(std::shared_ptr<const StaticGeometry> geometry);
+
+        // Immutable view of the world as it is now, which other threads can query
+        // without locks while this one keeps changing the world. The first call
+        // builds the paged mirror snapshots are made of; from then on add, update
+        // and remove keep it current, copying only the pages a live snapshot shares.
+        std::shared_ptr<const Snapshot> snapshot();
 
     private:
-        void addItemToCell(const Item &item, const Number &cx, const Number &cy);
+        friend class ConcurrentWorld;
+
+        // Side table entry of an item, free while item is nullptr
+        struct Slot
+        {
+            Item item = nullptr;
+            Rectangle rect;
+            std::uint32_t generation = 1;
+            Layers layers;
+
+            // Frees the slot under its next generation, wrapping from maxGeneration to 1.
+            // The next item starts with the default layers.
+            void release()
+            {
+                const std::uint32_t nextGeneration = generation % ItemHandle::maxGeneration + 1;
+                std::tie(item, rect, generation, layers) = std::make_tuple(nullptr, Rectangle(), nextGeneration, Layers());
+            }
+        };
+
+        // Item updated while deferring, from the rect the broad phase still holds
+        struct DirtyItem
+        {
+            std::uint32_t slot = 0;
+            Rectangle from;
+        };
+
+        // Item returned by a query, with the slot holding it or bakedSlot
+        struct Candidate
+        {
+            Item item = nullptr;
+            std::uint32_t slot = 0;
+        };
+
+        static constexpr std::uint32_t bakedSlot = ItemHandle::maxIndex + 1;
+
+        // Dynamic or static rect of item, throws NotFoundError for unknown items
+        const Rectangle &getItemRect(const Item &item) const;
+        const Rectangle &getCandidateRect(const Candidate &candidate) const;
+        // Layers of item, the default ones for baked and unknown items
+        Layers getItemLayers(const Item &item) const;
+        const Layers &getCandidateLayers(const Candidate &candidate) const;
+
+        // Slot index of handle, throws NotFoundError for stale handles
+        std::uint32_t getSlot(const ItemHandle &handle) const;
+        void updateSlot(const std::uint32_t &slot, const Rectangle &rect);
+        // Hands every dirty item to the broad phase. Const because queries call it
+        void flushUpdates() const;
+        void dropUpdates();
+        // deserialize with Check::Full, reader being past the header
+        void deserializeChecked(Blob::Reader &reader);
+
+        // Runs query against the broad phase and the static geometry and appends what
+        // both return
+        template<typename Query>
+        void gatherCandidates(const Query &query, std::vector<Candidate> &candidates) const;
+
+        // Only returns the collisions found before the first hit was known to be final,
+        // which is all check needs
+        void projectSubstepped(
+            const Item &item,
+            const Number &x, const Number &y,
+            const Number &w, const Number &h,
+            const Number &goalX, const Number &goalY,
+            const Filter &filter,
+            std::vector<Collision> &collisions
+        );
+
+        struct Mover;
+
+        // Earliest impact of mover from time on, against everything else. target is set to
+        // the index of the mover hit, or to the mover count for anything else. indices
+        // maps slots to movers
+        bool findImpact(
+            const Mover &mover,
+            const Number &time,
+            const std::vector<Mover> &movers,
+            const std::vector<std::size_t> &indices,
+            const Filter &filter,
+            Collision &impact,
+            std::size_t &target
+        );
+
+        // Runs the response of mover to impact at time and sets the rest of its tick
+        void respond(Mover &mover, const Number &time, Collision &impact, const Filter &filter);
+
+        // Narrow phase over candidates from first on. Contacts index candidates, and the
+        // response names the filter gave go to types alongside
+        void detectContacts(
+            const Item &item,
+            const Number &x, const Number &y,
+            const Number &w, const Number &h,
+            const Number &goalX, const Number &goalY,
+            const Filter &filter,
+            const std::vector<Candidate> &candidates,
+            const std::size_t &first,
+            std::vector<Contact> &contacts,
+            std::vector<ResponseId> &types
+        );
+
+        // Sorts contacts like sortByTiAndDistance and only then expands them into collisions
+        void toCollisions(
+            const Item &item,
+            const Number &x, const Number &y,
+            const Number &w, const Number &h,
+            const Number &goalX, const Number &goalY,
+            const std::vector<Candidate> &candidates,
+            const std::vector<Contact> &contacts,
+            std::vector<ResponseId> &types,
+            std::vector<Collision> &collisions
+        ) const;
+        // project against others[i] at rects[i], rects kept outside of any World, through
+        // the same narrow phase and sort. ConcurrentWorld projects with it.
+        static void projectAgainst(
+            const Item &item,
+            const Number &x, const Number &y,
+            const Number &w, const Number &h,
+            const Number &goalX, const Number &goalY,
+            const Filter &filter,
+            const std::vector<Item> &others,
+            const std::vector<Rectangle> &rects,
+            std::vector<Collision> &collisions
+        );
+
+        ItemInfos getInfoAboutItemsTouchedBySegment(
+            const Number &x1, const Number &y1,
+            const Number &x2, const Number &y2,
+            const QueryFilter &filter
+        ) const;
 
         static bool sortByWeight(const ItemInfo &a, const ItemInfo &b);
         static bool sortByTiAndDistance(const Collision &a, const Collision &b);  
-        inline ResponseFunction getResponseByName(const std::string &name);
+        // Built-in responses have no handler and are called directly
+        struct ResponseEntry
+        {
+            bool added = false;
+            FilterType type = FilterType::Touch;
+            std::unique_ptr<ResponseHandler> handler;
+        };
+
+        ResponseEntry &addResponseEntry(const std::string &name);
+        // Throws NotFoundError for responses the world does not know
+        inline const ResponseEntry &getResponse(const ResponseId &id) const;
+        static Point resolve(const ResponseEntry &response, ResponseContext &ctx, Collision &col);
 
     private:
         Number cellSize;
-        std::vector<std::vector<Cell>> rows;
-        std::vector<Rectangle> rects;
+        std::unique_ptr<BroadPhase> broadPhase;
+        // On the heap, so that the broad phase's pointer to it survives moving the world
+        std::unique_ptr<Stats> stats;
+        std::vector<Slot> slots;
+        std::vector<std::uint32_t> freeSlots;
+        FlatMap<Item, ItemHandle> handles;
+        std::shared_ptr<const StaticGeometry> staticGeometry;
+        std::unique_ptr<SnapshotWriter> snapshots;
+        bool substepping = false;
+        Mover *batching = nullptr;     // Mover whose response moveMany is running
+
+        // Flushing is deferred to the next query, hence mutable
+        bool deferring = false;
+        std::size_t flushThreads = 1;
+        mutable std::vector<DirtyItem> dirtyItems;
+        mutable std::vector<bool> dirtySlots;
+
+        // What gatherCandidates collects from the broad phase and the static geometry,
+        // kept so that queries stop allocating once they have grown
+        mutable std::vector<ItemHandle> gatheredHandles;
+        mutable std::vector<Item> gatheredBaked;
 
-        std::map<Cell*, bool> nonEmptyCells;
+        // Indexed by ResponseId
+        std::vector<ResponseEntry> responses;
 
-        std::map<std::string, ResponseFunction> responses;
+        // Scratch for checking untrusted blobs in deserialize, kept between restores
+        std::vector<std::uint8_t> loadGenerations;
+        std::vector<bool> loadListed;
     };
 
     /// ------------------------------------------
@@ -157,9 +1225,9 @@ namespace Bump
 
         // This is a generalized implementation of the liang - barsky algorithm, which also returns
         // the normals of the sides where the segment intersects.
-        // Returns nil if the segment never touches the rect
+        // The first value is false if the segment never touches the rect
         // Notice that normals are only guaranteed to be accurate when initially ti1, ti2 == -math.huge, math.huge
-        std::tuple<Number, Number, Number, Number, Number, Number>
+        std::tuple<bool, Number, Number, Number, Number, Number, Number>
             getSegmentIntersectionIndices(
                 const Number &x, const Number &y,
                 const Number &w, const Number &h,
@@ -196,7 +1264,18 @@ namespace Bump
             const Number &w2, const Number &h2
         );
 
-        Collision detectCollision(
+        // Fills everything in contact but other. Returns false if the rects never collide
+        bool detectContact(
+            const Number &x1, const Number &y1,
+            const Number &w1, const Number &h1,
+            const Number &x2, const Number &y2,
+            const Number &w2, const Number &h2,
+            const Number &goalX, const Number &goalY,
+            Contact &contact
+        );
+
+        // The first value is false if the rects never collide
+        std::tuple<bool, Collision> detectCollision(
             const Number &x1, const Number &y1,
             const Number &w1, const Number &h1,
             const Number &x2, const Number &y2,
@@ -204,16 +1283,112 @@ namespace Bump
             const Number &goalX, const Number &goalY
         );
 
-        Collision detectCollision(
+        std::tuple<bool, Collision> detectCollision(
             const Number &x1, const Number &y1,
             const Number &w1, const Number &h1,
             const Number &x2, const Number &y2,
             const Number &w2, const Number &h2
         );
+
+        // Both rects move during the same tick: the sweep runs in the frame of other,
+        // and ti is the fraction of the tick both have covered at the impact. touch and
+        // otherRect are where each one is at that point, overlaps are resolved as of
+        // the start of the tick.
+        std::tuple<bool, Collision> detectCollision(
+            const Number &x1, const Number &y1,
+            const Number &w1, const Number &h1,
+            const Number &goalX1, const Number &goalY1,
+            const Number &x2, const Number &y2,
+            const Number &w2, const Number &h2,
+            const Number &goalX2, const Number &goalY2
+        );
+
+        // Segment queries in one call: whether the segment goes through the rect, its ti1
+        // and ti2 within the segment and the weight items are sorted by
+        std::tuple<bool, Number, Number, Number> getSegmentTouch(
+            const Number &x, const Number &y,
+            const Number &w, const Number &h,
+            const Number &x1, const Number &y1,
+            const Number &x2, const Number &y2
+        );
+    }
+
+    namespace Grid
+    {
+        std::tuple<Number, Number> toWorld(
+            const Number &cellSize,
+            const Number &cx, const Number &cy
+        );
+
+        std::tuple<Number, Number> toCell(
+            const Number &cellSize,
+            const Number &x, const Number &y
+        );
+
+        void traverse(
+            const Number &cellSize,
+            const Number &x1, const Number &y1,
+            const Number &x2, const Number &y2,
+            const std::function<void(const Number &, const Number &)> &f
+        );
+
+        std::tuple<Number, Number, Number, Number> toCellRect(
+            const Number &cellSize,
+            const Number &x, const Number &y,
+            const Number &w, const Number &h
+        );
+
+        // toCellRect for count rects at once, as integers: left and top are the first cells,
+        // right and bottom one past the last ones. Four rects per step when built with AVX
+        // (BUMP_NATIVE=ON), one at a time otherwise.
+        void toCellRects(
+            const Number &cellSize,
+            const Rectangle *rects, const std::size_t &count,
+            Index *left, Index *top, Index *right, Index *bottom
+        );
+
+        // Packs integral cell coordinates into a FlatMap key. Never the empty key
+        // except for cell (INT32_MIN, INT32_MIN).
+        std::uint64_t toCellKey(const Number &cx, const Number &cy);
     }
 
     namespace Responses
     {
+        // The built-in responses. They are final, so World calls them without a virtual call.
+        class Touch final : public ResponseHandler
+        {
+        public:
+            Point resolve(ResponseContext &ctx, Collision &col) const override;
+        };
+
+        class Cross final : public ResponseHandler
+        {
+        public:
+            Point resolve(ResponseContext &ctx, Collision &col) const override;
+        };
+
+        class Slide final : public ResponseHandler
+        {
+        public:
+            Point resolve(ResponseContext &ctx, Collision &col) const override;
+        };
+
+        class Bounce final : public ResponseHandler
+        {
+        public:
+            Point resolve(ResponseContext &ctx, Collision &col) const override;
+        };
+
+        // One-way platform: slides along the other item when landing on its top side
+        // (normal (0, -1)), crosses it from any other side or when they already overlap.
+        // Crossing goes on from the contact, so move and moveMany agree.
+        class OneWay final : public ResponseHandler
+        {
+        public:
+            Point resolve(ResponseContext &ctx, Collision &col) const override;
+        };
+
+        // The same responses as ResponseFunctions
         Response touch(
             World &world, Collision &col,
             const Number &x, const Number &y,
@@ -245,9 +1420,27 @@ namespace Bump
             const Number &goalX, const Number &goalY,
             const Filter &filter
         );
-    }    
 
-    void test();
+        Response oneWay(
+            World &world, Collision &col,
+            const Number &x, const Number &y,
+            const Number &w, const Number &h,
+            const Number &goalX, const Number &goalY,
+            const Filter &filter
+        );
+    }
+}
+
+namespace std
+{
+    template<>
+    struct hash<Bump::ItemHandle>
+    {
+        std::size_t operator()(const Bump::ItemHandle &handle) const
+        {
+            return std::hash<std::uint32_t>()(handle.value);
+        }
+    };
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,553 @@
+#include "concurrent.h"
+#include "trace.h"
+
+#include <mutex>
+
+namespace Bump
+{
+    /// ------------------------------------------
+    /// -- Auxiliary functions
+    /// ------------------------------------------
+    namespace
+    {
+        struct CellRange
+        {
+            Number left = 0;
+            Number top = 0;
+            Number right = 0;   // Exclusive
+            Number bottom = 0;  // Exclusive
+        };
+
+        CellRange toCellRange(const Number &cellSize, const Rectangle &rect)
+        {
+            Number cl, ct, cw, ch;
+            std::tie(cl, ct, cw, ch) = Grid::toCellRect(cellSize, rect.x, rect.y, rect.w, rect.h);
+            return CellRange{ cl, ct, cl + cw, ct + ch };
+        }
+
+        bool contains(const CellRange &range, const Number &cx, const Number &cy)
+        {
+            return range.left <= cx && cx < range.right && range.top <= cy && cy < range.bottom;
+        }
+
+        bool isSameRect(const Rectangle &a, const Rectangle &b)
+        {
+            return a.x == b.x && a.y == b.y && a.w == b.w && a.h == b.h;
+        }
+
+        std::size_t toStripe(const std::uint64_t &key)
+        {
+            // Fibonacci hashing, neighbouring cells and pointers land on different stripes
+            return static_cast<std::size_t>((key * 0x9e3779b97f4a7c15ull) >> 40) % ConcurrentWorld::stripeCount;
+        }
+
+        std::size_t toStripe(const Item &item)
+        {
+            return toStripe(static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(item)));
+        }
+
+        void eraseEntry(std::vector<Stripes::Entry> &entries, const Item &item)
+        {
+            auto found = std::find_if(entries.begin(), entries.end(),
+                [&item](const Stripes::Entry &entry) { return entry.item == item; });
+            if (found != entries.end())
+            {
+                *found = entries.back();
+                entries.pop_back();
+            }
+        }
+
+        // Locks a set of stripes in ascending order and releases them in reverse
+        class StripeLock
+        {
+        public:
+            StripeLock(Stripes::Stripe *stripes_, std::vector<std::size_t> indices_, const bool &exclusive_)
+                : stripes(stripes_), indices(std::move(indices_)), exclusive(exclusive_)
+            {
+                std::sort(indices.begin(), indices.end());
+                indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+
+                for (const std::size_t &index : indices)
+                {
+                    if (exclusive)
+                    {
+                        stripes[index].mutex.lock();
+                    }
+                    else
+                    {
+                        stripes[index].mutex.lock_shared();
+                    }
+                }
+            }
+
+            ~StripeLock()
+            {
+                for (auto index = indices.rbegin(); index != indices.rend(); ++index)
+                {
+                    if (exclusive)
+                    {
+                        stripes[*index].mutex.unlock();
+                    }
+                    else
+                    {
+                        stripes[*index].mutex.unlock_shared();
+                    }
+                }
+            }
+
+            StripeLock(const StripeLock&) = delete;
+            StripeLock &operator=(const StripeLock&) = delete;
+
+        private:
+            Stripes::Stripe *stripes;
+            std::vector<std::size_t> indices;
+            bool exclusive;
+        };
+    }
+
+    /// ------------------------------------------
+    /// -- Classes
+    /// ------------------------------------------
+    constexpr std::size_t ConcurrentWorld::stripeCount;
+
+    ConcurrentWorld::ConcurrentWorld(const Number &cellSize_)
+        : cellSize(cellSize_), stripes(new Stripes::Stripe[stripeCount]), itemCount(0)
+    {
+        if (cellSize <= 0)
+        {
+            throw Exception::InvalidArgumentError();
+        }
+    }
+
+    ConcurrentWorld::~ConcurrentWorld() = default;
+
+    void ConcurrentWorld::add(
+        const Item &item,
+        const Number &x, const Number &y,
+        const Number &w, const Number &h
+    )
+    {
+        if (item == nullptr || w <= 0 || h <= 0)
+        {
+            throw Exception::InvalidArgumentError();
+        }
+
+        const Rectangle rect{ x, y, w, h };
+        std::vector<std::uint64_t> keys;
+        getCellKeys(rect, keys);
+
+        std::vector<std::size_t> locked{ toStripe(item) };
+        for (const std::uint64_t &key : keys)
+        {
+            locked.push_back(toStripe(key));
+        }
+        const StripeLock lock(stripes.get(), std::move(locked), true);
+
+        FlatMap<Item, Rectangle> &rects = stripes[toStripe(item)].rects;
+        if (rects.find(item) != rects.end())
+        {
+            throw Exception::AlreadyExistsError();
+        }
+
+        rects[item] = rect;
+        for (const std::uint64_t &key : keys)
+        {
+            stripes[toStripe(key)].cells[key].push_back(Stripes::Entry{ item, rect });
+        }
+        itemCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void ConcurrentWorld::remove(const Item &item)
+    {
+        // The stripes to lock depend on the rect, which may change until they are
+        // locked, so lock the ones of the rect read last and retry if it moved since
+        Rectangle rect;
+        while (findRect(item, rect))
+        {
+            std::vector<std::uint64_t> keys;
+            getCellKeys(rect, keys);
+
+            std::vector<std::size_t> locked{ toStripe(item) };
+            for (const std::uint64_t &key : keys)
+            {
+                locked.push_back(toStripe(key));
+            }
+            const StripeLock lock(stripes.get(), std::move(locked), true);
+
+            FlatMap<Item, Rectangle> &rects = stripes[toStripe(item)].rects;
+            auto found = rects.find(item);
+            if (found == rects.end() || !isSameRect(found->second, rect))
+            {
+                continue;
+            }
+
+            for (const std::uint64_t &key : keys)
+            {
+                auto &cells = stripes[toStripe(key)].cells;
+                auto cell = cells.find(key);
+                eraseEntry(cell->second, item);
+                if (cell->second.empty())
+                {
+                    cells.erase(cell);
+                }
+            }
+            rects.erase(found);
+            itemCount.fetch_sub(1, std::memory_order_relaxed);
+            return;
+        }
+
+        throw Exception::NotFoundError();
+    }
+
+    void ConcurrentWorld::update(const Item &item, const Number &x, const Number &y)
+    {
+        Number _1, _2, w, h;
+        std::tie(_1, _2, w, h) = getRect(item);
+        update(item, x, y, w, h);
+    }
+
+    void ConcurrentWorld::update(
+        const Item &item,
+        const Number &x, const Number &y,
+        const Number &w, const Number &h
+    )
+    {
+        if (w <= 0 || h <= 0)
+        {
+            throw Exception::InvalidArgumentError();
+        }
+
+        const Rectangle to{ x, y, w, h };
+        const CellRange toRange = toCellRange(cellSize, to);
+
+        Rectangle from;
+        while (findRect(item, from))
+        {
+            if (isSameRect(from, to))
+            {
+                return;
+            }
+
+            const CellRange fromRange = toCellRange(cellSize, from);
+            std::vector<std::size_t> locked{ toStripe(item) };
+            for (const CellRange &range : { fromRange, toRange })
+            {
+                for (Number cy = range.top; cy < range.bottom; cy++)
+                {
+                    for (Number cx = range.left; cx < range.right; cx++)
+                    {
+                        locked.push_back(toStripe(Grid::toCellKey(cx, cy)));
+                    }
+                }
+            }
+            const StripeLock lock(stripes.get(), std::move(locked), true);
+
+            FlatMap<Item, Rectangle> &rects = stripes[toStripe(item)].rects;
+            auto found = rects.find(item);
+            if (found == rects.end() || !isSameRect(found->second, from))
+            {
+                continue;
+            }
+
+            // Cells in both ranges keep their entry and only see the new rect
+            for (Number cy = fromRange.top; cy < fromRange.bottom; cy++)
+            {
+                for (Number cx = fromRange.left; cx < fromRange.right; cx++)
+                {
+                    const std::uint64_t key = Grid::toCellKey(cx, cy);
+                    auto &cells = stripes[toStripe(key)].cells;
+                    auto cell = cells.find(key);
+
+                    if (contains(toRange, cx, cy))
+                    {
+                        for (Stripes::Entry &entry : cell->second)
+                        {
+                            if (entry.item == item)
+                            {
+                                entry.rect = to;
+                                break;
+                            }
+                        }
+                        continue;
+                    }
+
+                    eraseEntry(cell->second, item);
+                    if (cell->second.empty())
+                    {
+                        cells.erase(cell);
+                    }
+                }
+            }
+
+            for (Number cy = toRange.top; cy < toRange.bottom; cy++)
+            {
+                for (Number cx = toRange.left; cx < toRange.right; cx++)
+                {
+                    if (!contains(fromRange, cx, cy))
+                    {
+                        const std::uint64_t key = Grid::toCellKey(cx, cy);
+                        stripes[toStripe(key)].cells[key].push_back(Stripes::Entry{ item, to });
+                    }
+                }
+            }
+
+            found->second = to;
+            return;
+        }
+
+        throw Exception::NotFoundError();
+    }
+
+    Collisions ConcurrentWorld::project(
+        const Item &item,
+        const Number &x, const Number &y,
+        const Number &w, const Number &h,
+        const Number &goalX, const Number &goalY,
+        const Filter &filter
+    ) const
+    {
+        BUMP_TRACE_SPAN("ConcurrentWorld::project", item);
+
+        const Number tl = std::min(goalX, x);
+        const Number tt = std::min(goalY, y);
+        const Number tr = std::max(goalX + w, x + w);
+        const Number tb = std::max(goalY + h, y + h);
+
+        const std::vector<Stripes::Entry> entries = gather(Rectangle{ tl, tt, tr - tl, tb - tt });
+        std::vector<Item> others(entries.size());
+        std::vector<Rectangle> rects(entries.size());
+        for (std::size_t i = 0; i < entries.size(); i++)
+        {
+            std::tie(others[i], rects[i]) = std::make_tuple(entries[i].item, entries[i].rect);
+        }
+
+        // The narrow phase of World::project, so that both find the same collisions
+        std::vector<Collision> collisions;
+        World::projectAgainst(item, x, y, w, h, goalX, goalY, filter, others, rects, collisions);
+
+        const std::uint32_t len = static_cast<std::uint32_t>(collisions.size());
+        return Collisions{ std::move(collisions), len };
+    }
+
+    Items ConcurrentWorld::queryRect(
+        const Number &x, const Number &y,
+        const Number &w, const Number &h,
+        const QueryFilter &filter
+    ) const
+    {
+        if (w <= 0 || h <= 0)
+        {
+            throw Exception::InvalidArgumentError();
+        }
+
+        std::vector<Item> items;
+        for (const Stripes::Entry &entry : gather(Rectangle{ x, y, w, h }))
+        {
+            const Rectangle &rect = entry.rect;
+            if ((!filter || filter(entry.item)) &&
+                Rect::isIntersecting(x, y, w, h, rect.x, rect.y, rect.w, rect.h))
+            {
+                items.push_back(entry.item);
+            }
+        }
+
+        const std::uint32_t len = static_cast<std::uint32_t>(items.size());
+        return Items{ std::move(items), len };
+    }
+
+    Items ConcurrentWorld::queryPoint(
+        const Number &x, const Number &y,
+        const QueryFilter &filter
+    ) const
+    {
+        Number cx, cy;
+        std::tie(cx, cy) = Grid::toCell(cellSize, x, y);
+
+        std::vector<Item> items;
+        for (const Stripes::Entry &entry : gather(std::vector<std::uint64_t>{ Grid::toCellKey(cx, cy) }))
+        {
+            const Rectangle &rect = entry.rect;
+            if ((!filter || filter(entry.item)) &&
+                Rect::containsPoint(rect.x, rect.y, rect.w, rect.h, x, y))
+            {
+                items.push_back(entry.item);
+            }
+        }
+
+        const std::uint32_t len = static_cast<std::uint32_t>(items.size());
+        return Items{ std::move(items), len };
+    }
+
+    Items ConcurrentWorld::querySegment(
+        const Number &x1, const Number &y1,
+        const Number &x2, const Number &y2,
+        const QueryFilter &filter
+    ) const
+    {
+        std::vector<std::uint64_t> keys;
+        Grid::traverse(cellSize, x1, y1, x2, y2, [&keys](const Number &cx, const Number &cy)
+        {
+            keys.push_back(Grid::toCellKey(cx, cy));
+        });
+
+        std::vector<ItemInfo> itemInfo;
+        for (const Stripes::Entry &entry : gather(keys))
+        {
+            if (filter && !filter(entry.item))
+            {
+                continue;
+            }
+
+            const Rectangle &rect = entry.rect;
+
+            bool touches;
+            ItemInfo info;
+            std::tie(touches, info.ti1, info.ti2, info.weight) =
+                Rect::getSegmentTouch(rect.x, rect.y, rect.w, rect.h, x1, y1, x2, y2);
+
+            if (touches)
+            {
+                info.item = entry.item;
+                itemInfo.push_back(info);
+            }
+        }
+
+        std::sort(itemInfo.begin(), itemInfo.end(), World::sortByWeight);
+
+        std::vector<Item> items;
+        items.reserve(itemInfo.size());
+        for (const ItemInfo &info : itemInfo)
+        {
+            items.push_back(info.item);
+        }
+
+        const std::uint32_t len = static_cast<std::uint32_t>(items.size());
+        return Items{ std::move(items), len };
+    }
+
+    bool ConcurrentWorld::hasItem(const Item &item) const
+    {
+        Rectangle rect;
+        return findRect(item, rect);
+    }
+
+    std::size_t ConcurrentWorld::countItems() const
+    {
+        return itemCount.load(std::memory_order_relaxed);
+    }
+
+    std::tuple<Number, Number, Number, Number> ConcurrentWorld::getRect(const Item &item) const
+    {
+        Rectangle rect;
+        if (!findRect(item, rect))
+        {
+            throw Exception::NotFoundError();
+        }
+        return std::make_tuple(rect.x, rect.y, rect.w, rect.h);
+    }
+
+    std::vector<Stripes::Entry> ConcurrentWorld::gather(const Rectangle &rect) const
+    {
+        const CellRange range = toCellRange(cellSize, rect);
+
+        std::vector<std::size_t> locked;
+        for (Number cy = range.top; cy < range.bottom; cy++)
+        {
+            for (Number cx = range.left; cx < range.right; cx++)
+            {
+                locked.push_back(toStripe(Grid::toCellKey(cx, cy)));
+            }
+        }
+
+        std::vector<Stripes::Entry> entries;
+
+        const StripeLock lock(stripes.get(), std::move(locked), false);
+        for (Number cy = range.top; cy < range.bottom; cy++)
+        {
+            for (Number cx = range.left; cx < range.right; cx++)
+            {
+                const std::uint64_t key = Grid::toCellKey(cx, cy);
+                const auto &cells = stripes[toStripe(key)].cells;
+                auto cell = cells.find(key);
+                if (cell == cells.end())
+                {
+                    continue;
+                }
+
+                for (const Stripes::Entry &entry : cell->second)
+                {
+                    // Only the first cell of the range the item overlaps reports it,
+                    // which saves a visited set
+                    Number ex, ey;
+                    std::tie(ex, ey) = Grid::toCell(cellSize, entry.rect.x, entry.rect.y);
+                    if (std::max(ex, range.left) == cx && std::max(ey, range.top) == cy)
+                    {
+                        entries.push_back(entry);
+                    }
+                }
+            }
+        }
+        return entries;
+    }
+
+    std::vector<Stripes::Entry> ConcurrentWorld::gather(const std::vector<std::uint64_t> &keys) const
+    {
+        std::vector<std::size_t> locked;
+        locked.reserve(keys.size());
+        for (const std::uint64_t &key : keys)
+        {
+            locked.push_back(toStripe(key));
+        }
+
+        std::vector<Stripes::Entry> entries;
+        const bool single = keys.size() == 1;
+        std::unordered_set<Item> visited;
+
+        const StripeLock lock(stripes.get(), std::move(locked), false);
+        for (const std::uint64_t &key : keys)
+        {
+            const auto &cells = stripes[toStripe(key)].cells;
+            auto cell = cells.find(key);
+            if (cell == cells.end())
+            {
+                continue;
+            }
+
+            for (const Stripes::Entry &entry : cell->second)
+            {
+                // A single cell cannot hold an item twice
+                if (single || visited.insert(entry.item).second)
+                {
+                    entries.push_back(entry);
+                }
+            }
+        }
+        return entries;
+    }
+
+    void ConcurrentWorld::getCellKeys(const Rectangle &rect, std::vector<std::uint64_t> &keys) const
+    {
+        const CellRange range = toCellRange(cellSize, rect);
+        for (Number cy = range.top; cy < range.bottom; cy++)
+        {
+            for (Number cx = range.left; cx < range.right; cx++)
+            {
+                keys.push_back(Grid::toCellKey(cx, cy));
+            }
+        }
+    }
+
+    bool ConcurrentWorld::findRect(const Item &item, Rectangle &rect) const
+    {
+        const Stripes::Stripe &stripe = stripes[toStripe(item)];
+        std::shared_lock<std::shared_timed_mutex> lock(stripe.mutex);
+
+        auto found = stripe.rects.find(item);
+        if (found == stripe.rects.end())
+        {
+            return false;
+        }
+        rect = found->second;
+        return true;
+    }
+}
@@ -0,0 +1,111 @@
+#ifndef CONCURRENT_H_INCLUDED_3D7A1E92_C54B_4F08_96E2_B18F0C6A7D35
+#define CONCURRENT_H_INCLUDED_3D7A1E92_C54B_4F08_96E2_B18F0C6A7D35
+#include "bump.h"
+
+#include <atomic>
+#include <shared_mutex>
+
+namespace Bump
+{
+    /// ------------------------------------------
+    /// -- Concurrent world
+    /// ------------------------------------------
+    namespace Stripes
+    {
+        struct Entry
+        {
+            Item item = nullptr;
+            Rectangle rect;
+        };
+
+        // Owns the cells and the item rects whose keys hash to it
+        struct Stripe
+        {
+            mutable std::shared_timed_mutex mutex;
+            std::unordered_map<std::uint64_t, std::vector<Entry>> cells;
+            FlatMap<Item, Rectangle> rects;
+        };
+    }
+
+    // Grid world that any number of threads can query and update at once. There is
+    // no world-wide lock: cells and item rects are spread over stripeCount stripes
+    // by hash, queries take the stripes of the cells they read shared and updates
+    // take the stripes of the item and of its old and new cells exclusively, always
+    // in ascending stripe order so that no two operations can deadlock. Queries see
+    // an update either entirely or not at all. Filters run once the locks are gone.
+    //
+    // project goes through the narrow phase of World::project. Responses need a World,
+    // so there is no move: project, then update.
+    class ConcurrentWorld
+    {
+    public:
+        static constexpr std::size_t stripeCount = 256;
+
+        explicit ConcurrentWorld(const Number &cellSize = 64);
+        ~ConcurrentWorld();
+
+        ConcurrentWorld(const ConcurrentWorld &a) = delete;
+        ConcurrentWorld &operator=(const ConcurrentWorld &a) = delete;
+
+        void add(
+            const Item &item,
+            const Number &x, const Number &y,
+            const Number &w, const Number &h
+        );
+
+        void remove(const Item &item);
+
+        void update(const Item &item, const Number &x, const Number &y);
+
+        void update(
+            const Item &item,
+            const Number &x, const Number &y,
+            const Number &w, const Number &h
+        );
+
+        Collisions project(
+            const Item &item,
+            const Number &x, const Number &y,
+            const Number &w, const Number &h,
+            const Number &goalX, const Number &goalY,
+            const Filter &filter = defaultFilter
+        ) const;
+
+        Items queryRect(
+            const Number &x, const Number &y,
+            const Number &w, const Number &h,
+            const QueryFilter &filter = nullptr
+        ) const;
+
+        Items queryPoint(
+            const Number &x, const Number &y,
+            const QueryFilter &filter = nullptr
+        ) const;
+
+        Items querySegment(
+            const Number &x1, const Number &y1,
+            const Number &x2, const Number &y2,
+            const QueryFilter &filter = nullptr
+        ) const;
+
+        bool hasItem(const Item &item) const;
+        std::size_t countItems() const;
+
+        std::tuple<Number, Number, Number, Number> getRect(const Item &item) const;
+
+    private:
+        // Entries of the cells rect overlaps or of the cells behind keys, each item
+        // once, copied out under shared locks
+        std::vector<Stripes::Entry> gather(const Rectangle &rect) const;
+        std::vector<Stripes::Entry> gather(const std::vector<std::uint64_t> &keys) const;
+        void getCellKeys(const Rectangle &rect, std::vector<std::uint64_t> &keys) const;
+        bool findRect(const Item &item, Rectangle &rect) const;
+
+    private:
+        Number cellSize;
+        std::unique_ptr<Stripes::Stripe[]> stripes;
+        std::atomic<std::size_t> itemCount;
+    };
+}
+
+#endif
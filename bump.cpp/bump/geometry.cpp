@@ -0,0 +1,400 @@
+#include "geometry.h"
+
+#include <fstream>
+#include <limits>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Bump
+{
+    /// ------------------------------------------
+    /// -- File layout
+    /// ------------------------------------------
+    namespace
+    {
+        constexpr std::uint32_t magic = 0x47534d42;     // "BMSG"
+        constexpr std::uint32_t version = 1;
+        constexpr std::uint64_t alignment = 64;
+
+        // Followed by the rect slots, the cell slots and the item pool, each
+        // starting on an aligned offset so that they can be used in place
+        struct Header
+        {
+            std::uint32_t magic = 0;
+            std::uint32_t version = 0;
+            std::uint32_t byteOrder = 0;
+            std::uint32_t pointerSize = 0;
+            Number cellSize = 0;
+            std::uint64_t fileSize = 0;
+            std::uint64_t itemCount = 0;
+            std::uint64_t rectCapacity = 0;
+            std::uint64_t rectOffset = 0;
+            std::uint64_t cellCount = 0;
+            std::uint64_t cellCapacity = 0;
+            std::uint64_t cellOffset = 0;
+            std::uint64_t poolSize = 0;
+            std::uint64_t poolOffset = 0;
+        };
+
+        std::uint64_t align(const std::uint64_t &offset)
+        {
+            return (offset + alignment - 1) / alignment * alignment;
+        }
+
+        bool isSection(
+            const std::uint64_t &offset, const std::uint64_t &count,
+            const std::size_t &elementSize, const std::size_t &size
+        )
+        {
+            return offset % alignment == 0 && offset <= size && count <= (size - offset) / elementSize;
+        }
+
+        template<typename T>
+        void writeSection(std::ofstream &file, const std::uint64_t &offset, const std::vector<T> &values)
+        {
+            const std::uint64_t position = static_cast<std::uint64_t>(file.tellp());
+            const std::vector<char> padding(static_cast<std::size_t>(offset - position), 0);
+            file.write(padding.data(), padding.size());
+            file.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+        }
+
+        template<typename Function>
+        void forEachCell(const Number &cellSize, const Rectangle &rect, const Function &function)
+        {
+            Number cl, ct, cw, ch;
+            std::tie(cl, ct, cw, ch) = Grid::toCellRect(cellSize, rect.x, rect.y, rect.w, rect.h);
+
+            for (Number cy = ct; cy < ct + ch; cy++)
+            {
+                for (Number cx = cl; cx < cl + cw; cx++)
+                {
+                    function(cx, cy);
+                }
+            }
+        }
+    }
+
+    /// ------------------------------------------
+    /// -- Static geometry
+    /// ------------------------------------------
+    void StaticGeometry::bake(
+        const std::string &path,
+        const std::vector<Item> &items,
+        const std::vector<Rectangle> &rects,
+        const Number &cellSize
+    )
+    {
+        if (items.size() != rects.size() || cellSize <= 0)
+        {
+            throw Exception::InvalidArgumentError();
+        }
+
+        FlatMap<Item, Rectangle> rectTable;
+        rectTable.reserve(items.size());
+        for (std::size_t i = 0; i < items.size(); i++)
+        {
+            if (rects[i].w <= 0 || rects[i].h <= 0 || !rectTable.insert(items[i], rects[i]).second)
+            {
+                throw Exception::InvalidArgumentError();
+            }
+        }
+
+        // First pass sizes every cell, the second one fills the pool
+        FlatMap<std::uint64_t, Cell> cells;
+        for (const Rectangle &rect : rects)
+        {
+            forEachCell(cellSize, rect, [&cells](const Number &cx, const Number &cy)
+            {
+                Cell cell;
+                std::tie(cell.x, cell.y) = std::make_tuple(static_cast<Index>(cx), static_cast<Index>(cy));
+                cells.insert(Grid::toCellKey(cx, cy), cell).first->second.capacity++;
+            });
+        }
+
+        std::uint64_t poolSize = 0;
+        for (auto &slot : cells)
+        {
+            slot.second.offset = static_cast<std::uint32_t>(poolSize);
+            poolSize += slot.second.capacity;
+            if (poolSize > std::numeric_limits<std::uint32_t>::max())
+            {
+                throw Exception::ComputationError();
+            }
+        }
+
+        std::vector<Item> pool(static_cast<std::size_t>(poolSize));
+        for (std::size_t i = 0; i < items.size(); i++)
+        {
+            const Item &item = items[i];
+            forEachCell(cellSize, rects[i], [&cells, &pool, &item](const Number &cx, const Number &cy)
+            {
+                Cell &cell = cells.at(Grid::toCellKey(cx, cy));
+                pool[cell.offset + cell.itemCount] = item;
+                cell.itemCount++;
+            });
+        }
+
+        Header header;
+        header.magic = magic;
+        header.version = version;
+        header.byteOrder = Blob::byteOrder;
+        header.pointerSize = sizeof(Item);
+        header.cellSize = cellSize;
+        header.itemCount = rectTable.size();
+        header.rectCapacity = rectTable.getSlots().size();
+        header.rectOffset = align(sizeof(Header));
+        header.cellCount = cells.size();
+        header.cellCapacity = cells.getSlots().size();
+        header.cellOffset = align(header.rectOffset + header.rectCapacity * sizeof(RectSlot));
+        header.poolSize = poolSize;
+        header.poolOffset = align(header.cellOffset + header.cellCapacity * sizeof(CellSlot));
+        header.fileSize = header.poolOffset + header.poolSize * sizeof(Item);
+
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file)
+        {
+            throw Exception::IOError();
+        }
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+        writeSection(file, header.rectOffset, rectTable.getSlots());
+        writeSection(file, header.cellOffset, cells.getSlots());
+        writeSection(file, header.poolOffset, pool);
+
+        if (!file)
+        {
+            throw Exception::IOError();
+        }
+    }
+
+    StaticGeometry::StaticGeometry(const std::string &path)
+    {
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            file = nullptr;
+            throw Exception::IOError();
+        }
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+        {
+            unmap();
+            throw Exception::IOError();
+        }
+        size = static_cast<std::size_t>(fileSize.QuadPart);
+
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        const void *view = mapping == nullptr ? nullptr : MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (view == nullptr)
+        {
+            unmap();
+            throw Exception::IOError();
+        }
+        data = static_cast<const std::uint8_t*>(view);
+#else
+        const int descriptor = ::open(path.c_str(), O_RDONLY);
+        struct stat status;
+        if (descriptor < 0 || ::fstat(descriptor, &status) != 0 || status.st_size == 0)
+        {
+            if (descriptor >= 0)
+            {
+                ::close(descriptor);
+            }
+            throw Exception::IOError();
+        }
+        size = static_cast<std::size_t>(status.st_size);
+
+        // A shared read-only mapping lets every process use the same page cache pages
+        void *view = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, descriptor, 0);
+        ::close(descriptor);
+        if (view == MAP_FAILED)
+        {
+            throw Exception::IOError();
+        }
+        data = static_cast<const std::uint8_t*>(view);
+#endif
+
+        Header header;
+        if (size >= sizeof(Header))
+        {
+            std::memcpy(&header, data, sizeof(Header));
+        }
+
+        if (size < sizeof(Header) ||
+            header.magic != magic ||
+            header.version != version ||
+            header.byteOrder != Blob::byteOrder ||
+            header.pointerSize != sizeof(Item) ||
+            header.fileSize != size ||
+            !(header.cellSize > 0) ||
+            (header.rectCapacity & (header.rectCapacity - 1)) != 0 ||
+            (header.cellCapacity & (header.cellCapacity - 1)) != 0 ||
+            header.itemCount > header.rectCapacity ||
+            header.cellCount > header.cellCapacity ||
+            !isSection(header.rectOffset, header.rectCapacity, sizeof(RectSlot), size) ||
+            !isSection(header.cellOffset, header.cellCapacity, sizeof(CellSlot), size) ||
+            !isSection(header.poolOffset, header.poolSize, sizeof(Item), size))
+        {
+            unmap();
+            throw Exception::InvalidArgumentError();
+        }
+
+        cellSize = header.cellSize;
+        itemCount = static_cast<std::size_t>(header.itemCount);
+        cellCount = static_cast<std::size_t>(header.cellCount);
+        rectSlots = reinterpret_cast<const RectSlot*>(data + header.rectOffset);
+        rectCapacity = static_cast<std::size_t>(header.rectCapacity);
+        cellSlots = reinterpret_cast<const CellSlot*>(data + header.cellOffset);
+        cellCapacity = static_cast<std::size_t>(header.cellCapacity);
+        pool = reinterpret_cast<const Item*>(data + header.poolOffset);
+        poolSize = static_cast<std::size_t>(header.poolSize);
+    }
+
+    StaticGeometry::~StaticGeometry()
+    {
+        unmap();
+    }
+
+    bool StaticGeometry::hasItem(const Item &item) const
+    {
+        return getRect(item) != nullptr;
+    }
+
+    const Rectangle *StaticGeometry::getRect(const Item &item) const
+    {
+        const RectSlot *slot = FlatMap<Item, Rectangle>::probe(rectSlots, rectCapacity, item);
+        return slot == nullptr ? nullptr : &slot->second;
+    }
+
+    void StaticGeometry::getItems(std::vector<Item> &items) const
+    {
+        for (std::size_t i = 0; i < rectCapacity; i++)
+        {
+            if (rectSlots[i].first != nullptr)
+            {
+                items.push_back(rectSlots[i].first);
+            }
+        }
+    }
+
+    std::size_t StaticGeometry::countItems() const
+    {
+        return itemCount;
+    }
+
+    std::size_t StaticGeometry::countCells() const
+    {
+        return cellCount;
+    }
+
+    Number StaticGeometry::getCellSize() const
+    {
+        return cellSize;
+    }
+
+    void StaticGeometry::queryRect(const Rectangle &rect, std::vector<Item> &items) const
+    {
+        std::unordered_set<Item> visited;
+        forEachCell(cellSize, rect, [this, &items, &visited](const Number &cx, const Number &cy)
+        {
+            const Cell *cell = getCell(cx, cy);
+            if (cell == nullptr)
+            {
+                return;
+            }
+
+            for (std::uint32_t i = 0; i < cell->itemCount; i++)
+            {
+                if (visited.insert(pool[cell->offset + i]).second)
+                {
+                    items.push_back(pool[cell->offset + i]);
+                }
+            }
+        });
+    }
+
+    void StaticGeometry::queryPoint(const Number &x, const Number &y, std::vector<Item> &items) const
+    {
+        Number cx, cy;
+        std::tie(cx, cy) = Grid::toCell(cellSize, x, y);
+
+        const Cell *cell = getCell(cx, cy);
+        if (cell != nullptr)
+        {
+            items.insert(items.end(), pool + cell->offset, pool + cell->offset + cell->itemCount);
+        }
+    }
+
+    void StaticGeometry::querySegment(
+        const Number &x1, const Number &y1,
+        const Number &x2, const Number &y2,
+        std::vector<Item> &items
+    ) const
+    {
+        std::unordered_set<Item> visited;
+        Grid::traverse(cellSize, x1, y1, x2, y2,
+            [this, &items, &visited](const Number &cx, const Number &cy)
+            {
+                const Cell *cell = getCell(cx, cy);
+                if (cell == nullptr)
+                {
+                    return;
+                }
+
+                for (std::uint32_t i = 0; i < cell->itemCount; i++)
+                {
+                    if (visited.insert(pool[cell->offset + i]).second)
+                    {
+                        items.push_back(pool[cell->offset + i]);
+                    }
+                }
+            });
+    }
+
+    const Cell *StaticGeometry::getCell(const Number &cx, const Number &cy) const
+    {
+        const CellSlot *slot = FlatMap<std::uint64_t, Cell>::probe(cellSlots, cellCapacity, Grid::toCellKey(cx, cy));
+        if (slot == nullptr || static_cast<std::uint64_t>(slot->second.offset) + slot->second.itemCount > poolSize)
+        {
+            return nullptr;
+        }
+        return &slot->second;
+    }
+
+    void StaticGeometry::unmap()
+    {
+#ifdef _WIN32
+        if (data != nullptr)
+        {
+            UnmapViewOfFile(data);
+        }
+        if (mapping != nullptr)
+        {
+            CloseHandle(mapping);
+        }
+        if (file != nullptr)
+        {
+            CloseHandle(file);
+        }
+        file = mapping = nullptr;
+#else
+        if (data != nullptr)
+        {
+            ::munmap(const_cast<std::uint8_t*>(data), size);
+        }
+#endif
+        data = nullptr;
+        size = 0;
+    }
+}
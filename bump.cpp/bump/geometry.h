@@ -0,0 +1,85 @@
+#ifndef GEOMETRY_H_INCLUDED_B4E1907C_5F2D_4A36_8C7B_0D93E6A21F58
+#define GEOMETRY_H_INCLUDED_B4E1907C_5F2D_4A36_8C7B_0D93E6A21F58
+#include "bump.h"
+
+namespace Bump
+{
+    /// ------------------------------------------
+    /// -- Static geometry
+    /// ------------------------------------------
+
+    // Read-only grid of static rects baked offline and mapped from a file. Opening
+    // one only validates the header: cells, items and rects are read straight out
+    // of the mapping, so startup does not depend on the amount of geometry, and
+    // processes mapping the same file share its pages.
+    //
+    // Items are baked as their raw values, so use ids rather than pointers.
+    class StaticGeometry
+    {
+    public:
+        // Builds the cell index of items[i] / rects[i] and writes it to path.
+        // Throws InvalidArgumentError for duplicate or null items or empty rects,
+        // like World::add, and IOError when the file cannot be written.
+        static void bake(
+            const std::string &path,
+            const std::vector<Item> &items,
+            const std::vector<Rectangle> &rects,
+            const Number &cellSize = 64
+        );
+
+        // Throws IOError when the file cannot be mapped and InvalidArgumentError
+        // when it was not baked by this version on this platform. Only the header
+        // and section bounds are checked, the file itself is trusted, except that
+        // queries skip cells whose items would lie outside the pool.
+        explicit StaticGeometry(const std::string &path);
+        ~StaticGeometry();
+
+        StaticGeometry(const StaticGeometry &a) = delete;
+        StaticGeometry &operator=(const StaticGeometry &a) = delete;
+
+        bool hasItem(const Item &item) const;
+        // nullptr when item is not part of the geometry
+        const Rectangle *getRect(const Item &item) const;
+        void getItems(std::vector<Item> &items) const;
+        std::size_t countItems() const;
+        std::size_t countCells() const;
+        Number getCellSize() const;
+
+        // Same contract as BroadPhase: every item that may touch the query, once
+        void queryRect(const Rectangle &rect, std::vector<Item> &items) const;
+        void queryPoint(const Number &x, const Number &y, std::vector<Item> &items) const;
+        void querySegment(
+            const Number &x1, const Number &y1,
+            const Number &x2, const Number &y2,
+            std::vector<Item> &items
+        ) const;
+
+    private:
+        using RectSlot = FlatMap<Item, Rectangle>::Slot;
+        using CellSlot = FlatMap<std::uint64_t, Cell>::Slot;
+
+        // nullptr when the cell is missing or its items run past the pool
+        const Cell *getCell(const Number &cx, const Number &cy) const;
+        void unmap();
+
+    private:
+        const std::uint8_t *data = nullptr;
+        std::size_t size = 0;
+#ifdef _WIN32
+        void *file = nullptr;
+        void *mapping = nullptr;
+#endif
+
+        Number cellSize = 0;
+        std::size_t itemCount = 0;
+        std::size_t cellCount = 0;
+        const RectSlot *rectSlots = nullptr;
+        std::size_t rectCapacity = 0;
+        const CellSlot *cellSlots = nullptr;
+        std::size_t cellCapacity = 0;
+        const Item *pool = nullptr;
+        std::size_t poolSize = 0;
+    };
+}
+
+#endif
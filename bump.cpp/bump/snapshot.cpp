@@ -0,0 +1,451 @@
+#include "snapshot.h"
+#include "geometry.h"
+
+#include <algorithm>
+
+namespace Bump
+{
+    /// ------------------------------------------
+    /// -- Auxiliary functions
+    /// ------------------------------------------
+    namespace
+    {
+        struct PageRange
+        {
+            Number left = 0;
+            Number top = 0;
+            Number right = 0;   // Exclusive
+            Number bottom = 0;  // Exclusive
+        };
+
+        PageRange toPageRange(const Number &pageSize, const Rectangle &rect)
+        {
+            Number cl, ct, cw, ch;
+            std::tie(cl, ct, cw, ch) = Grid::toCellRect(pageSize, rect.x, rect.y, rect.w, rect.h);
+            return PageRange{ cl, ct, cl + cw, ct + ch };
+        }
+
+        bool contains(const PageRange &range, const Number &px, const Number &py)
+        {
+            return range.left <= px && px < range.right && range.top <= py && py < range.bottom;
+        }
+
+        std::size_t toBucket(const Item &item)
+        {
+            // Fibonacci hashing, pointers have weak low bits
+            const std::uint64_t value = static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(item));
+            return static_cast<std::size_t>((value * 0x9e3779b97f4a7c15ull) >> 54) % SnapshotWriter::bucketCount;
+        }
+
+        void eraseEntry(std::vector<Pages::Entry> &entries, const Item &item)
+        {
+            auto found = std::find_if(entries.begin(), entries.end(),
+                [&item](const Pages::Entry &entry) { return entry.item == item; });
+            if (found != entries.end())
+            {
+                *found = entries.back();
+                entries.pop_back();
+            }
+        }
+    }
+
+    /// ------------------------------------------
+    /// -- Snapshot
+    /// ------------------------------------------
+    Items Snapshot::queryRect(
+        const Number &x, const Number &y,
+        const Number &w, const Number &h,
+        const QueryFilter &filter
+    ) const
+    {
+        if (w <= 0 || h <= 0)
+        {
+            throw Exception::InvalidArgumentError();
+        }
+
+        std::unordered_set<Item> visited;
+        std::vector<Item> items;
+
+        const PageRange range = toPageRange(pageSize, Rectangle{ x, y, w, h });
+        for (Number py = range.top; py < range.bottom; py++)
+        {
+            for (Number px = range.left; px < range.right; px++)
+            {
+                const Pages::Page *page = getPage(px, py);
+                if (page == nullptr)
+                {
+                    continue;
+                }
+
+                for (const Pages::Entry &entry : page->entries)
+                {
+                    const Rectangle &rect = entry.rect;
+                    if (Rect::isIntersecting(x, y, w, h, rect.x, rect.y, rect.w, rect.h) &&
+                        visited.insert(entry.item).second &&
+                        (!filter || filter(entry.item)))
+                    {
+                        items.push_back(entry.item);
+                    }
+                }
+            }
+        }
+
+        if (staticGeometry)
+        {
+            std::vector<Item> candidates;
+            staticGeometry->queryRect(Rectangle{ x, y, w, h }, candidates);
+            for (const Item &item : candidates)
+            {
+                const Rectangle &rect = *staticGeometry->getRect(item);
+                if ((!filter || filter(item)) &&
+                    Rect::isIntersecting(x, y, w, h, rect.x, rect.y, rect.w, rect.h))
+                {
+                    items.push_back(item);
+                }
+            }
+        }
+
+        const std::uint32_t len = static_cast<std::uint32_t>(items.size());
+        return Items{ std::move(items), len };
+    }
+
+    Items Snapshot::queryPoint(
+        const Number &x, const Number &y,
+        const QueryFilter &filter
+    ) const
+    {
+        std::vector<Item> items;
+
+        Number px, py;
+        std::tie(px, py) = Grid::toCell(pageSize, x, y);
+
+        // A point lies in a single page, so nothing can show up twice
+        const Pages::Page *page = getPage(px, py);
+        if (page != nullptr)
+        {
+            for (const Pages::Entry &entry : page->entries)
+            {
+                const Rectangle &rect = entry.rect;
+                if (Rect::containsPoint(rect.x, rect.y, rect.w, rect.h, x, y) &&
+                    (!filter || filter(entry.item)))
+                {
+                    items.push_back(entry.item);
+                }
+            }
+        }
+
+        if (staticGeometry)
+        {
+            std::vector<Item> candidates;
+            staticGeometry->queryPoint(x, y, candidates);
+            for (const Item &item : candidates)
+            {
+                const Rectangle &rect = *staticGeometry->getRect(item);
+                if ((!filter || filter(item)) &&
+                    Rect::containsPoint(rect.x, rect.y, rect.w, rect.h, x, y))
+                {
+                    items.push_back(item);
+                }
+            }
+        }
+
+        const std::uint32_t len = static_cast<std::uint32_t>(items.size());
+        return Items{ std::move(items), len };
+    }
+
+    Items Snapshot::querySegment(
+        const Number &x1, const Number &y1,
+        const Number &x2, const Number &y2,
+        const QueryFilter &filter
+    ) const
+    {
+        std::unordered_set<Item> visited;
+        std::vector<Item> candidates;
+
+        Grid::traverse(pageSize, x1, y1, x2, y2,
+            [this, &visited, &candidates](const Number &px, const Number &py)
+            {
+                const Pages::Page *page = getPage(px, py);
+                if (page == nullptr)
+                {
+                    return;
+                }
+
+                for (const Pages::Entry &entry : page->entries)
+                {
+                    if (visited.insert(entry.item).second)
+                    {
+                        candidates.push_back(entry.item);
+                    }
+                }
+            });
+
+        if (staticGeometry)
+        {
+            staticGeometry->querySegment(x1, y1, x2, y2, candidates);
+        }
+
+        std::vector<ItemInfo> itemInfo;
+        for (const Item &item : candidates)
+        {
+            if (filter && !filter(item))
+            {
+                continue;
+            }
+
+            const Rectangle &rect = *findRect(item);
+
+            bool touches;
+            ItemInfo info;
+            std::tie(touches, info.ti1, info.ti2, info.weight) =
+                Rect::getSegmentTouch(rect.x, rect.y, rect.w, rect.h, x1, y1, x2, y2);
+
+            if (touches)
+            {
+                info.item = item;
+                itemInfo.push_back(info);
+            }
+        }
+
+        std::sort(itemInfo.begin(), itemInfo.end(),
+            [](const ItemInfo &a, const ItemInfo &b) { return a.weight < b.weight; });
+
+        std::vector<Item> items;
+        items.reserve(itemInfo.size());
+        for (const ItemInfo &info : itemInfo)
+        {
+            items.push_back(info.item);
+        }
+
+        const std::uint32_t len = static_cast<std::uint32_t>(items.size());
+        return Items{ std::move(items), len };
+    }
+
+    bool Snapshot::hasItem(const Item &item) const
+    {
+        return findRect(item) != nullptr;
+    }
+
+    std::size_t Snapshot::countItems() const
+    {
+        return buckets->count + (staticGeometry ? staticGeometry->countItems() : 0);
+    }
+
+    std::tuple<Number, Number, Number, Number> Snapshot::getRect(const Item &item) const
+    {
+        const Rectangle *rect = findRect(item);
+        if (rect == nullptr)
+        {
+            throw Exception::NotFoundError();
+        }
+        return std::make_tuple(rect->x, rect->y, rect->w, rect->h);
+    }
+
+    std::uint64_t Snapshot::getFrame() const
+    {
+        return frame;
+    }
+
+    const Rectangle *Snapshot::findRect(const Item &item) const
+    {
+        for (const Pages::Entry &entry : buckets->pages[toBucket(item)]->entries)
+        {
+            if (entry.item == item)
+            {
+                return &entry.rect;
+            }
+        }
+        return staticGeometry ? staticGeometry->getRect(item) : nullptr;
+    }
+
+    const Pages::Page *Snapshot::getPage(const Number &px, const Number &py) const
+    {
+        auto found = directory->pages.find(Grid::toCellKey(px, py));
+        return found == directory->pages.end() ? nullptr : found->second.get();
+    }
+
+    /// ------------------------------------------
+    /// -- Snapshot writer
+    /// ------------------------------------------
+    constexpr Index SnapshotWriter::pageCells;
+    constexpr std::size_t SnapshotWriter::bucketCount;
+
+    SnapshotWriter::SnapshotWriter(const Number &cellSize)
+        : pageSize(cellSize * pageCells)
+        , directory(std::make_shared<Pages::Directory>())
+        , buckets(std::make_shared<Pages::Buckets>())
+    {
+        directory->generation = generation;
+        buckets->generation = generation;
+        buckets->pages.resize(bucketCount);
+        for (std::shared_ptr<Pages::Page> &page : buckets->pages)
+        {
+            page = std::make_shared<Pages::Page>();
+            page->generation = generation;
+        }
+    }
+
+    void SnapshotWriter::add(const Item &item, const Rectangle &rect)
+    {
+        const PageRange range = toPageRange(pageSize, rect);
+        for (Number py = range.top; py < range.bottom; py++)
+        {
+            for (Number px = range.left; px < range.right; px++)
+            {
+                addToPage(Grid::toCellKey(px, py), item, rect);
+            }
+        }
+
+        Pages::Buckets &writable = getWritableBuckets();
+        getWritablePage(writable.pages[toBucket(item)]).entries.push_back(Pages::Entry{ item, rect });
+        writable.count++;
+    }
+
+    void SnapshotWriter::remove(const Item &item, const Rectangle &rect)
+    {
+        const PageRange range = toPageRange(pageSize, rect);
+        for (Number py = range.top; py < range.bottom; py++)
+        {
+            for (Number px = range.left; px < range.right; px++)
+            {
+                removeFromPage(Grid::toCellKey(px, py), item);
+            }
+        }
+
+        Pages::Buckets &writable = getWritableBuckets();
+        eraseEntry(getWritablePage(writable.pages[toBucket(item)]).entries, item);
+        writable.count--;
+    }
+
+    void SnapshotWriter::update(const Item &item, const Rectangle &from, const Rectangle &to)
+    {
+        const PageRange fromRange = toPageRange(pageSize, from);
+        const PageRange toRange = toPageRange(pageSize, to);
+
+        for (Number py = fromRange.top; py < fromRange.bottom; py++)
+        {
+            for (Number px = fromRange.left; px < fromRange.right; px++)
+            {
+                if (contains(toRange, px, py))
+                {
+                    updateInPage(Grid::toCellKey(px, py), item, to);
+                }
+                else
+                {
+                    removeFromPage(Grid::toCellKey(px, py), item);
+                }
+            }
+        }
+        for (Number py = toRange.top; py < toRange.bottom; py++)
+        {
+            for (Number px = toRange.left; px < toRange.right; px++)
+            {
+                if (!contains(fromRange, px, py))
+                {
+                    addToPage(Grid::toCellKey(px, py), item, to);
+                }
+            }
+        }
+
+        Pages::Buckets &writable = getWritableBuckets();
+        for (Pages::Entry &entry : getWritablePage(writable.pages[toBucket(item)]).entries)
+        {
+            if (entry.item == item)
+            {
+                entry.rect = to;
+                break;
+            }
+        }
+    }
+
+    std::shared_ptr<const Snapshot> SnapshotWriter::snapshot(const std::shared_ptr<const StaticGeometry> &staticGeometry)
+    {
+        std::shared_ptr<Snapshot> view(new Snapshot());
+        view->frame = generation - 1;
+        view->pageSize = pageSize;
+        view->directory = directory;
+        view->buckets = buckets;
+        view->staticGeometry = staticGeometry;
+
+        // Everything reachable now belongs to the snapshot and gets copied before the next write
+        generation++;
+        return view;
+    }
+
+    Pages::Page &SnapshotWriter::getWritablePage(std::shared_ptr<Pages::Page> &page)
+    {
+        if (page->generation != generation)
+        {
+            page = std::make_shared<Pages::Page>(*page);
+            page->generation = generation;
+        }
+        return *page;
+    }
+
+    Pages::Directory &SnapshotWriter::getWritableDirectory()
+    {
+        if (directory->generation != generation)
+        {
+            directory = std::make_shared<Pages::Directory>(*directory);
+            directory->generation = generation;
+        }
+        return *directory;
+    }
+
+    Pages::Buckets &SnapshotWriter::getWritableBuckets()
+    {
+        if (buckets->generation != generation)
+        {
+            buckets = std::make_shared<Pages::Buckets>(*buckets);
+            buckets->generation = generation;
+        }
+        return *buckets;
+    }
+
+    void SnapshotWriter::addToPage(const std::uint64_t &key, const Item &item, const Rectangle &rect)
+    {
+        std::shared_ptr<Pages::Page> &page = getWritableDirectory().pages[key];
+        if (!page)
+        {
+            page = std::make_shared<Pages::Page>();
+            page->generation = generation;
+        }
+        getWritablePage(page).entries.push_back(Pages::Entry{ item, rect });
+    }
+
+    void SnapshotWriter::removeFromPage(const std::uint64_t &key, const Item &item)
+    {
+        Pages::Directory &writable = getWritableDirectory();
+        auto found = writable.pages.find(key);
+        if (found == writable.pages.end())
+        {
+            return;
+        }
+
+        Pages::Page &page = getWritablePage(found->second);
+        eraseEntry(page.entries, item);
+        if (page.entries.empty())
+        {
+            writable.pages.erase(found);
+        }
+    }
+
+    void SnapshotWriter::updateInPage(const std::uint64_t &key, const Item &item, const Rectangle &rect)
+    {
+        Pages::Directory &writable = getWritableDirectory();
+        auto found = writable.pages.find(key);
+        if (found == writable.pages.end())
+        {
+            return;
+        }
+
+        for (Pages::Entry &entry : getWritablePage(found->second).entries)
+        {
+            if (entry.item == item)
+            {
+                entry.rect = rect;
+                return;
+            }
+        }
+    }
+}
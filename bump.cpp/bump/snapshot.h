@@ -0,0 +1,122 @@
+#ifndef SNAPSHOT_H_INCLUDED_61C8D3F0_2B7A_4E15_9D46_A0F5B83E7C12
+#define SNAPSHOT_H_INCLUDED_61C8D3F0_2B7A_4E15_9D46_A0F5B83E7C12
+#include "bump.h"
+
+namespace Bump
+{
+    /// ------------------------------------------
+    /// -- Snapshots
+    /// ------------------------------------------
+    namespace Pages
+    {
+        struct Entry
+        {
+            Item item = nullptr;
+            Rectangle rect;
+        };
+
+        // Never changed once a snapshot can see it: the writer copies a page
+        // whose generation is older than the current one before touching it
+        struct Page
+        {
+            std::uint64_t generation = 0;
+            std::vector<Entry> entries;
+        };
+
+        // Pages of pageCells x pageCells grid cells, holding every item overlapping them
+        struct Directory
+        {
+            std::uint64_t generation = 0;
+            std::unordered_map<std::uint64_t, std::shared_ptr<Page>> pages;
+        };
+
+        // Items hashed into a fixed number of buckets, for rect lookups by item
+        struct Buckets
+        {
+            std::uint64_t generation = 0;
+            std::vector<std::shared_ptr<Page>> pages;
+            std::size_t count = 0;
+        };
+    }
+
+    // Immutable view of a World at the frame it was taken. Any number of threads
+    // can query one without locks while the world keeps moving items.
+    class Snapshot
+    {
+    public:
+        Items queryRect(
+            const Number &x, const Number &y,
+            const Number &w, const Number &h,
+            const QueryFilter &filter = nullptr
+        ) const;
+
+        Items queryPoint(
+            const Number &x, const Number &y,
+            const QueryFilter &filter = nullptr
+        ) const;
+
+        Items querySegment(
+            const Number &x1, const Number &y1,
+            const Number &x2, const Number &y2,
+            const QueryFilter &filter = nullptr
+        ) const;
+
+        bool hasItem(const Item &item) const;
+        std::size_t countItems() const;
+        std::tuple<Number, Number, Number, Number> getRect(const Item &item) const;
+
+        // Number of snapshots the world took before this one
+        std::uint64_t getFrame() const;
+
+    private:
+        friend class SnapshotWriter;
+
+        Snapshot() = default;
+
+        const Rectangle *findRect(const Item &item) const;
+        const Pages::Page *getPage(const Number &px, const Number &py) const;
+
+    private:
+        std::uint64_t frame = 0;
+        Number pageSize = 0;
+        std::shared_ptr<const Pages::Directory> directory;
+        std::shared_ptr<const Pages::Buckets> buckets;
+        std::shared_ptr<const StaticGeometry> staticGeometry;
+    };
+
+    // Writer side of the snapshots, mirrored by a World from its first snapshot on.
+    // Pages shared with a snapshot are copied on write, so every frame only copies
+    // the pages it changes plus the page directory.
+    class SnapshotWriter
+    {
+    public:
+        static constexpr Index pageCells = 8;
+        static constexpr std::size_t bucketCount = 1024;
+
+        // Starts out empty, the world adds the items it already holds
+        explicit SnapshotWriter(const Number &cellSize);
+
+        void add(const Item &item, const Rectangle &rect);
+        void remove(const Item &item, const Rectangle &rect);
+        void update(const Item &item, const Rectangle &from, const Rectangle &to);
+
+        std::shared_ptr<const Snapshot> snapshot(const std::shared_ptr<const StaticGeometry> &staticGeometry);
+
+    private:
+        Pages::Page &getWritablePage(std::shared_ptr<Pages::Page> &page);
+        Pages::Directory &getWritableDirectory();
+        Pages::Buckets &getWritableBuckets();
+
+        void addToPage(const std::uint64_t &key, const Item &item, const Rectangle &rect);
+        void removeFromPage(const std::uint64_t &key, const Item &item);
+        void updateInPage(const std::uint64_t &key, const Item &item, const Rectangle &rect);
+
+    private:
+        Number pageSize;
+        std::uint64_t generation = 1;
+        std::shared_ptr<Pages::Directory> directory;
+        std::shared_ptr<Pages::Buckets> buckets;
+    };
+}
+
+#endif
@@ -0,0 +1,168 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace Bump
+{
+    namespace Trace
+    {
+        /// ------------------------------------------
+        /// -- Ring buffers
+        /// ------------------------------------------
+        namespace
+        {
+            // Single producer ring: only the owning thread writes, and publishes
+            // each event with a release store of head. Readers never block it.
+            struct Ring
+            {
+                explicit Ring(const std::uint32_t &thread)
+                    : events(ringCapacity)
+                    , head(0)
+                    , thread(thread)
+                {
+                }
+
+                std::vector<Event> events;
+                std::atomic<std::uint64_t> head;
+                std::uint32_t thread;
+            };
+
+            struct Registry
+            {
+                std::mutex mutex;   // Only taken the first time a thread records
+                std::vector<std::shared_ptr<Ring>> rings;
+                std::atomic<bool> running{ false };
+                const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+            };
+
+            Registry &registry()
+            {
+                static Registry instance;
+                return instance;
+            }
+
+            Ring &localRing()
+            {
+                // Rings are shared with the registry so events survive their thread
+                thread_local std::shared_ptr<Ring> ring;
+                if (!ring)
+                {
+                    Registry &reg = registry();
+                    std::lock_guard<std::mutex> lock(reg.mutex);
+                    ring = std::make_shared<Ring>(static_cast<std::uint32_t>(reg.rings.size()));
+                    reg.rings.push_back(ring);
+                }
+                return *ring;
+            }
+
+            std::uint64_t now()
+            {
+                return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - registry().epoch
+                ).count());
+            }
+        }
+
+        /// ------------------------------------------
+        /// -- Span
+        /// ------------------------------------------
+        Span::Span(const char *name, const void *item)
+            : name(name)
+            , item(item)
+            , start(isRunning() ? now() : 0)
+        {
+        }
+
+        Span::~Span()
+        {
+            if (start != 0 && isRunning())
+            {
+                record(Event{ name, item, start, now() - start });
+            }
+        }
+
+        /// ------------------------------------------
+        /// -- Functions
+        /// ------------------------------------------
+        void start()
+        {
+            registry().running.store(true, std::memory_order_release);
+        }
+
+        void stop()
+        {
+            registry().running.store(false, std::memory_order_release);
+        }
+
+        bool isRunning()
+        {
+            return registry().running.load(std::memory_order_relaxed);
+        }
+
+        void clear()
+        {
+            Registry &reg = registry();
+            std::lock_guard<std::mutex> lock(reg.mutex);
+            for (const auto &ring : reg.rings)
+            {
+                ring->head.store(0, std::memory_order_release);
+            }
+        }
+
+        void record(const Event &event)
+        {
+            Ring &ring = localRing();
+            const std::uint64_t head = ring.head.load(std::memory_order_relaxed);
+            ring.events[head % ringCapacity] = event;
+            ring.head.store(head + 1, std::memory_order_release);
+        }
+
+        bool write(const std::string &path)
+        {
+            std::ofstream file(path);
+            if (!file)
+            {
+                return false;
+            }
+
+            Registry &reg = registry();
+            std::lock_guard<std::mutex> lock(reg.mutex);
+
+            file << std::fixed << std::setprecision(3);
+            file << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+            bool first = true;
+            for (const auto &ring : reg.rings)
+            {
+                const std::uint64_t head = ring->head.load(std::memory_order_acquire);
+                const std::uint64_t count = std::min<std::uint64_t>(head, ringCapacity);
+
+                for (std::uint64_t i = head - count; i < head; i++)
+                {
+                    const Event &event = ring->events[i % ringCapacity];
+
+                    file << (first ? "\n" : ",\n");
+                    file << "{\"name\":\"" << event.name << "\",\"cat\":\"bump\",\"ph\":\"X\""
+                         << ",\"pid\":1,\"tid\":" << ring->thread
+                         << ",\"ts\":" << event.start / 1000.0
+                         << ",\"dur\":" << event.duration / 1000.0;
+                    if (event.item != nullptr)
+                    {
+                        file << ",\"args\":{\"item\":\"" << event.item << "\"}";
+                    }
+                    file << "}";
+                    first = false;
+                }
+            }
+            file << "\n]}\n";
+
+            return static_cast<bool>(file);
+        }
+    }
+}
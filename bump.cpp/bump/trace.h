@@ -0,0 +1,75 @@
+#ifndef TRACE_H_INCLUDED_8F2A6C41_D37E_4B09_A5C1_7E94B0D2F618
+#define TRACE_H_INCLUDED_8F2A6C41_D37E_4B09_A5C1_7E94B0D2F618
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Spans compile to nothing unless BUMP_ENABLE_TRACE is defined
+#ifdef BUMP_ENABLE_TRACE
+#define BUMP_TRACE_CONCAT_(a, b) a##b
+#define BUMP_TRACE_CONCAT(a, b) BUMP_TRACE_CONCAT_(a, b)
+#define BUMP_TRACE_SPAN(name, item) \
+    const ::Bump::Trace::Span BUMP_TRACE_CONCAT(bumpTraceSpan, __LINE__)((name), (item))
+#else
+#define BUMP_TRACE_SPAN(name, item) ((void)0)
+#endif
+
+namespace Bump
+{
+    namespace Trace
+    {
+        /// ------------------------------------------
+        /// -- Structures
+        /// ------------------------------------------
+        struct Event
+        {
+            const char *name = nullptr;     // Must outlive the trace, string literals in practice
+            const void *item = nullptr;
+            std::uint64_t start = 0;        // Nanoseconds since the first traced event
+            std::uint64_t duration = 0;
+        };
+
+        /// ------------------------------------------
+        /// -- Classes
+        /// ------------------------------------------
+
+        // Records a complete event from construction to destruction into the
+        // ring buffer of the calling thread. Does nothing while tracing is stopped.
+        class Span
+        {
+        public:
+            Span(const char *name, const void *item = nullptr);
+            ~Span();
+
+            Span(const Span&) = delete;
+            Span &operator=(const Span&) = delete;
+
+        private:
+            const char *name;
+            const void *item;
+            std::uint64_t start;
+        };
+
+        /// ------------------------------------------
+        /// -- Functions
+        /// ------------------------------------------
+
+        // Every thread owns a ring buffer of this many events; older events are overwritten
+        constexpr std::size_t ringCapacity = 1 << 16;
+
+        void start();
+        void stop();
+        bool isRunning();
+
+        // Drops every recorded event. Only call it while no thread is tracing.
+        void clear();
+
+        void record(const Event &event);
+
+        // Writes the recorded events as Chrome trace JSON, loadable in chrome://tracing
+        // and Perfetto. Only call it while no thread is tracing, e.g. between ticks.
+        bool write(const std::string &path);
+    }
+}
+
+#endif
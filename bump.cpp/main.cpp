@@ -1,7 +1,6 @@
-#include "bump/bump.h"
+#include "bench/bench.h"
 
 int main(int argc, char **argv)
 {
-    Bump::test();
-    return 0;
-}
\ No newline at end of file
+    return Bench::run(argc, argv);
+}
@@ -0,0 +1,1205 @@
+#include "../bump/broadphase.h"
+#include "../bump/bump.h"
+#include "../bump/concurrent.h"
+#include "../bump/geometry.h"
+#include "../bump/snapshot.h"
+#include "../bump/trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Tests
+{
+    namespace
+    {
+        /// ------------------------------------------
+        /// -- Checks
+        /// ------------------------------------------
+        std::size_t failures = 0;
+
+        void check(const bool &passed, const char *condition, const char *file, const int &line)
+        {
+            if (!passed)
+            {
+                failures++;
+                std::printf("  %s:%d: %s\n", file, line, condition);
+            }
+        }
+
+#define BUMP_CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+        template<typename ExceptionType>
+        bool throws(const std::function<void()> &function)
+        {
+            try
+            {
+                function();
+            }
+            catch (const ExceptionType &)
+            {
+                return true;
+            }
+            catch (...)
+            {
+                return false;
+            }
+            return false;
+        }
+
+        // Stores the checksum of a patched blob again, so that only Check::Full can catch it
+        void resign(std::vector<std::uint8_t> &blob)
+        {
+            const std::size_t size = blob.size() - sizeof(std::uint64_t);
+            const std::uint64_t checksum = Bump::Blob::checksum(blob.data(), size);
+            std::memcpy(blob.data() + size, &checksum, sizeof(checksum));
+        }
+
+        /// ------------------------------------------
+        /// -- Worlds
+        /// ------------------------------------------
+
+        // Returns every item for every query, which leaves the whole job to the narrow phase
+        class BruteForceBroadPhase : public Bump::BroadPhase
+        {
+        public:
+            void add(const Bump::ItemHandle &item, const Bump::Rectangle &) override
+            {
+                items.push_back(item);
+            }
+
+            void remove(const Bump::ItemHandle &item, const Bump::Rectangle &) override
+            {
+                items.erase(std::find(items.begin(), items.end(), item));
+            }
+
+            void update(const Bump::ItemHandle &, const Bump::Rectangle &, const Bump::Rectangle &) override
+            {
+            }
+
+            void clear() override
+            {
+                items.clear();
+            }
+
+            void queryRect(const Bump::Rectangle &, std::vector<Bump::ItemHandle> &found) const override
+            {
+                found.insert(found.end(), items.begin(), items.end());
+            }
+
+            void queryPoint(const Bump::Number &, const Bump::Number &, std::vector<Bump::ItemHandle> &found) const override
+            {
+                found.insert(found.end(), items.begin(), items.end());
+            }
+
+            void querySegment(
+                const Bump::Number &, const Bump::Number &,
+                const Bump::Number &, const Bump::Number &,
+                std::vector<Bump::ItemHandle> &found
+            ) const override
+            {
+                found.insert(found.end(), items.begin(), items.end());
+            }
+
+            std::size_t countCells() const override
+            {
+                return 1;
+            }
+
+            void save(std::vector<std::uint8_t> &blob) const override
+            {
+                Bump::Blob::writeArray(blob, items);
+            }
+
+            void load(Bump::Blob::Reader &reader, const std::vector<std::uint8_t> *generations) override
+            {
+                std::vector<Bump::ItemHandle> loaded;
+                reader.readArray(loaded);
+                for (const Bump::ItemHandle &item : loaded)
+                {
+                    if (generations != nullptr && !isLive(item, *generations))
+                    {
+                        throw Bump::Exception::InvalidArgumentError();
+                    }
+                }
+                items.swap(loaded);
+            }
+
+        private:
+            std::vector<Bump::ItemHandle> items;
+        };
+
+        struct Backend
+        {
+            std::string name;
+            std::function<Bump::World()> create;
+        };
+
+        const Bump::Number cellSize = 32;
+
+        std::vector<Backend> backends()
+        {
+            return std::vector<Backend>
+            {
+                { "grid", []() { return Bump::World(cellSize); } },
+                { "grid4", []() { return Bump::World(cellSize, 4); } },
+                { "gridTiled", []()
+                    {
+                        return Bump::World(std::unique_ptr<Bump::BroadPhase>(
+                            new Bump::GridBroadPhase(cellSize, 1, Bump::GridBroadPhase::Layout::Tiled)), cellSize);
+                    }
+                },
+                { "tree", []()
+                    {
+                        return Bump::World(std::unique_ptr<Bump::BroadPhase>(new Bump::AabbTreeBroadPhase(4)), cellSize);
+                    }
+                },
+                { "sap", []()
+                    {
+                        return Bump::World(std::unique_ptr<Bump::BroadPhase>(new Bump::SweepAndPruneBroadPhase()), cellSize);
+                    }
+                },
+            };
+        }
+
+        Bump::World bruteForce()
+        {
+            return Bump::World(std::unique_ptr<Bump::BroadPhase>(new BruteForceBroadPhase()), cellSize);
+        }
+
+        // Items of mixed sizes, from bullets to a few rects spanning dozens of cells
+        struct Scene
+        {
+            std::vector<int> ids;
+            std::vector<Bump::Item> items;
+            std::vector<Bump::Rectangle> rects;
+
+            Scene(const std::size_t &count, const unsigned &seed) : ids(count)
+            {
+                std::mt19937 rng(seed);
+                std::uniform_real_distribution<Bump::Number> position(-1000, 1000), size(1, 100), huge(200, 1500);
+                for (std::size_t i = 0; i < count; i++)
+                {
+                    items.push_back(&ids[i]);
+                    rects.push_back(Bump::Rectangle{ position(rng), position(rng), i % 50 == 0 ? huge(rng) : size(rng), size(rng) });
+                }
+            }
+
+            void addTo(Bump::World &world) const
+            {
+                for (std::size_t i = 0; i < items.size(); i++)
+                {
+                    world.add(items[i], rects[i].x, rects[i].y, rects[i].w, rects[i].h);
+                }
+            }
+        };
+
+        std::vector<Bump::Item> sorted(Bump::Items found)
+        {
+            std::vector<Bump::Item> items = std::move(std::get<0>(found));
+            std::sort(items.begin(), items.end());
+            return items;
+        }
+
+        // Runs the same random queries against both worlds and counts those that differ
+        std::size_t countQueryMismatches(const Bump::World &world, const Bump::World &expected, const unsigned &seed)
+        {
+            std::mt19937 rng(seed);
+            std::uniform_real_distribution<Bump::Number> position(-1200, 1200), size(0.5, 400);
+
+            std::size_t mismatches = 0;
+            for (int i = 0; i < 100; i++)
+            {
+                const Bump::Number x = position(rng), y = position(rng), w = size(rng), h = size(rng);
+                mismatches += sorted(world.queryRect(x, y, w, h)) != sorted(expected.queryRect(x, y, w, h));
+                mismatches += sorted(world.queryPoint(x, y)) != sorted(expected.queryPoint(x, y));
+
+                // Diagonal, then axis aligned along a cell border
+                const Bump::Number x2 = position(rng), y2 = position(rng);
+                mismatches += sorted(world.querySegment(x, y, x2, y2)) != sorted(expected.querySegment(x, y, x2, y2));
+                const Bump::Number border = std::floor(y / cellSize) * cellSize;
+                mismatches += sorted(world.querySegment(x, border, x2, border)) != sorted(expected.querySegment(x, border, x2, border));
+            }
+            return mismatches;
+        }
+
+        bool sameMovement(const Bump::Movement &a, const Bump::Movement &b)
+        {
+            const std::vector<Bump::Collision> &colsA = std::get<2>(a);
+            const std::vector<Bump::Collision> &colsB = std::get<2>(b);
+            if (std::abs(std::get<0>(a) - std::get<0>(b)) > 1e-9 ||
+                std::abs(std::get<1>(a) - std::get<1>(b)) > 1e-9 ||
+                colsA.size() != colsB.size())
+            {
+                return false;
+            }
+
+            for (std::size_t i = 0; i < colsA.size(); i++)
+            {
+                if (colsA[i].other != colsB[i].other || colsA[i].type != colsB[i].type)
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        Bump::Filter respondWith(const std::string &response)
+        {
+            return [response](const Bump::Item &, const Bump::Item &) { return response; };
+        }
+
+        const char *const responses[] = { "touch", "cross", "slide", "bounce", "oneWay" };
+
+        /// ------------------------------------------
+        /// -- Tests
+        /// ------------------------------------------
+        void queriesMatchBruteForce()
+        {
+            const Scene scene(2000, 1);
+            for (const Backend &backend : backends())
+            {
+                Bump::World world = backend.create();
+                Bump::World expected = bruteForce();
+                scene.addTo(world);
+                scene.addTo(expected);
+                BUMP_CHECK(countQueryMismatches(world, expected, 2) == 0);
+
+                // Moved, resized, removed and added back
+                std::mt19937 rng(3);
+                std::uniform_real_distribution<Bump::Number> step(-80, 80), size(1, 300);
+                for (std::size_t i = 0; i < scene.items.size(); i += 3)
+                {
+                    Bump::Number x, y, w, h;
+                    std::tie(x, y, w, h) = world.getRect(scene.items[i]);
+                    x += step(rng);
+                    y += step(rng);
+                    if (i % 7 == 0)
+                    {
+                        std::tie(w, h) = std::make_tuple(size(rng), size(rng));
+                    }
+                    world.update(scene.items[i], x, y, w, h);
+                    expected.update(scene.items[i], x, y, w, h);
+                }
+                for (std::size_t i = 1; i < scene.items.size(); i += 4)
+                {
+                    world.remove(scene.items[i]);
+                    expected.remove(scene.items[i]);
+                }
+                for (std::size_t i = 1; i < scene.items.size(); i += 8)
+                {
+                    const Bump::Rectangle &rect = scene.rects[i];
+                    world.add(scene.items[i], rect.x, rect.y, rect.w, rect.h);
+                    expected.add(scene.items[i], rect.x, rect.y, rect.w, rect.h);
+                }
+
+                BUMP_CHECK(countQueryMismatches(world, expected, 4) == 0);
+                BUMP_CHECK(world.countItems() == expected.countItems());
+            }
+        }
+
+        void moveMatchesMoveSubstepped()
+        {
+            const Scene walls(600, 5);
+            for (const char *response : responses)
+            {
+                Bump::World world(cellSize), substepped(cellSize);
+                walls.addTo(world);
+                walls.addTo(substepped);
+
+                std::vector<int> movers(50);
+                std::mt19937 rng(6);
+                std::uniform_real_distribution<Bump::Number> position(-1000, 1000), step(-300, 300);
+                for (int &mover : movers)
+                {
+                    const Bump::Number x = position(rng), y = position(rng);
+                    world.add(&mover, x, y, 8, 8);
+                    substepped.add(&mover, x, y, 8, 8);
+                }
+
+                const Bump::Filter filter = respondWith(response);
+                std::size_t mismatches = 0, misnamed = 0;
+                for (int frame = 0; frame < 10; frame++)
+                {
+                    for (int &mover : movers)
+                    {
+                        Bump::Number x, y, w, h;
+                        std::tie(x, y, w, h) = world.getRect(&mover);
+                        const Bump::Number goalX = x + step(rng), goalY = y + step(rng);
+                        const Bump::Movement movement = world.move(&mover, goalX, goalY, filter);
+                        mismatches += !sameMovement(movement, substepped.moveSubstepped(&mover, goalX, goalY, filter));
+                        for (const Bump::Collision &col : std::get<2>(movement))
+                        {
+                            misnamed += col.getTypeName() != response;
+                        }
+                    }
+                }
+                BUMP_CHECK(mismatches == 0);
+                BUMP_CHECK(misnamed == 0);
+            }
+        }
+
+        void moveMatchesSingleMoverMoveMany()
+        {
+            const Scene walls(600, 7);
+            for (const char *response : responses)
+            {
+                Bump::World world(cellSize), batched(cellSize);
+                walls.addTo(world);
+                walls.addTo(batched);
+
+                std::vector<int> movers(50);
+                std::mt19937 rng(8);
+                std::uniform_real_distribution<Bump::Number> position(-1000, 1000), step(-300, 300);
+                for (int &mover : movers)
+                {
+                    const Bump::Number x = position(rng), y = position(rng);
+                    world.add(&mover, x, y, 8, 8);
+                    batched.add(&mover, x, y, 8, 8);
+                }
+
+                const Bump::Filter filter = respondWith(response);
+                std::size_t mismatches = 0;
+                for (int frame = 0; frame < 10; frame++)
+                {
+                    for (int &mover : movers)
+                    {
+                        Bump::Number x, y, w, h;
+                        std::tie(x, y, w, h) = world.getRect(&mover);
+                        const Bump::Point goal{ x + step(rng), y + step(rng) };
+                        const std::vector<Bump::Movement> movements = batched.moveMany({ &mover }, { goal }, filter);
+                        mismatches += !sameMovement(world.move(&mover, goal.x, goal.y, filter), movements[0]);
+                    }
+                }
+                BUMP_CHECK(mismatches == 0);
+            }
+        }
+
+        void serializeRoundTrips()
+        {
+            const Scene scene(2000, 9);
+            for (const Backend &backend : backends())
+            {
+                Bump::World world = backend.create();
+                scene.addTo(world);
+                for (std::size_t i = 0; i < scene.items.size(); i += 5)
+                {
+                    world.remove(scene.items[i]);
+                }
+
+                std::vector<std::uint8_t> blob;
+                world.serialize(blob);
+                for (const Bump::Blob::Check &mode : { Bump::Blob::Check::Checksum, Bump::Blob::Check::Full })
+                {
+                    Bump::World restored = backend.create();
+                    restored.deserialize(blob, mode);
+
+                    BUMP_CHECK(restored.countItems() == world.countItems());
+                    BUMP_CHECK(restored.countCells() == world.countCells());
+                    bool same = true;
+                    for (const Bump::Item &item : world.getItems())
+                    {
+                        same = same && restored.hasItem(item) &&
+                            restored.getRect(item) == world.getRect(item) &&
+                            restored.getHandle(item) == world.getHandle(item);
+                    }
+                    BUMP_CHECK(same);
+                    BUMP_CHECK(countQueryMismatches(restored, world, 10) == 0);
+
+                    // Free slots come back too, so both hand out the same handles from here on
+                    int extra = 0;
+                    Bump::World copy = backend.create();
+                    copy.deserialize(blob);
+                    copy.add(&extra, 0, 0, 10, 10);
+                    restored.add(&extra, 0, 0, 10, 10);
+                    BUMP_CHECK(restored.getHandle(&extra) == copy.getHandle(&extra));
+                    BUMP_CHECK(countQueryMismatches(restored, copy, 11) == 0);
+                }
+            }
+
+            // Another backend cannot read it
+            Bump::World grid(cellSize);
+            std::vector<std::uint8_t> blob;
+            grid.serialize(blob);
+            Bump::World tree(std::unique_ptr<Bump::BroadPhase>(new Bump::AabbTreeBroadPhase()), cellSize);
+            BUMP_CHECK(throws<Bump::Exception::InvalidArgumentError>([&tree, &blob]() { tree.deserialize(blob); }));
+        }
+
+        void badBlobsLeaveWorldUntouched()
+        {
+            const Scene scene(500, 10);
+            int a = 0;
+            for (const Backend &backend : backends())
+            {
+                // Same layout, only the generation of a differs, so mixing the two
+                // leaves handles that disagree with the slots or the broad phase
+                Bump::World once = backend.create(), twice = backend.create();
+                once.add(&a, 0, 0, 10, 10);
+                twice.add(&a, 0, 0, 10, 10);
+                twice.remove(&a);
+                twice.add(&a, 0, 0, 10, 10);
+
+                std::vector<std::uint8_t> good, other;
+                once.serialize(good);
+                twice.serialize(other);
+                BUMP_CHECK(good.size() == other.size());
+
+                // Generation bytes only: padding and hash slot positions differ too, but
+                // swapping those may well leave a blob that is still consistent
+                std::size_t first = 0, last = 0;
+                for (std::size_t i = 0; i + sizeof(std::uint64_t) < good.size(); i++)
+                {
+                    if (good[i] == 1 && other[i] == 2)
+                    {
+                        first = first == 0 ? i : first;
+                        last = i;
+                    }
+                }
+
+                std::vector<std::vector<std::uint8_t>> blobs;
+                for (const std::size_t &size : { std::size_t(0), std::size_t(20), good.size() / 2, good.size() - 1 })
+                {
+                    blobs.emplace_back(good.begin(), good.begin() + size);
+                }
+                blobs.push_back(good);
+                blobs.back().push_back(0);
+
+                // Mixed ones fail the checksum, and once signed again the full check
+                std::vector<std::vector<std::uint8_t>> mixed;
+                mixed.push_back(good);
+                mixed.back()[first] = other[first];
+                mixed.push_back(other);
+                mixed.back()[last] = good[last];
+                blobs.insert(blobs.end(), mixed.begin(), mixed.end());
+
+                Bump::World world = backend.create(), expected = backend.create();
+                scene.addTo(world);
+                scene.addTo(expected);
+                for (const Bump::Blob::Check &mode : { Bump::Blob::Check::Checksum, Bump::Blob::Check::Full })
+                {
+                    for (const std::vector<std::uint8_t> &blob : blobs)
+                    {
+                        BUMP_CHECK(throws<Bump::Exception::InvalidArgumentError>([&]() { world.deserialize(blob, mode); }));
+                    }
+                }
+                for (std::vector<std::uint8_t> &blob : mixed)
+                {
+                    resign(blob);
+                    BUMP_CHECK(throws<Bump::Exception::InvalidArgumentError>([&]() { world.deserialize(blob, Bump::Blob::Check::Full); }));
+                }
+
+                BUMP_CHECK(world.countItems() == expected.countItems());
+                BUMP_CHECK(!world.hasItem(&a));
+                bool same = true;
+                for (const Bump::Item &item : expected.getItems())
+                {
+                    same = same && world.hasItem(item) &&
+                        world.getRect(item) == expected.getRect(item) &&
+                        world.getHandle(item) == expected.getHandle(item);
+                }
+                BUMP_CHECK(same);
+                BUMP_CHECK(countQueryMismatches(world, expected, 12) == 0);
+
+                // And it still takes a good one
+                world.deserialize(good);
+                BUMP_CHECK(world.countItems() == 1 && world.getHandle(&a) == once.getHandle(&a));
+            }
+
+            // A tree whose root names a free node
+            const auto createTree = []()
+            {
+                return Bump::World(std::unique_ptr<Bump::BroadPhase>(new Bump::AabbTreeBroadPhase(4)), cellSize);
+            };
+            Bump::World emptied = createTree();
+            emptied.add(&a, 0, 0, 10, 10);
+            const Bump::ItemHandle handle = emptied.getHandle(&a);
+            emptied.remove(&a);
+            std::vector<std::uint8_t> blob;
+            emptied.serialize(blob);
+
+            // The same tree on its own, which the world blob ends with before its checksum
+            Bump::AabbTreeBroadPhase mirror(4);
+            mirror.add(handle, Bump::Rectangle{ 0, 0, 10, 10 });
+            mirror.remove(handle, Bump::Rectangle{ 0, 0, 10, 10 });
+            std::vector<std::uint8_t> section;
+            mirror.save(section);
+            const std::size_t start = blob.size() - sizeof(std::uint64_t) - section.size();
+            BUMP_CHECK(blob.size() >= section.size() + sizeof(std::uint64_t)
+                && std::equal(section.begin(), section.end(), blob.begin() + start));
+
+            // Right after the backend kind and the margin
+            const std::int32_t root = 0;
+            std::memcpy(blob.data() + start + sizeof(std::uint32_t) + sizeof(Bump::Number), &root, sizeof(root));
+            resign(blob);
+
+            Bump::World world = createTree(), expected = createTree();
+            scene.addTo(world);
+            scene.addTo(expected);
+            BUMP_CHECK(throws<Bump::Exception::InvalidArgumentError>([&world, &blob]() { world.deserialize(blob, Bump::Blob::Check::Full); }));
+            BUMP_CHECK(countQueryMismatches(world, expected, 13) == 0);
+        }
+
+        void staleHandlesAreRejected()
+        {
+            Bump::World world(cellSize);
+            int a = 0, b = 0;
+
+            world.add(&a, 0, 0, 10, 10);
+            const Bump::ItemHandle handle = world.getHandle(&a);
+            BUMP_CHECK(world.hasHandle(handle));
+            BUMP_CHECK(world.getItem(handle) == &a);
+            BUMP_CHECK(!world.hasHandle(Bump::ItemHandle()));
+
+            world.setLayers(&a, Bump::Layers{ 2, 2 });
+            world.remove(&a);
+            BUMP_CHECK(!world.hasHandle(handle));
+            BUMP_CHECK(throws<Bump::Exception::NotFoundError>([&world, &handle]() { world.getItem(handle); }));
+            BUMP_CHECK(throws<Bump::Exception::NotFoundError>([&world, &handle]() { world.getRect(handle); }));
+            BUMP_CHECK(throws<Bump::Exception::NotFoundError>([&world, &handle]() { world.update(handle, 5, 5); }));
+
+            // The slot is reused under another generation
+            world.add(&b, 20, 20, 10, 10);
+            const Bump::ItemHandle reused = world.getHandle(&b);
+            BUMP_CHECK(reused.getIndex() == handle.getIndex());
+            BUMP_CHECK(reused != handle);
+            BUMP_CHECK(!world.hasHandle(handle));
+            BUMP_CHECK(world.getItem(reused) == &b);
+            BUMP_CHECK(world.getLayers(&b).category == Bump::Layers().category);
+            BUMP_CHECK(world.getLayers(&b).mask == Bump::Layers().mask);
+
+            world.clear();
+            BUMP_CHECK(!world.hasHandle(reused));
+            BUMP_CHECK(throws<Bump::Exception::NotFoundError>([&world, &reused]() { world.getItem(reused); }));
+
+            // The generation wraps instead of retiring the slot, so churn never grows the slots
+            world.add(&a, 0, 0, 10, 10);
+            const Bump::ItemHandle first = world.getHandle(&a);
+            bool sameSlot = true, fresh = true;
+            for (std::uint32_t i = 1; i < Bump::ItemHandle::maxGeneration; i++)
+            {
+                world.remove(&a);
+                world.add(&a, 0, 0, 10, 10);
+                sameSlot = sameSlot && world.getHandle(&a).getIndex() == first.getIndex();
+                fresh = fresh && world.getHandle(&a) != first;
+            }
+            BUMP_CHECK(sameSlot && fresh);
+            world.remove(&a);
+            world.add(&b, 0, 0, 10, 10);
+            BUMP_CHECK(world.getHandle(&b) == first);
+        }
+
+        void rejectedAddsTakeNoSlot()
+        {
+            Bump::World world(cellSize);
+            int a = 0, b = 0;
+
+            world.add(&a, 0, 0, 10, 10);
+            BUMP_CHECK(throws<Bump::Exception::InvalidArgumentError>([&world]() { world.add(nullptr, 0, 0, 10, 10); }));
+            BUMP_CHECK(throws<Bump::Exception::AlreadyExistsError>([&world, &a]() { world.add(&a, 5, 5, 10, 10); }));
+            BUMP_CHECK(throws<Bump::Exception::InvalidArgumentError>([&world, &b]() { world.add(&b, 5, 5, 0, 10); }));
+            BUMP_CHECK(world.countItems() == 1);
+
+            // The next item gets the slot right after the first one
+            world.add(&b, 20, 20, 10, 10);
+            BUMP_CHECK(world.getHandle(&b).getIndex() == world.getHandle(&a).getIndex() + 1);
+            BUMP_CHECK(std::get<0>(world.getRect(&a)) == 0);
+        }
+
+        void bakedGeometryIsChecked()
+        {
+            const std::string path = "bump_tests_geometry.bin";
+            int a = 0;
+            const std::vector<Bump::Item> items{ &a };
+            const auto bake = [&path, &items](const Bump::Rectangle &rect)
+            {
+                Bump::StaticGeometry::bake(path, items, { rect }, cellSize);
+            };
+            BUMP_CHECK(throws<Bump::Exception::InvalidArgumentError>([&bake]() { bake(Bump::Rectangle{ 0, 0, 0, 10 }); }));
+            BUMP_CHECK(throws<Bump::Exception::InvalidArgumentError>([&bake]() { bake(Bump::Rectangle{ 0, 0, 10, -1 }); }));
+
+            // Point the only cell past the end of the pool
+            const Bump::Rectangle rect{ 100 * cellSize, 100 * cellSize, 10, 10 };
+            bake(rect);
+            std::vector<char> file;
+            {
+                std::ifstream in(path, std::ios::binary);
+                file.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+            }
+            Bump::Number cx, cy;
+            std::tie(cx, cy) = Bump::Grid::toCell(cellSize, rect.x, rect.y);
+            Bump::Cell cell;
+            std::tie(cell.x, cell.y, cell.itemCount, cell.capacity) = std::make_tuple(
+                static_cast<Bump::Index>(cx), static_cast<Bump::Index>(cy), 1, 1);
+            const char *bytes = reinterpret_cast<const char*>(&cell);
+            auto found = std::search(file.begin(), file.end(), bytes, bytes + sizeof(cell));
+            BUMP_CHECK(found != file.end());
+            if (found != file.end())
+            {
+                cell.offset = 1;
+                std::copy(bytes, bytes + sizeof(cell), found);
+                std::ofstream(path, std::ios::binary | std::ios::trunc).write(file.data(), file.size());
+
+                const Bump::StaticGeometry geometry(path);
+                std::vector<Bump::Item> queried;
+                geometry.queryRect(rect, queried);
+                BUMP_CHECK(geometry.hasItem(&a) && queried.empty());
+            }
+            std::remove(path.c_str());
+        }
+
+        void batchesMatchOneAtATime()
+        {
+            const Scene scene(3000, 12);
+            for (const Backend &backend : backends())
+            {
+                Bump::World world = backend.create();
+                Bump::World bulk = backend.create();
+                scene.addTo(world);
+                bulk.addBulk(scene.items, scene.rects, 2);
+
+                bool sameHandles = true;
+                for (const Bump::Item &item : scene.items)
+                {
+                    sameHandles = sameHandles && bulk.getHandle(item) == world.getHandle(item);
+                }
+                BUMP_CHECK(sameHandles);
+                BUMP_CHECK(countQueryMismatches(bulk, world, 13) == 0);
+
+                std::vector<Bump::Item> removed;
+                for (std::size_t i = 0; i < scene.items.size(); i += 3)
+                {
+                    removed.push_back(scene.items[i]);
+                    world.remove(scene.items[i]);
+                }
+                bulk.removeMany(removed);
+                BUMP_CHECK(bulk.countItems() == world.countItems());
+                BUMP_CHECK(countQueryMismatches(bulk, world, 14) == 0);
+
+                // Several updates per item between queries
+                Bump::World deferred = backend.create();
+                deferred.addBulk(scene.items, scene.rects);
+                deferred.removeMany(removed);
+                deferred.setDeferredUpdates(true, 2);
+
+                std::mt19937 rng(15);
+                std::uniform_real_distribution<Bump::Number> step(-50, 50), size(1, 200);
+                for (int round = 0; round < 3; round++)
+                {
+                    for (std::size_t i = 1; i < scene.items.size(); i += 3)
+                    {
+                        Bump::Number x, y, w, h;
+                        std::tie(x, y, w, h) = world.getRect(scene.items[i]);
+                        std::tie(x, y) = std::make_tuple(x + step(rng), y + step(rng));
+                        if (round == 1)
+                        {
+                            std::tie(w, h) = std::make_tuple(size(rng), size(rng));
+                        }
+                        world.update(scene.items[i], x, y, w, h);
+                        deferred.update(scene.items[i], x, y, w, h);
+                    }
+                }
+                BUMP_CHECK(countQueryMismatches(deferred, world, 16) == 0);
+            }
+        }
+
+        void toCellRectsMatchesToCellRect()
+        {
+            std::mt19937 rng(17);
+            std::uniform_real_distribution<Bump::Number> position(-5000, 5000), size(0, 300);
+            std::uniform_int_distribution<int> cell(-100, 100);
+
+            // Every other rect sits exactly on cell borders, an odd count leaves a tail
+            std::vector<Bump::Rectangle> rects(1001);
+            for (std::size_t i = 0; i < rects.size(); i++)
+            {
+                rects[i] = i % 2 == 0
+                    ? Bump::Rectangle{ cell(rng) * cellSize, cell(rng) * cellSize, (i % 5) * cellSize, cell(rng) + 100.0 }
+                    : Bump::Rectangle{ position(rng), position(rng), size(rng), size(rng) };
+            }
+
+            std::vector<Bump::Index> left(rects.size()), top(rects.size()), right(rects.size()), bottom(rects.size());
+            Bump::Grid::toCellRects(cellSize, rects.data(), rects.size(), left.data(), top.data(), right.data(), bottom.data());
+
+            std::size_t mismatches = 0;
+            for (std::size_t i = 0; i < rects.size(); i++)
+            {
+                Bump::Number cl, ct, cw, ch;
+                std::tie(cl, ct, cw, ch) = Bump::Grid::toCellRect(cellSize, rects[i].x, rects[i].y, rects[i].w, rects[i].h);
+                mismatches += left[i] != cl || top[i] != ct || right[i] != cl + cw || bottom[i] != ct + ch;
+            }
+            BUMP_CHECK(mismatches == 0);
+        }
+
+        void concurrentProjectMatchesWorld()
+        {
+            const Scene scene(2000, 18);
+            Bump::World world(cellSize);
+            Bump::ConcurrentWorld concurrent(cellSize);
+            scene.addTo(world);
+            for (std::size_t i = 0; i < scene.items.size(); i++)
+            {
+                const Bump::Rectangle &rect = scene.rects[i];
+                concurrent.add(scene.items[i], rect.x, rect.y, rect.w, rect.h);
+            }
+
+            std::mt19937 rng(19);
+            std::uniform_real_distribution<Bump::Number> step(-300, 300);
+            const Bump::Filter filter = respondWith("slide");
+            std::size_t mismatches = 0;
+            for (std::size_t i = 0; i < scene.items.size(); i += 10)
+            {
+                const Bump::Rectangle &rect = scene.rects[i];
+                const Bump::Number goalX = rect.x + step(rng), goalY = rect.y + step(rng);
+                const Bump::Collisions expected = world.project(scene.items[i], rect.x, rect.y, rect.w, rect.h, goalX, goalY, filter);
+                const Bump::Collisions found = concurrent.project(scene.items[i], rect.x, rect.y, rect.w, rect.h, goalX, goalY, filter);
+
+                const std::vector<Bump::Collision> &a = std::get<0>(expected);
+                const std::vector<Bump::Collision> &b = std::get<0>(found);
+                bool same = a.size() == b.size();
+                for (std::size_t j = 0; same && j < a.size(); j++)
+                {
+                    same = a[j].other == b[j].other && a[j].ti == b[j].ti &&
+                        a[j].touch.x == b[j].touch.x && a[j].touch.y == b[j].touch.y &&
+                        a[j].normal.x == b[j].normal.x && a[j].normal.y == b[j].normal.y;
+                }
+                mismatches += !same;
+            }
+            BUMP_CHECK(mismatches == 0);
+        }
+
+        void traceWritesChromeJson()
+        {
+            const char *path = "bump_tests_trace.json";
+            int item = 0;
+            Bump::World world(cellSize);
+            world.add(&item, 0, 0, 10, 10);
+
+            Bump::Trace::clear();
+            {
+                const Bump::Trace::Span stopped("stopped", &item);
+            }
+            Bump::Trace::start();
+            BUMP_CHECK(Bump::Trace::isRunning());
+            {
+                const Bump::Trace::Span span("span", &item);
+            }
+            world.move(&item, 50, 0);
+            Bump::Trace::stop();
+            BUMP_CHECK(!Bump::Trace::isRunning());
+
+            BUMP_CHECK(Bump::Trace::write(path));
+            std::ifstream file(path);
+            const std::string json((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            file.close();
+            std::remove(path);
+            Bump::Trace::clear();
+
+            BUMP_CHECK(json.find("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n") == 0);
+            BUMP_CHECK(json.size() >= 4 && json.compare(json.size() - 4, 4, "\n]}\n") == 0);
+            BUMP_CHECK(json.find("\"name\":\"span\",\"cat\":\"bump\",\"ph\":\"X\"") != std::string::npos);
+            BUMP_CHECK(json.find("\"stopped\"") == std::string::npos);
+
+            // World operations only record spans when built with BUMP_TRACE
+#ifdef BUMP_ENABLE_TRACE
+            BUMP_CHECK(json.find("\"World::move\"") != std::string::npos);
+#else
+            BUMP_CHECK(json.find("\"World::move\"") == std::string::npos);
+#endif
+        }
+
+        void staticGeometryActsLikeItems()
+        {
+            const std::string path = "bump_tests_static.bin";
+            const Scene walls(1500, 18);
+            Bump::StaticGeometry::bake(path, walls.items, walls.rects, cellSize);
+            {
+                const auto geometry = std::make_shared<const Bump::StaticGeometry>(path);
+                BUMP_CHECK(geometry->countItems() == walls.items.size());
+                bool sameRects = true;
+                for (std::size_t i = 0; i < walls.items.size(); i++)
+                {
+                    const Bump::Rectangle *rect = geometry->getRect(walls.items[i]);
+                    sameRects = sameRects && rect != nullptr &&
+                        rect->x == walls.rects[i].x && rect->y == walls.rects[i].y &&
+                        rect->w == walls.rects[i].w && rect->h == walls.rects[i].h;
+                }
+                BUMP_CHECK(sameRects);
+
+                // Baked walls are queried and collided with like added ones
+                Bump::World world(cellSize), expected = bruteForce();
+                world.setStaticGeometry(geometry);
+                walls.addTo(expected);
+                BUMP_CHECK(world.countItems() == expected.countItems());
+                BUMP_CHECK(countQueryMismatches(world, expected, 19) == 0);
+
+                std::vector<int> movers(50);
+                std::mt19937 rng(20);
+                std::uniform_real_distribution<Bump::Number> position(-1000, 1000), step(-300, 300);
+                const Bump::Filter filter = respondWith("slide");
+                std::size_t mismatches = 0, collisions = 0;
+                for (int &mover : movers)
+                {
+                    const Bump::Number x = position(rng), y = position(rng);
+                    world.add(&mover, x, y, 8, 8);
+                    expected.add(&mover, x, y, 8, 8);
+                    const Bump::Number goalX = x + step(rng), goalY = y + step(rng);
+                    const Bump::Movement movement = world.move(&mover, goalX, goalY, filter);
+                    mismatches += !sameMovement(movement, expected.move(&mover, goalX, goalY, filter));
+                    collisions += std::get<2>(movement).size();
+                }
+                BUMP_CHECK(mismatches == 0 && collisions > 0);
+                BUMP_CHECK(countQueryMismatches(world, expected, 21) == 0);
+
+                // But they are not the world's to change
+                const Bump::Item &wall = walls.items[0];
+                BUMP_CHECK(throws<Bump::Exception::NotFoundError>([&world, &wall]() { world.remove(wall); }));
+                BUMP_CHECK(throws<Bump::Exception::NotFoundError>([&world, &wall]() { world.update(wall, 0, 0); }));
+                BUMP_CHECK(throws<Bump::Exception::AlreadyExistsError>([&world, &wall]() { world.add(wall, 0, 0, 10, 10); }));
+
+                Bump::World other(cellSize);
+                other.add(wall, 0, 0, 10, 10);
+                BUMP_CHECK(throws<Bump::Exception::AlreadyExistsError>([&other, &geometry]() { other.setStaticGeometry(geometry); }));
+            }
+            std::remove(path.c_str());
+        }
+
+        void snapshotsIgnoreLaterWrites()
+        {
+            const Scene scene(2000, 22);
+            Bump::World world(cellSize), frozen = bruteForce();
+            scene.addTo(world);
+            scene.addTo(frozen);
+            const std::shared_ptr<const Bump::Snapshot> snapshot = world.snapshot();
+
+            // Same random queries as countQueryMismatches, against the world as it was
+            const auto countMismatches = [&snapshot, &frozen](const unsigned &seed)
+            {
+                std::mt19937 rng(seed);
+                std::uniform_real_distribution<Bump::Number> position(-1200, 1200), size(0.5, 400);
+                std::size_t mismatches = 0;
+                for (int i = 0; i < 100; i++)
+                {
+                    const Bump::Number x = position(rng), y = position(rng), w = size(rng), h = size(rng);
+                    const Bump::Number x2 = position(rng), y2 = position(rng);
+                    mismatches += sorted(snapshot->queryRect(x, y, w, h)) != sorted(frozen.queryRect(x, y, w, h));
+                    mismatches += sorted(snapshot->queryPoint(x, y)) != sorted(frozen.queryPoint(x, y));
+                    mismatches += sorted(snapshot->querySegment(x, y, x2, y2)) != sorted(frozen.querySegment(x, y, x2, y2));
+                }
+                return mismatches;
+            };
+
+            // A reader keeps querying while the world moves, removes and adds items
+            std::size_t readerMismatches = 0;
+            std::thread reader([&countMismatches, &readerMismatches]()
+            {
+                for (unsigned seed = 23; seed < 28; seed++)
+                {
+                    readerMismatches += countMismatches(seed);
+                }
+            });
+            std::mt19937 rng(28);
+            std::uniform_real_distribution<Bump::Number> step(-80, 80);
+            for (std::size_t i = 0; i < scene.items.size(); i += 2)
+            {
+                Bump::Number x, y, w, h;
+                std::tie(x, y, w, h) = world.getRect(scene.items[i]);
+                world.update(scene.items[i], x + step(rng), y + step(rng));
+            }
+            for (std::size_t i = 1; i < scene.items.size(); i += 4)
+            {
+                world.remove(scene.items[i]);
+            }
+            std::vector<int> added(100);
+            for (int &item : added)
+            {
+                world.add(&item, step(rng), step(rng), 20, 20);
+            }
+            reader.join();
+            BUMP_CHECK(readerMismatches == 0);
+
+            BUMP_CHECK(countMismatches(29) == 0);
+            BUMP_CHECK(snapshot->countItems() == scene.items.size() && snapshot->hasItem(scene.items[1]) && !snapshot->hasItem(&added[0]));
+            BUMP_CHECK(snapshot->getRect(scene.items[0]) == frozen.getRect(scene.items[0]));
+
+            // A new snapshot sees the world as it is now
+            const std::shared_ptr<const Bump::Snapshot> later = world.snapshot();
+            BUMP_CHECK(later->getFrame() == snapshot->getFrame() + 1);
+            BUMP_CHECK(later->countItems() == world.countItems() && !later->hasItem(scene.items[1]) && later->hasItem(&added[0]));
+            bool sameRects = true;
+            for (const Bump::Item &item : world.getItems())
+            {
+                sameRects = sameRects && later->getRect(item) == world.getRect(item);
+            }
+            BUMP_CHECK(sameRects);
+        }
+
+        void moveManyMeetsMoversMidway()
+        {
+            // Head on: sequential moves let a stop where b started, moveMany meets them midway
+            Bump::World world(cellSize);
+            int a = 0, b = 0;
+            world.add(&a, 0, 0, 10, 10);
+            world.add(&b, 200, 0, 10, 10);
+            const std::vector<Bump::Movement> movements = world.moveMany({ &a, &b }, { { 190, 0 }, { 0, 0 } }, respondWith("touch"));
+            const Bump::Number meetX = 190 * 190 / 390.0;
+            BUMP_CHECK(std::abs(std::get<0>(movements[0]) - meetX) < 1e-9);
+            BUMP_CHECK(std::abs(std::get<0>(movements[1]) - (meetX + 10)) < 1e-9);
+            BUMP_CHECK(std::get<2>(movements[0]).size() == 1 && std::get<2>(movements[0])[0].other == &b);
+            BUMP_CHECK(std::get<2>(movements[1]).size() == 1 && std::get<2>(movements[1])[0].other == &a);
+
+            // Movers that do not overlap at the start get the same results in any order
+            for (const char *response : responses)
+            {
+                Bump::World ordered(cellSize), shuffled(cellSize);
+                std::vector<int> ids(400);
+                std::vector<Bump::Item> movers;
+                std::vector<Bump::Point> goals;
+                std::mt19937 rng(30);
+                std::uniform_real_distribution<Bump::Number> step(-100, 100);
+                for (std::size_t i = 0; i < ids.size(); i++)
+                {
+                    const Bump::Number x = (i % 20) * 40.0, y = (i / 20) * 40.0;
+                    ordered.add(&ids[i], x, y, 8, 8);
+                    shuffled.add(&ids[i], x, y, 8, 8);
+                    movers.push_back(&ids[i]);
+                    goals.push_back(Bump::Point{ x + step(rng), y + step(rng) });
+                }
+
+                const Bump::Filter filter = respondWith(response);
+                const std::vector<Bump::Movement> expected = ordered.moveMany(movers, goals, filter);
+                std::vector<std::size_t> order(movers.size());
+                for (std::size_t i = 0; i < order.size(); i++)
+                {
+                    order[i] = i;
+                }
+                std::shuffle(order.begin(), order.end(), rng);
+                std::vector<Bump::Item> shuffledMovers;
+                std::vector<Bump::Point> shuffledGoals;
+                for (const std::size_t &i : order)
+                {
+                    shuffledMovers.push_back(movers[i]);
+                    shuffledGoals.push_back(goals[i]);
+                }
+                const std::vector<Bump::Movement> actual = shuffled.moveMany(shuffledMovers, shuffledGoals, filter);
+
+                std::size_t mismatches = 0, collisions = 0;
+                for (std::size_t i = 0; i < order.size(); i++)
+                {
+                    mismatches += !sameMovement(actual[i], expected[order[i]]);
+                    collisions += std::get<2>(actual[i]).size();
+                }
+                BUMP_CHECK(mismatches == 0 && collisions > 0);
+            }
+        }
+
+        // Slides like Responses::Slide and counts the collisions it resolves
+        class CountingSlide : public Bump::ResponseHandler
+        {
+        public:
+            explicit CountingSlide(std::size_t &calls) : calls(calls)
+            {
+            }
+
+            Bump::Point resolve(Bump::ResponseContext &ctx, Bump::Collision &col) const override
+            {
+                calls++;
+                Bump::Point goal = col.touch;
+                if (col.move.x != 0 || col.move.y != 0)
+                {
+                    if (col.normal.x == 0)
+                    {
+                        goal.x = ctx.goalX;
+                    }
+                    else
+                    {
+                        goal.y = ctx.goalY;
+                    }
+                }
+                col.slide = goal;
+
+                ctx.project(col.item, col.touch.x, col.touch.y, goal.x, goal.y);
+                return goal;
+            }
+
+        private:
+            std::size_t &calls;
+        };
+
+        void responseHandlersReplaceBuiltIns()
+        {
+            const Scene walls(600, 31);
+            Bump::World world(cellSize), builtIn(cellSize);
+            walls.addTo(world);
+            walls.addTo(builtIn);
+
+            std::size_t calls = 0;
+            world.addResponse("slide", std::unique_ptr<Bump::ResponseHandler>(new CountingSlide(calls)));
+            BUMP_CHECK(throws<Bump::Exception::InvalidArgumentError>([&world]()
+            {
+                world.addResponse("none", std::unique_ptr<Bump::ResponseHandler>());
+            }));
+
+            std::vector<int> movers(50);
+            std::mt19937 rng(32);
+            std::uniform_real_distribution<Bump::Number> position(-1000, 1000), step(-300, 300);
+            for (int &mover : movers)
+            {
+                const Bump::Number x = position(rng), y = position(rng);
+                world.add(&mover, x, y, 8, 8);
+                builtIn.add(&mover, x, y, 8, 8);
+            }
+
+            const Bump::Filter filter = respondWith("slide");
+            std::size_t mismatches = 0, collisions = 0;
+            for (int frame = 0; frame < 10; frame++)
+            {
+                for (int &mover : movers)
+                {
+                    Bump::Number x, y, w, h;
+                    std::tie(x, y, w, h) = world.getRect(&mover);
+                    const Bump::Number goalX = x + step(rng), goalY = y + step(rng);
+                    const Bump::Movement movement = world.move(&mover, goalX, goalY, filter);
+                    mismatches += !sameMovement(movement, builtIn.move(&mover, goalX, goalY, filter));
+                    collisions += std::get<2>(movement).size();
+                }
+            }
+            BUMP_CHECK(mismatches == 0);
+            BUMP_CHECK(calls == collisions && calls > 0);
+        }
+
+        void layersSkipPairsBeforeTheFilter()
+        {
+            Bump::World world(cellSize);
+            int a = 0, wall = 0;
+            world.add(&a, 0, 0, 10, 10);
+            world.add(&wall, 20, 0, 10, 10);
+
+            std::size_t filterCalls = 0;
+            const Bump::Filter filter = [&filterCalls](const Bump::Item &, const Bump::Item &)
+            {
+                filterCalls++;
+                return std::string("touch");
+            };
+
+            // Either mask leaving out the other's category is enough
+            const Bump::Layers masks[][2] =
+            {
+                { Bump::Layers{ 1, ~2u }, Bump::Layers{ 2, ~0u } },
+                { Bump::Layers{ 1, ~0u }, Bump::Layers{ 2, ~1u } },
+            };
+            for (const auto &layers : masks)
+            {
+                world.setLayers(&a, layers[0]);
+                world.setLayers(&wall, layers[1]);
+                BUMP_CHECK(world.getLayers(&wall).category == 2 && world.getLayers(&wall).mask == layers[1].mask);
+
+                const Bump::Movement checked = world.check(&a, 40, 0, filter);
+                BUMP_CHECK(std::get<0>(checked) == 40 && std::get<2>(checked).empty());
+                const std::vector<Bump::Movement> batched = world.moveMany({ &a }, { Bump::Point{ 40, 0 } }, filter);
+                BUMP_CHECK(std::get<0>(batched[0]) == 40 && std::get<2>(batched[0]).empty());
+                world.update(&a, 0, 0);
+            }
+            BUMP_CHECK(filterCalls == 0);
+
+            // Layers only keep pairs from colliding, queries still see both
+            BUMP_CHECK(std::get<0>(world.queryRect(0, 0, 40, 10)).size() == 2);
+
+            // Sharing a bit both ways collides again
+            world.setLayers(&wall, Bump::Layers{ 2 | 1, ~0u });
+            const Bump::Movement moved = world.move(&a, 40, 0, filter);
+            BUMP_CHECK(std::get<0>(moved) == 10 && std::get<2>(moved).size() == 1 && filterCalls == 1);
+
+            int unknown = 0;
+            BUMP_CHECK(throws<Bump::Exception::NotFoundError>([&world, &unknown]() { world.setLayers(&unknown, Bump::Layers()); }));
+        }
+
+        void oneWayPlatformsOnlyStopLandings()
+        {
+            Bump::World world(cellSize);
+            int platform = 0, item = 0;
+            world.add(&platform, 0, 100, 100, 10);
+            world.add(&item, 40, 50, 10, 10);
+            const Bump::Filter filter = respondWith("oneWay");
+
+            // Falling onto the top side lands and slides along it
+            Bump::Movement movement = world.move(&item, 60, 120, filter);
+            BUMP_CHECK(std::get<0>(movement) == 60 && std::get<1>(movement) == 90);
+            BUMP_CHECK(std::get<2>(movement).size() == 1 && std::get<2>(movement)[0].normal.y == -1);
+
+            // Jumping through from below, and walking through from the side
+            const Bump::Point passes[][2] =
+            {
+                { Bump::Point{ 40, 150 }, Bump::Point{ 40, 50 } },
+                { Bump::Point{ -20, 102 }, Bump::Point{ 120, 102 } },
+            };
+            for (const auto &pass : passes)
+            {
+                world.update(&item, pass[0].x, pass[0].y);
+                movement = world.move(&item, pass[1].x, pass[1].y, filter);
+                BUMP_CHECK(std::get<0>(movement) == pass[1].x && std::get<1>(movement) == pass[1].y);
+                BUMP_CHECK(std::get<2>(movement).size() == 1 && std::get<2>(movement)[0].other == &platform);
+            }
+
+            // Still inside the platform after jumping through: keeps falling instead of landing
+            world.update(&item, 40, 95);
+            movement = world.move(&item, 40, 130, filter);
+            BUMP_CHECK(std::get<1>(movement) == 130);
+        }
+
+        struct Test
+        {
+            const char *name;
+            void (*run)();
+        };
+
+        const Test tests[] =
+        {
+            { "queriesMatchBruteForce", queriesMatchBruteForce },
+            { "moveMatchesMoveSubstepped", moveMatchesMoveSubstepped },
+            { "moveMatchesSingleMoverMoveMany", moveMatchesSingleMoverMoveMany },
+            { "serializeRoundTrips", serializeRoundTrips },
+            { "badBlobsLeaveWorldUntouched", badBlobsLeaveWorldUntouched },
+            { "staleHandlesAreRejected", staleHandlesAreRejected },
+            { "rejectedAddsTakeNoSlot", rejectedAddsTakeNoSlot },
+            { "bakedGeometryIsChecked", bakedGeometryIsChecked },
+            { "batchesMatchOneAtATime", batchesMatchOneAtATime },
+            { "toCellRectsMatchesToCellRect", toCellRectsMatchesToCellRect },
+            { "concurrentProjectMatchesWorld", concurrentProjectMatchesWorld },
+            { "traceWritesChromeJson", traceWritesChromeJson },
+            { "staticGeometryActsLikeItems", staticGeometryActsLikeItems },
+            { "snapshotsIgnoreLaterWrites", snapshotsIgnoreLaterWrites },
+            { "moveManyMeetsMoversMidway", moveManyMeetsMoversMidway },
+            { "responseHandlersReplaceBuiltIns", responseHandlersReplaceBuiltIns },
+            { "layersSkipPairsBeforeTheFilter", layersSkipPairsBeforeTheFilter },
+            { "oneWayPlatformsOnlyStopLandings", oneWayPlatformsOnlyStopLandings },
+        };
+    }
+
+    int run()
+    {
+        std::size_t failed = 0;
+        for (const Test &test : tests)
+        {
+            const std::size_t before = failures;
+            test.run();
+            failed += failures != before;
+            std::printf("%s %s\n", failures != before ? "FAIL" : "ok  ", test.name);
+        }
+        std::printf("%zu of %zu tests failed\n", failed, sizeof(tests) / sizeof(tests[0]));
+        return failed == 0 ? 0 : 1;
+    }
+}
+
+int main()
+{
+    return Tests::run();
+}